@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bam_concat.hpp"
+#include "timer.hpp"
+#include "binary_io.hpp"
+#include "failure.hpp"
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <zlib.h>
+#include <sys/stat.h>
+
+namespace po = boost::program_options;
+
+using namespace std;
+using namespace rnasequel;
+
+namespace {
+
+const size_t COPY_SIZE = 1 << 22;
+
+uint32_t le32(const uint8_t * p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint16_t le16(const uint8_t * p) {
+    return p[0] | (p[1] << 8);
+}
+
+// Length of the BAM header at the start of data, 0 if more data is needed
+size_t header_length(const std::vector<uint8_t> & data) {
+    size_t n = data.size();
+    if(n < 8) return 0;
+    size_t p = 8 + le32(&data[4]);
+    if(n < p + 4) return 0;
+    uint32_t nref = le32(&data[p]);
+    p += 4;
+    for(uint32_t i = 0; i < nref; i++){
+        if(n < p + 4) return 0;
+        p += 4 + le32(&data[p]) + 4;
+        if(n < p) return 0;
+    }
+    return p;
+}
+
+uint64_t file_size(const std::string & f) {
+    struct stat st;
+    if(stat(f.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+};
+
+void BamConcat::open(const std::string & fout) {
+    close();
+    out_.open(fout);
+    header_ = false;
+    refs_.clear();
+}
+
+void BamConcat::close() {
+    out_.close();
+}
+
+bool BamConcat::read_block_(FILE * in, std::vector<uint8_t> & data) {
+    uint8_t h[18];
+    if(fread(h, 1, sizeof(h), in) != sizeof(h)) return false;
+    if(h[0] != 31 || h[1] != 139 || h[2] != 8 || (h[3] & 4) == 0 || le16(h + 10) != 6 || h[12] != 'B' || h[13] != 'C') return false;
+    size_t bsize = le16(h + 16) + 1;
+    comp_.resize(bsize);
+    memcpy(&comp_[0], h, sizeof(h));
+    if(bsize < 26 || fread(&comp_[sizeof(h)], 1, bsize - sizeof(h), in) != bsize - sizeof(h)) return false;
+
+    size_t isize = le32(&comp_[bsize - 4]);
+    size_t start = data.size();
+    data.resize(start + isize);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -15) != Z_OK) return false;
+    zs.next_in   = &comp_[sizeof(h)];
+    zs.avail_in  = bsize - sizeof(h) - 8;
+    zs.next_out  = isize > 0 ? &data[start] : NULL;
+    zs.avail_out = isize;
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END && zs.total_out == isize;
+}
+
+void BamConcat::add(const std::string & fin) {
+    FILE * in = fopen(fin.c_str(), "rb");
+    if(in == NULL) fail("opening the bam file " + fin + " for reading");
+
+    // Only the blocks the header is in are inflated
+    std::vector<uint8_t> data;
+    size_t hlen = 0;
+    while((hlen = header_length(data)) == 0){
+        if(!read_block_(in, data)){
+            fclose(in);
+            fail("reading the header of " + fin + ", it isn't a BGZF compressed bam file");
+        }
+    }
+    if(data.size() < 4 || memcmp(&data[0], "BAM\1", 4) != 0){
+        fclose(in);
+        fail(fin + " isn't a bam file");
+    }
+
+    size_t rstart = 8 + le32(&data[4]);
+    if(!header_){
+        out_.write(&data[0], hlen);
+        refs_.assign(data.begin() + rstart, data.begin() + hlen);
+        header_ = true;
+    }else if(hlen - rstart != refs_.size() || memcmp(&data[rstart], &refs_[0], refs_.size()) != 0){
+        fclose(in);
+        fail(fin + " doesn't have the reference sequences of the first bam file");
+    }
+    if(hlen < data.size()) out_.write(&data[hlen], data.size() - hlen);
+
+    // The rest is copied up to the end of file marker
+    uint64_t pos = ftello(in);
+    uint64_t end = file_size(fin);
+    uint8_t  tail[sizeof(BgzfWriter::EOF_BLOCK)];
+    if(end >= pos + sizeof(tail) && fseeko(in, end - sizeof(tail), SEEK_SET) == 0 && 
+       fread(tail, 1, sizeof(tail), in) == sizeof(tail) && memcmp(tail, BgzfWriter::EOF_BLOCK, sizeof(tail)) == 0){
+        end -= sizeof(tail);
+    }
+    fseeko(in, pos, SEEK_SET);
+
+    std::vector<char> buf(COPY_SIZE);
+    while(pos < end){
+        size_t n = fread(&buf[0], 1, std::min<uint64_t>(buf.size(), end - pos), in);
+        if(n == 0) break;
+        out_.write_raw(&buf[0], n);
+        pos += n;
+    }
+    bool error = ferror(in) != 0;
+    fclose(in);
+    if(error) fail("reading the bam file " + fin);
+}
+
+void concat_init_options(int argc, char *argv[], po::variables_map & vm) {
+    po::options_description generic("Arguments");
+    generic.add_options()
+    ("output,o", po::value<string>(), "Output bam file")
+    ("help,h", "help message")
+    ;
+
+    po::options_description hidden("Hidden Options");
+    hidden.add_options()
+    ("inputs", po::value< vector<string> >(), "Input bam files")
+    ;
+
+    po::options_description cmdline_options;
+    cmdline_options.add(generic).add(hidden);
+
+    po::positional_options_description pd;
+    pd.add("inputs", -1);
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(pd).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "Usage: " << endl;
+        cout << "rnasequel " << string(argv[0]) << " [options] -o <out.bam> <in1.bam> <in2.bam> ...\n" << endl;
+        cout << generic << "\n";
+        exit(0);
+    }
+
+    bool error = false;
+
+    if(vm.count("output") == 0) {
+        cout << "An output bam file must be specified\n";
+        error = true;
+    }
+
+    if(vm.count("inputs") == 0) {
+        cout << "At least one input bam file must be specified\n";
+        error = true;
+    }else if(vm.count("output") > 0) {
+        // The output is truncated when it's opened, before the inputs are read
+        const vector<string> & inputs = vm["inputs"].as< vector<string> >();
+        for(size_t i = 0; i < inputs.size(); i++){
+            if(same_file(inputs[i], vm["output"].as<string>())) {
+                cout << "The output bam file " << inputs[i] << " is also an input\n";
+                error = true;
+                break;
+            }
+        }
+    }
+
+    if(error) exit(1);
+}
+
+int rnasequel::concat_bams(int argc, char *argv[]) {
+    po::variables_map vm;
+    concat_init_options(argc, argv, vm);
+    Timer ti("Total concatenation time");
+
+    const vector<string> & inputs = vm["inputs"].as< vector<string> >();
+    BamConcat out(vm["output"].as<string>());
+    for(size_t i = 0; i < inputs.size(); i++){
+        out.add(inputs[i]);
+    }
+    out.close();
+    return 0;
+}
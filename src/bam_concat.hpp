@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_BAM_CONCAT_HPP
+#define GW_BAM_CONCAT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include "bgzf_writer.hpp"
+
+namespace rnasequel {
+
+/**
+ * Joins BAM files by copying their compressed BGZF blocks
+ *
+ * The header of the first file is written once and the alignment blocks of
+ * every file are copied as they are. Only the block a header ends in is
+ * decompressed, its alignments are compressed again. The end of file
+ * markers of the inputs are dropped and a single one ends the output.
+ * The files have to share their reference sequences.
+ */
+class BamConcat {
+    public:
+        BamConcat() : header_(false) { }
+
+        BamConcat(const std::string & fout) : header_(false) {
+            open(fout);
+        }
+
+        ~BamConcat() {
+            try {
+                close();
+            } catch(const Failure &) {
+            }
+        }
+
+        void open(const std::string & fout);
+        // Appends the alignments of fin
+        void add(const std::string & fin);
+        void close();
+
+    private:
+        BamConcat(const BamConcat & c);
+        BamConcat & operator=(const BamConcat & c);
+
+        // Reads and inflates the block at the current position of in
+        bool read_block_(FILE * in, std::vector<uint8_t> & data);
+        BgzfWriter              out_;
+        // References of the first header, later files must match them
+        std::vector<uint8_t>    refs_;
+        bool                    header_;
+        std::vector<uint8_t>    comp_;
+};
+
+int concat_bams(int argc, char * argv[]);
+
+};
+
+#endif
@@ -0,0 +1,389 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bam_sort.hpp"
+#include "binary_io.hpp"
+#include "timer.hpp"
+#include "failure.hpp"
+#include <iostream>
+#include <algorithm>
+#include <queue>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <zlib.h>
+
+using namespace std;
+using namespace rnasequel;
+
+namespace {
+
+const size_t CORE_SIZE = 36;
+
+int32_t get32(const uint8_t * p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+void append32(std::vector<uint8_t> & buf, uint32_t v) {
+    uint8_t p[4];
+    memcpy(p, &v, 4);
+    buf.insert(buf.end(), p, p + 4);
+}
+
+// Unmapped reads without a reference end up last
+uint64_t sort_key(int32_t tid, int32_t pos) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(tid)) << 32) | static_cast<uint32_t>(pos + 1);
+}
+
+uint64_t record_key(const uint8_t * rec) {
+    return sort_key(get32(rec + 4), get32(rec + 8));
+}
+
+// End of the reference span of an encoded record (exclusive)
+int32_t record_end(const uint8_t * rec) {
+    int32_t  pos     = get32(rec + 8);
+    uint32_t l_qname = rec[12];
+    uint32_t n_cigar = rec[16] | (rec[17] << 8);
+    uint32_t flag    = rec[18] | (rec[19] << 8);
+    if(flag & BAM_FUNMAP) return pos + 1;
+
+    const uint8_t * c = rec + CORE_SIZE + l_qname;
+    int32_t len = 0;
+    for(uint32_t i = 0; i < n_cigar; i++){
+        uint32_t v  = get32(c + 4 * i);
+        uint32_t op = v & 0xf;
+        if(op == 0 || op == 2 || op == 3 || op == 7 || op == 8) len += v >> 4;
+    }
+    return pos + std::max(len, 1);
+}
+
+};
+
+void BaiBuilder::add(int32_t tid, int32_t pos, int32_t end, bool unmapped, uint64_t vbeg, uint64_t vend) {
+    if(tid < 0 || pos < 0 || static_cast<size_t>(tid) >= refs_.size()){
+        no_coor_++;
+        return;
+    }
+
+    Ref & r = refs_[tid];
+    if(r.mapped + r.unmapped == 0) r.beg = vbeg;
+    r.end = vend;
+    if(unmapped) r.unmapped++;
+    else r.mapped++;
+
+    // Chunks of a bin that start in the block the previous one ends in are joined
+    std::vector<chunk_t> & chunks = r.bins[bam_reg2bin(pos, end)];
+    if(!chunks.empty() && (chunks.back().second >> 16) == (vbeg >> 16)){
+        chunks.back().second = vend;
+    }else{
+        chunks.push_back(chunk_t(vbeg, vend));
+    }
+
+    size_t last = (end - 1) >> 14;
+    if(r.linear.size() <= last) r.linear.resize(last + 1, 0);
+    for(size_t w = pos >> 14; w <= last; w++){
+        if(r.linear[w] == 0) r.linear[w] = vbeg;
+    }
+}
+
+void BaiBuilder::save(const std::string & fout) const {
+    BinaryWrite bw(fout);
+    if(!bw) fail("opening the bam index " + fout + " for writing");
+
+    bw.write_n("BAI\1", 4);
+    bw.write<int32_t>(refs_.size());
+    for(size_t i = 0; i < refs_.size(); i++){
+        const Ref & r = refs_[i];
+        bool reads = r.mapped + r.unmapped > 0;
+        bw.write<int32_t>(r.bins.size() + (reads ? 1 : 0));
+        for(std::map<uint32_t, std::vector<chunk_t> >::const_iterator it = r.bins.begin(); it != r.bins.end(); ++it){
+            bw.write<uint32_t>(it->first);
+            bw.write<int32_t>(it->second.size());
+            for(size_t j = 0; j < it->second.size(); j++){
+                bw.write<uint64_t>(it->second[j].first);
+                bw.write<uint64_t>(it->second[j].second);
+            }
+        }
+        // Pseudo bin with the span and the read counts of the reference
+        if(reads){
+            bw.write<uint32_t>(37450);
+            bw.write<int32_t>(2);
+            bw.write<uint64_t>(r.beg);
+            bw.write<uint64_t>(r.end);
+            bw.write<uint64_t>(r.mapped);
+            bw.write<uint64_t>(r.unmapped);
+        }
+
+        // Empty windows point to the previous one
+        bw.write<int32_t>(r.linear.size());
+        uint64_t prev = 0;
+        for(size_t j = 0; j < r.linear.size(); j++){
+            if(r.linear[j] != 0) prev = r.linear[j];
+            bw.write<uint64_t>(prev);
+        }
+    }
+    bw.write<uint64_t>(no_coor_);
+}
+
+/**
+ * Sorted records of a run kept in memory or spilled to a file
+ */
+class BamSorter::Source {
+    public:
+        Source(const Run & run) : run_(&run), fp_(NULL), next_(0), rec_(NULL) { }
+
+        Source(const std::string & fin) : run_(NULL), file_(fin), next_(0), rec_(NULL) {
+            fp_ = gzopen(fin.c_str(), "rb");
+            if(fp_ == NULL) fail("opening the temporary sort file " + fin + " for reading");
+            gzbuffer(fp_, 1 << 16);
+        }
+
+        ~Source() {
+            if(fp_ != NULL) gzclose(fp_);
+        }
+
+        // Loads the next record, false at the end
+        bool next() {
+            if(run_ != NULL){
+                if(next_ == run_->entries.size()) return false;
+                rec_ = &run_->buf[run_->entries[next_++].offset];
+            }else{
+                buf_.resize(4);
+                int got = gzread(fp_, &buf_[0], 4);
+                // Only the end of a whole gzip stream ends the run, a damaged or cut off one is an error
+                int err = Z_OK;
+                gzerror(fp_, &err);
+                if(got == 0 && err == Z_OK && gzeof(fp_)) return false;
+                size_t len = got == 4 ? get32(&buf_[0]) : 0;
+                buf_.resize(4 + len);
+                if(got != 4 || gzread(fp_, &buf_[4], len) != static_cast<int>(len)){
+                    fail("reading the temporary sort file " + file_ + ", it's damaged or truncated");
+                }
+                rec_ = &buf_[0];
+            }
+            key_ = record_key(rec_);
+            return true;
+        }
+
+        uint64_t key() const {
+            return key_;
+        }
+
+        const uint8_t * record() const {
+            return rec_;
+        }
+
+        size_t size() const {
+            return 4 + get32(rec_);
+        }
+
+    private:
+        const Run             * run_;
+        std::string             file_;
+        gzFile                  fp_;
+        size_t                  next_;
+        std::vector<uint8_t>    buf_;
+        const uint8_t         * rec_;
+        uint64_t                key_;
+};
+
+// Writes the merged records to a temporary file
+class BamSorter::RunSink {
+    public:
+        RunSink(const std::string & fout) : fout_(fout) {
+            fp_ = gzopen(fout.c_str(), "wb1");
+            if(fp_ == NULL) fail("opening the temporary sort file " + fout + " for writing");
+            gzbuffer(fp_, 1 << 20);
+        }
+
+        // A sink that isn't closed is being abandoned, its errors don't matter
+        ~RunSink() {
+            if(fp_ != NULL) gzclose(fp_);
+        }
+
+        void operator()(const uint8_t * rec, size_t len) {
+            if(gzwrite(fp_, rec, len) != static_cast<int>(len)){
+                fail("writing the temporary sort file " + fout_ + ", the disk may be full");
+            }
+        }
+
+        void close() {
+            int r = gzclose(fp_);
+            fp_ = NULL;
+            if(r != Z_OK) fail("writing the temporary sort file " + fout_ + ", the disk may be full");
+        }
+
+    private:
+        std::string fout_;
+        gzFile      fp_;
+};
+
+// Writes the merged records to the bam file and indexes them
+class BamSorter::BamSink {
+    public:
+        BamSink(BgzfWriter & out, BaiBuilder & bai) : out_(out), bai_(bai) { }
+
+        void operator()(const uint8_t * rec, size_t len) {
+            uint64_t vbeg = out_.tell();
+            out_.write(rec, len);
+            uint32_t flag = rec[18] | (rec[19] << 8);
+            bai_.add(get32(rec + 4), get32(rec + 8), record_end(rec), (flag & BAM_FUNMAP) != 0, vbeg, out_.tell());
+        }
+
+    private:
+        BgzfWriter & out_;
+        BaiBuilder & bai_;
+};
+
+BamSorter::BamSorter(const std::string & fout, const BamHeader & bh, size_t num_threads, size_t budget) 
+    : fout_(fout), nrefs_(bh.size()), budget_(std::max<size_t>(budget / std::max<size_t>(num_threads, 1), 1 << 20)), nfiles_(0), open_(true)
+{
+    for(size_t i = 0; i < num_threads; i++) runs_.push_back(new Run());
+
+    const bam_header_t * h = bh.cstruct();
+    std::string text = sort_order_text(h->text, h->l_text, "coordinate");
+    header_.insert(header_.end(), "BAM\1", "BAM\1" + 4);
+    append32(header_, text.size());
+    header_.insert(header_.end(), text.begin(), text.end());
+    append32(header_, h->n_targets);
+    for(int32_t i = 0; i < h->n_targets; i++){
+        size_t len = strlen(h->target_name[i]) + 1;
+        append32(header_, len);
+        header_.insert(header_.end(), h->target_name[i], h->target_name[i] + len);
+        append32(header_, h->target_len[i]);
+    }
+}
+
+BamSorter::~BamSorter() {
+    close();
+    for(size_t i = 0; i < runs_.size(); i++) delete runs_[i];
+}
+
+void BamSorter::add(size_t thread, BamRead & r) {
+    Run & run = *runs_[thread];
+    bam1_t * b = run.data;
+    r.load_to_struct(b);
+
+    run.entries.push_back(Entry(sort_key(b->core.tid, b->core.pos), run.buf.size()));
+    append32(run.buf, CORE_SIZE - 4 + b->data_len);
+    append32(run.buf, b->core.tid);
+    append32(run.buf, b->core.pos);
+    append32(run.buf, (b->core.bin << 16) | (b->core.qual << 8) | b->core.l_qname);
+    append32(run.buf, (b->core.flag << 16) | b->core.n_cigar);
+    append32(run.buf, b->core.l_qseq);
+    append32(run.buf, b->core.mtid);
+    append32(run.buf, b->core.mpos);
+    append32(run.buf, b->core.isize);
+    run.buf.insert(run.buf.end(), b->data, b->data + b->data_len);
+
+    if(run.bytes() > budget_) spill_(run);
+}
+
+std::string BamSorter::run_name_() {
+    boost::mutex::scoped_lock lock(mtx_);
+    std::string fout = fout_ + ".sort" + std::to_string(nfiles_++) + ".tmp";
+    files_.push_back(fout);
+    return fout;
+}
+
+void BamSorter::spill_(Run & run) {
+    std::stable_sort(run.entries.begin(), run.entries.end());
+    {
+        Source  src(run);
+        RunSink sink(run_name_());
+        while(src.next()) sink(src.record(), src.size());
+        sink.close();
+    }
+    run.entries.clear();
+    run.buf.clear();
+}
+
+template <typename T>
+void BamSorter::merge_(std::vector<Source *> & sources, T & sink) {
+    // Ties keep the order of the sources
+    typedef std::pair<uint64_t, size_t> item_t;
+    std::priority_queue<item_t, std::vector<item_t>, std::greater<item_t> > heap;
+    for(size_t i = 0; i < sources.size(); i++){
+        if(sources[i]->next()) heap.push(item_t(sources[i]->key(), i));
+    }
+    while(!heap.empty()){
+        Source * s = sources[heap.top().second];
+        size_t   i = heap.top().second;
+        heap.pop();
+        sink(s->record(), s->size());
+        if(s->next()) heap.push(item_t(s->key(), i));
+    }
+}
+
+void BamSorter::discard() {
+    open_ = false;
+    for(size_t i = 0; i < files_.size(); i++) std::remove(files_[i].c_str());
+    files_.clear();
+}
+
+void BamSorter::close(std::ostream & log) {
+    if(!open_) return;
+    open_ = false;
+    Timer ti("Merging the sorted runs", log);
+
+    // Too many spilled runs are merged into bigger ones first
+    while(files_.size() > MAX_RUNS){
+        std::vector<std::string> group(files_.begin(), files_.begin() + MAX_RUNS);
+        files_.erase(files_.begin(), files_.begin() + MAX_RUNS);
+        std::vector<Source *> sources;
+        for(size_t i = 0; i < group.size(); i++) sources.push_back(new Source(group[i]));
+        {
+            RunSink sink(run_name_());
+            merge_(sources, sink);
+            sink.close();
+        }
+        for(size_t i = 0; i < group.size(); i++){
+            delete sources[i];
+            std::remove(group[i].c_str());
+        }
+    }
+
+    std::vector<Source *> sources;
+    for(size_t i = 0; i < files_.size(); i++) sources.push_back(new Source(files_[i]));
+    for(size_t i = 0; i < runs_.size(); i++){
+        std::stable_sort(runs_[i]->entries.begin(), runs_[i]->entries.end());
+        sources.push_back(new Source(*runs_[i]));
+    }
+
+    BgzfWriter out;
+    BaiBuilder bai(nrefs_);
+    out.open(fout_);
+    out.write(&header_[0], header_.size());
+    // The alignments start in a new block like samtools writes them
+    out.flush();
+    BamSink sink(out, bai);
+    merge_(sources, sink);
+    out.close();
+    bai.save(fout_ + ".bai");
+
+    for(size_t i = 0; i < sources.size(); i++) delete sources[i];
+    for(size_t i = 0; i < files_.size(); i++) std::remove(files_[i].c_str());
+    files_.clear();
+    for(size_t i = 0; i < runs_.size(); i++){
+        std::vector<uint8_t>().swap(runs_[i]->buf);
+        std::vector<Entry>().swap(runs_[i]->entries);
+    }
+}
@@ -0,0 +1,140 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_BAM_SORT_HPP
+#define GW_BAM_SORT_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include "read.hpp"
+#include "header.hpp"
+#include "bgzf_writer.hpp"
+
+namespace rnasequel {
+
+/**
+ * Bam index (.bai) built from the virtual offsets of coordinate sorted records
+ */
+class BaiBuilder {
+    public:
+        BaiBuilder(size_t nrefs = 0) : no_coor_(0) {
+            refs_.resize(nrefs);
+        }
+
+        // The record [pos, end) of reference tid is stored from beg up to end
+        void add(int32_t tid, int32_t pos, int32_t end, bool unmapped, uint64_t vbeg, uint64_t vend);
+        void save(const std::string & fout) const;
+
+    private:
+        typedef std::pair<uint64_t, uint64_t> chunk_t;
+
+        struct Ref {
+            Ref() : beg(0), end(0), mapped(0), unmapped(0) { }
+
+            std::map<uint32_t, std::vector<chunk_t> >   bins;
+            std::vector<uint64_t>                       linear;
+            uint64_t                                    beg;
+            uint64_t                                    end;
+            uint64_t                                    mapped;
+            uint64_t                                    unmapped;
+        };
+
+        std::vector<Ref>    refs_;
+        uint64_t            no_coor_;
+};
+
+/**
+ * Coordinate sorting bam writer
+ *
+ * Every thread encodes its reads into its own run, a run that outgrows its
+ * share of the memory budget is sorted by (tid, pos) and spilled to a
+ * compressed temporary file. close() merges the runs left in memory with the
+ * spilled ones into the bam file and builds its index (<fout>.bai) in the
+ * same pass. Unmapped reads without a position end the file.
+ */
+class BamSorter {
+    public:
+        // At most MAX_RUNS spilled runs are merged at once
+        static const size_t MAX_RUNS = 256;
+
+        BamSorter(const std::string & fout, const BamHeader & bh, size_t num_threads, size_t budget);
+        ~BamSorter();
+
+        // Only one thread may add to a thread index at a time
+        void add(size_t thread, BamRead & r);
+        void close(std::ostream & log = std::cout);
+        // Removes the spilled runs without writing the bam file
+        void discard();
+
+    private:
+        BamSorter(const BamSorter & s);
+        BamSorter & operator=(const BamSorter & s);
+
+        struct Entry {
+            Entry(uint64_t k, uint64_t o) : key(k), offset(o) { }
+
+            bool operator<(const Entry & e) const {
+                return key < e.key;
+            }
+
+            uint64_t key;
+            uint64_t offset;
+        };
+
+        struct Run {
+            Run() : data(bam_init1()) { }
+            ~Run() { bam_destroy1(data); }
+
+            size_t bytes() const {
+                return buf.size() + entries.size() * sizeof(Entry);
+            }
+
+            bam1_t                * data;
+            std::vector<uint8_t>    buf;
+            std::vector<Entry>      entries;
+        };
+
+        class Source;
+        class RunSink;
+        class BamSink;
+
+        void spill_(Run & run);
+        std::string run_name_();
+
+        template <typename T>
+        void merge_(std::vector<Source *> & sources, T & sink);
+
+        std::string                 fout_;
+        std::vector<uint8_t>        header_;
+        size_t                      nrefs_;
+        size_t                      budget_;
+        std::vector<Run *>          runs_;
+        std::vector<std::string>    files_;
+        size_t                      nfiles_;
+        boost::mutex                mtx_;
+        bool                        open_;
+};
+
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bgzf_writer.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <zlib.h>
+
+using namespace std;
+using namespace rnasequel;
+
+const uint8_t BgzfWriter::EOF_BLOCK[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+namespace {
+
+void put16(uint8_t * p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+void put32(uint8_t * p, uint32_t v) {
+    for(size_t i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xff;
+}
+
+};
+
+void BgzfWriter::open(const std::string & fout, int level) {
+    close();
+    fout_    = fout;
+    level_   = level;
+    address_ = 0;
+    out_     = fopen(fout.c_str(), "wb");
+    if(out_ == NULL) {
+        fail("opening the bam file " + fout + " for writing");
+    }
+    buf_.clear();
+    buf_.reserve(BLOCK_INPUT);
+    block_.resize(BLOCK_MAX);
+}
+
+void BgzfWriter::close() {
+    if(out_ != NULL) {
+        flush();
+        write_(EOF_BLOCK, sizeof(EOF_BLOCK));
+        bool ok = fclose(out_) == 0;
+        out_ = NULL;
+        if(!ok) fail("writing the bam file " + fout_);
+    }
+}
+
+void BgzfWriter::write_(const void * data, size_t len) {
+    if(fwrite(data, 1, len, out_) != len) {
+        fclose(out_);
+        out_ = NULL;
+        fail("writing the bam file " + fout_);
+    }
+}
+
+void BgzfWriter::write(const void * data, size_t len) {
+    const uint8_t * p = static_cast<const uint8_t *>(data);
+    while(len > 0){
+        size_t n = std::min(len, BLOCK_INPUT - buf_.size());
+        buf_.insert(buf_.end(), p, p + n);
+        if(buf_.size() == BLOCK_INPUT) flush();
+        p   += n;
+        len -= n;
+    }
+}
+
+void BgzfWriter::flush() {
+    if(buf_.empty()) return;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in   = &buf_[0];
+    zs.avail_in  = buf_.size();
+    zs.next_out  = &block_[18];
+    zs.avail_out = BLOCK_MAX - 18 - 8;
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END){
+        deflateEnd(&zs);
+        fail("compressing a block of " + fout_);
+    }
+    size_t bsize = 18 + zs.total_out + 8;
+    deflateEnd(&zs);
+
+    memcpy(&block_[0], EOF_BLOCK, 16);
+    put16(&block_[16], bsize - 1);
+    put32(&block_[bsize - 8], crc32(crc32(0, NULL, 0), &buf_[0], buf_.size()));
+    put32(&block_[bsize - 4], buf_.size());
+    write_(&block_[0], bsize);
+    address_ += bsize;
+    buf_.clear();
+}
+
+void BgzfWriter::write_raw(const void * data, size_t len) {
+    flush();
+    write_(data, len);
+    address_ += len;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_BGZF_WRITER_HPP
+#define GW_BGZF_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include "failure.hpp"
+
+namespace rnasequel {
+
+/**
+ * BGZF block compressor with virtual file offsets
+ *
+ * Data is compressed into blocks of at most BLOCK_INPUT bytes, tell() is the
+ * virtual offset (block address << 16 | offset in the block) of the next
+ * byte written, the offsets bam indexes point to.
+ */
+class BgzfWriter {
+    public:
+        static const size_t BLOCK_INPUT = 0xff00;
+        static const size_t BLOCK_MAX   = 0x10000;
+        static const uint8_t EOF_BLOCK[28];
+
+        BgzfWriter() : out_(NULL), level_(-1), address_(0) { }
+
+        // Only reached without close() when another error is unwound, a
+        // write error here can't be thrown as well
+        ~BgzfWriter() {
+            try {
+                close();
+            } catch(const Failure &) {
+            }
+        }
+
+        void open(const std::string & fout, int level = -1);
+        // Flushes the last block and writes the end of file marker
+        void close();
+
+        void write(const void * data, size_t len);
+        // Compresses the buffered data into a block
+        void flush();
+        // Copies already compressed blocks as they are
+        void write_raw(const void * data, size_t len);
+
+        uint64_t tell() const {
+            return (address_ << 16) | buf_.size();
+        }
+
+        bool is_open() const {
+            return out_ != NULL;
+        }
+
+    private:
+        BgzfWriter(const BgzfWriter & w);
+        BgzfWriter & operator=(const BgzfWriter & w);
+
+        // Fails on a short write, the file is closed first
+        void write_(const void * data, size_t len);
+
+        FILE                  * out_;
+        std::string             fout_;
+        int                     level_;
+        uint64_t                address_;
+        std::vector<uint8_t>    buf_;
+        std::vector<uint8_t>    block_;
+};
+
+};
+
+#endif
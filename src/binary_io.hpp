@@ -24,9 +24,18 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdint.h>
 #include <cstdlib>
 #include <cstdio>
+#include <sys/stat.h>
 
 namespace rnasequel {
 
+// True if a and b name the same file, b doesn't have to exist
+inline bool same_file(const std::string & a, const std::string & b) {
+    struct stat sa, sb;
+    if(a == b) return true;
+    if(stat(a.c_str(), &sa) != 0 || stat(b.c_str(), &sb) != 0) return false;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
 class BinaryWrite {
     public:
         BinaryWrite(const std::string &file) {
@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "buffered_writer.hpp"
+#include <iostream>
+#include <cstdlib>
+
+using namespace rnasequel;
+using namespace std;
+
+bool BufferedWriter::open(const std::string & fout) {
+    close();
+    out_ = fopen(fout.c_str(), "wb");
+    if(out_ == NULL) return false;
+    fout_  = fout;
+    buf_.resize(BUFFER);
+    size_  = 0;
+    done_  = false;
+    error_ = false;
+    thread_ = boost::thread(boost::ref(*this));
+    return true;
+}
+
+void BufferedWriter::close() {
+    if(out_ == NULL) return;
+    flush_();
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+        done_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+    bool error = fclose(out_) != 0 || error_;
+    out_ = NULL;
+    if(error) write_error_();
+    full_.clear();
+    free_.clear();
+    std::vector<char>().swap(buf_);
+}
+
+void BufferedWriter::write_error_() {
+    cout << "Error writing the file `" << fout_ << "`\n";
+    exit(1);
+}
+
+void BufferedWriter::flush_() {
+    if(size_ == 0) return;
+    boost::mutex::scoped_lock lock(mtx_);
+    while(full_.size() >= PENDING) cond_.wait(lock);
+    if(error_) write_error_();
+
+    full_.push_back(std::make_pair(std::vector<char>(), size_));
+    full_.back().first.swap(buf_);
+    if(!free_.empty()) {
+        buf_.swap(free_.back());
+        free_.pop_back();
+    } else {
+        buf_.resize(BUFFER);
+    }
+    size_ = 0;
+    cond_.notify_all();
+}
+
+void BufferedWriter::operator()() {
+    std::vector<char> buf;
+    size_t            n = 0;
+    while(true) {
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            if(n > 0) {
+                free_.push_back(std::vector<char>());
+                free_.back().swap(buf);
+                cond_.notify_all();
+            }
+            while(full_.empty() && !done_) cond_.wait(lock);
+            if(full_.empty()) return;
+            buf.swap(full_.front().first);
+            n = full_.front().second;
+            full_.pop_front();
+            cond_.notify_all();
+        }
+        // After a failed write the buffers are only drained, the error is reported by the caller
+        if(!error_ && fwrite(&buf[0], 1, n, out_) != n) {
+            boost::mutex::scoped_lock lock(mtx_);
+            error_ = true;
+        }
+    }
+}
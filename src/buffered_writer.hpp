@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_BUFFERED_WRITER_HPP
+#define GW_BUFFERED_WRITER_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace rnasequel {
+
+/**
+  * Text file writer that formats into large buffers and writes the full
+  * buffers to the file on a background thread
+  *
+  * At most PENDING buffers are queued so a slow disk blocks the caller
+  * instead of growing the memory. A failed write is reported and exits
+  * when the next buffer is queued or the file is closed.
+  */
+class BufferedWriter {
+    public:
+        static const size_t BUFFER  = 1UL << 22;
+        static const size_t PENDING = 4;
+
+        BufferedWriter() : out_(NULL), size_(0), done_(false), error_(false) { }
+
+        ~BufferedWriter() {
+            close();
+        }
+
+        bool open(const std::string & fout);
+        void close();
+
+        bool is_open() const {
+            return out_ != NULL;
+        }
+
+        // Space for n characters, commit() the number actually written
+        char * reserve(size_t n) {
+            if(size_ + n > buf_.size()) {
+                flush_();
+                if(n > buf_.size()) buf_.resize(n);
+            }
+            return &buf_[size_];
+        }
+
+        void commit(size_t n) {
+            size_ += n;
+        }
+
+        void write(const char * s, size_t n) {
+            memcpy(reserve(n), s, n);
+            size_ += n;
+        }
+
+        void write(const std::string & s) {
+            write(s.c_str(), s.size());
+        }
+
+        void put(char c) {
+            *reserve(1) = c;
+            size_++;
+        }
+
+        void write_uint(uint64_t v) {
+            char   tmp[20];
+            size_t n = 0;
+            do {
+                tmp[n++] = '0' + (v % 10);
+                v /= 10;
+            } while(v);
+            char * out = reserve(n);
+            for(size_t i = 0; i < n; i++) out[i] = tmp[n - i - 1];
+            size_ += n;
+        }
+
+        void operator()();
+
+    private:
+        BufferedWriter(const BufferedWriter & w);
+        BufferedWriter & operator=(const BufferedWriter & w);
+
+        // Queues the current buffer and takes a free one
+        void flush_();
+        void write_error_();
+
+        std::string                        fout_;
+        FILE                             * out_;
+        std::vector<char>                  buf_;
+        size_t                             size_;
+
+        // Full buffers with their sizes and the buffers that were written
+        std::deque< std::pair<std::vector<char>, size_t> > full_;
+        std::vector< std::vector<char> >   free_;
+        bool                               done_;
+        // Set by the writer thread when a write fails
+        bool                               error_;
+
+        boost::mutex                       mtx_;
+        boost::condition_variable          cond_;
+        boost::thread                      thread_;
+};
+
+};
+
+#endif
@@ -21,6 +21,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
 
 using namespace rnasequel;
 using namespace std;
@@ -44,38 +45,43 @@ struct GroupSizeComp {
     }
 };
 
-bool FragmentOverlap::_check(_junc_list::iterator it, _junc_list::iterator it2) {
-    int64_t s = (*it)->spans(**it2);
-    // it2 is not spanned by it1
+bool FragmentOverlap::_check(FragmentSet *c, FragmentSet *j) {
+    int64_t s = c->spans(*j);
+    // j is not spanned by c
     if(s == -1) return false;
-    size_t ss = s + (*it2)->size();
+    size_t ss = s + j->size();
 
     // Take the smallest lft if the first block
-    if(s == 0 && (*it)->lft() > (*it2)->lft()) {
-        //cout << "Old Lft: " << (*it)->lft();
-        (*it)->set_lft((*it2)->lft());
+    if(s == 0 && c->lft() > j->lft()) {
+        c->set_lft(j->lft());
         // Adjust the blocks position
-        (*it)->front().lft = (*it2)->lft();
-        //cout << "  New Lft: " << (*it2)->lft() << "\n";
-        //cout << **it;
-        // Take max rgt position for the very last block
-    } else if(ss == (*it)->size() && (*it)->rgt() < (*it2)->rgt()) {
-        //cout << "Old Rgt: " << (*it)->rgt() << "  ";
-        (*it)->set_rgt((*it2)->rgt());
-        //cout << "New Rgt: " << (*it2)->rgt() << "\n";
+        c->front().lft = j->lft();
+    }
+    // Take max rgt position for the very last block
+    if(ss == c->size() && c->rgt() < j->rgt()) {
+        c->set_rgt(j->rgt());
         // Adjust the blocks position
-        (*it)->back().rgt = (*it2)->rgt();
-        //cout << **it;
+        c->back().rgt = j->rgt();
     }
-    if((*it)->strand() != (*it2)->strand()) {
-        (*it)->set_strand(BOTH);
+    if(c->strand() != j->strand()) {
+        c->set_strand(BOTH);
     }
     return true;
 }
 
+// A junction is the rgt of a block and the lft of the next block
+static uint64_t junc_key(const FragmentBlock & a, const FragmentBlock & b) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(a.rgt)) << 32) | static_cast<uint32_t>(b.lft);
+}
+
+/*
+  A set can only be spanned by a set that has its first junction so every
+  junction is indexed once and each set is only checked against the sets
+  sharing its first junction. Sets are removed smallest first, anything a
+  removed set contains is also contained in the set that absorbed it.
+*/
 void FragmentOverlap::merge() {
     _juncs.sort(GroupComp());
-    //cout << "Size before unique: " << _juncs.size() << "\n";
     _junc_list::iterator it = _juncs.begin(), it2 = it;
     it2++;
     while(it2 != _juncs.end()) {
@@ -83,29 +89,52 @@ void FragmentOverlap::merge() {
             if((*it)->strand() != (*it2)->strand()) {
                 (*it)->set_strand(BOTH);
             }
+            delete *it2;
             it2 = _juncs.erase(it2);
         } else {
-            if(_check(it,it2)) {
-                it2 = _juncs.erase(it2);
-            } else {
-                it++;
-                it2++;
-            }
+            it++;
+            it2++;
         }
     }
 
-    // This is horrible and slow but it seems necessary to remove as much redundency as possible
-    for(it = _juncs.begin(); it != _juncs.end(); ++it) {
-        it2 = it;
-        it2++;
-        for(it2 = _juncs.begin(); it2 != _juncs.end(); ++it2) {
-            if(it == it2) continue;
-            if(_check(it,it2)) {
-                it2 = _juncs.erase(it2);
+    std::vector<FragmentSet*> sets(_juncs.begin(), _juncs.end());
+    std::vector<bool>         removed(sets.size(), false);
+    std::unordered_map<uint64_t, std::vector<size_t> > index;
+    for(size_t i = 0; i < sets.size(); ++i) {
+        const FragmentSet & f = *sets[i];
+        for(size_t k = 1; k < f.size(); ++k) {
+            index[junc_key(f[k - 1], f[k])].push_back(i);
+        }
+    }
+
+    std::vector<size_t> order(sets.size());
+    for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&sets](size_t a, size_t b) {
+        return sets[a]->size() < sets[b]->size();
+    });
+
+    for(size_t o = 0; o < order.size(); ++o) {
+        size_t i = order[o];
+        const FragmentSet & f = *sets[i];
+        if(f.size() < 2) continue;
+        const std::vector<size_t> & cands = index[junc_key(f[0], f[1])];
+        for(size_t c = 0; c < cands.size(); ++c) {
+            if(cands[c] == i || removed[cands[c]]) continue;
+            if(_check(sets[cands[c]], sets[i])) {
+                removed[i] = true;
+                break;
             }
         }
     }
-    //cout << "\n";
+
+    _juncs.clear();
+    for(size_t i = 0; i < sets.size(); ++i) {
+        if(!removed[i]) {
+            _juncs.push_back(sets[i]);
+        } else {
+            delete sets[i];
+        }
+    }
 }
 
 BuildFragments::~BuildFragments() {
@@ -63,7 +63,7 @@ class FragmentOverlap {
 
     private:
         typedef std::list<FragmentSet*> _junc_list;
-        bool _check(_junc_list::iterator it1, _junc_list::iterator it2);
+        bool _check(FragmentSet *container, FragmentSet *s);
 
         _junc_list _juncs;
         pos_t      _lft;
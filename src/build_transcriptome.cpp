@@ -19,10 +19,17 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "build_transcriptome.hpp"
 #include <iomanip>
+#include <algorithm>
+#include "timer.hpp"
+#include "tokenizer.hpp"
 
 using namespace std;
 using namespace rnasequel;
 
+static bool lft_cmp(unsigned int pos, const Junction & j) {
+    return pos < j.lft;
+}
+
 void Transcriptome::process_junctions(const JunctionSet & juncs, Strand strand) {
     size_t start = index_;
     strand_ = strand;
@@ -34,6 +41,7 @@ void Transcriptome::process_junctions(const JunctionSet & juncs, Strand strand)
     }
 
     build_locuses_();
+    reuse_locuses_();
     
     size_t m  = 0;
     size_t mp = 0;
@@ -42,35 +50,93 @@ void Transcriptome::process_junctions(const JunctionSet & juncs, Strand strand)
     }
     cout << "Total locuses on the " << strand2char[strand] << " strand: " << locuses_.size() << " Maximum Juncs in a locus: " << m << "\n";
     /*
-      Write single junctions first
+      Enumerate the locus paths in windows on the worker threads and write
+      each window in locus order so the path ids don't depend on the thread count
     */
-    for(auto const & j : juncs_){
-        JunctionLocus tmp(j, j.lft, j.rgt);
-        IndexVect     path;
-        path.push_back(0);
-        write_paths_(path, tmp);
+    std::vector<PathWorker*> threads(threads_);
+    for(size_t i = 0; i < threads.size(); i++){
+        threads[i] = new PathWorker(*this);
     }
 
+    const size_t WINDOW = 64 * threads.size();
+    for(size_t w = 0; w < locuses_.size(); w += WINDOW){
+        size_t wend = std::min(w + WINDOW, locuses_.size());
+        std::atomic<size_t> next(w);
+        results_.resize(wend - w);
+        for(size_t i = 0; i < threads.size(); i++){
+            threads[i]->init(locuses_, results_, next, w, wend);
+        }
+        for(size_t i = 1; i < threads.size(); i++){
+            threads[i]->start();
+        }
+        threads[0]->operator()();
+        for(size_t i = 1; i < threads.size(); i++){
+            threads[i]->join();
+        }
 
-    for(size_t i = 0; i < locuses_.size(); i++){
-	build_graph_(locuses_[i]);
-	mp = std::max(paths_.size(), mp);
-	if(paths_.size() == max_iter_) {
-	    cout << "**Locus Number of junctions: " << locuses_[i].size()
-		 << " Position: " << fi_.at(locuses_[i].tid()).id << ":" << locuses_[i].lft << "-" << locuses_[i].rgt << "\n";
-	    cout << "    Max iterations reached kept: " << paths_.size() << " paths\n";
-	}
+        for(size_t i = w; i < wend; i++){
+            const PathList & paths = results_[i - w];
+            mp = std::max(paths.size(), mp);
 
-	for(size_t j = 0; j < paths_.size(); j++){
-            if(paths_[j].size() > 1){
-                write_paths_(paths_[j], locuses_[i]);
+            write_locus_(locuses_[i]);
+            if(reuse_[i] >= 0){
+                write_paths_(reuse_paths_(prev_[reuse_[i]]));
+                continue;
             }
-	}
+
+            // Single junctions first followed by the multi junction paths
+            size_t n = 0;
+            IndexVect single(1, 0);
+            for(size_t j = 0; j < locuses_[i].size(); j++){
+                if(pseqs_.size() <= n) pseqs_.resize(n + 1);
+                single[0] = j;
+                build_path_(single, locuses_[i], pseqs_[n++]);
+            }
+            for(size_t j = 0; j < paths.size(); j++){
+                if(paths[j].size() > 1){
+                    if(pseqs_.size() <= n) pseqs_.resize(n + 1);
+                    build_path_(paths[j], locuses_[i], pseqs_[n++]);
+                }
+            }
+            collapse_(n);
+            write_paths_(n);
+        }
+    }
+
+    for(size_t i = 0; i < threads.size(); i++){
+        delete threads[i];
     }
 
     cout << "    Maximum paths in a locus: " << mp << "\n";
     cout << "    Used " << juncs_used_.size() << " out of " << juncs_.size() << " junctions [ " << fixed << setprecision(2) << (100.0 * juncs_used_.size() / juncs.size()) << "]\n";
     cout << "    Wrote " << index_ - start << " paths\n";
+    if(!prev_.empty()) {
+        cout << "    Reused " << reused_ << " locuses from the previous transcriptome so far\n";
+        cout << "    Kept the previous ids of " << kept_ids_ << " paths of changed locuses so far\n";
+    }
+    cout << "    Collapsed " << identical_ << " identical and " << contained_ << " contained paths so far\n";
+}
+
+void Transcriptome::close() {
+    Timer ti("Writing the fragment database");
+    cout_.close();
+    iout_.close();
+    lout_.close();
+
+    // Fragments of the previous transcriptome that are no longer part of any locus
+    if(!prev_.empty()){
+        std::string fout = prefix_ + ".retired";
+        std::ofstream out(fout.c_str());
+        size_t retired = 0;
+        for(size_t i = 0; i < prev_ids_.size(); i++){
+            if(prev_ids_[i] && (i >= live_.size() || !live_[i])){
+                out << i << "\n";
+                retired++;
+            }
+        }
+        cout << "Retired " << retired << " fragments of the previous transcriptome, see " << fout << "\n";
+    }
+    fdb_.save(prefix_ + ".fdb");
 }
 
 void Transcriptome::build_locuses_() {
@@ -89,117 +155,114 @@ void Transcriptome::build_locuses_() {
     }
 }
 
-void Transcriptome::build_graph_(JunctionLocus & locus){
+void Transcriptome::PathWorker::operator()() {
+    size_t i;
+    while((i = (*next_)++) < end_){
+        if(tx_.reuse_[i] >= 0){
+            (*results_)[i - start_].clear();
+            continue;
+        }
+        build_graph_((*locuses_)[i]);
+        (*results_)[i - start_].swap(paths_);
+    }
+}
+
+/*
+  Paths are the maximal chains of junctions where the exonic distance between
+  the first and last junction fits in a read. A chain is extended right while
+  the next junction fits and is only kept if its left most junction can't be
+  preceded by another junction, so no path is contained in another one.
+
+  longest_(j, r) is the longest exonic distance that can be added after
+  junction j with r bases remaining, it's computed once per state over the
+  successor ranges so the search only descends into branches that end in a
+  path that is kept.
+*/
+void Transcriptome::PathWorker::build_graph_(const JunctionLocus & locus){
+    const unsigned int L = tx_.read_size_;
+    const size_t       n = locus.size();
     paths_.clear();
-    hash_.clear();
     stack_.clear();
 
-    hash_.resize(locus.size());
-
-    if(debug_){
+    if(tx_.debug_){
 	cout << "Locus Number of junctions: " << locus.size()
-	     << " Position: " << fi_.at(locus.tid()).id << ":" << locus.lft << "-" << locus.rgt << "\n";
+	     << " Position: " << tx_.fi_.at(locus.tid()).id << ":" << locus.lft << "-" << locus.rgt << "\n";
 
 	for(size_t j = 0; j < locus.size(); j++){
 	    cout << "    " << locus.juncs[j] << "\n";
 	}
     }
 
-    for(size_t i = 0; i < locus.size(); i++){
-	if(paths_.size() >= max_iter_) break;
-	step_graph_(i, read_size_, locus);
+    // The junctions are sorted by lft so the successors of each junction are a contiguous range
+    succs_.resize(n);
+    rgts_.resize(n);
+    JunctionVect::const_iterator jbegin = locus.juncs.begin();
+    for(size_t i = 0; i < n; i++){
+        unsigned int rgt = locus[i].rgt;
+        succs_[i].start = std::upper_bound(jbegin + i + 1, locus.juncs.end(), rgt, lft_cmp) - jbegin;
+        succs_[i].end   = std::upper_bound(jbegin + succs_[i].start, locus.juncs.end(), rgt + L, lft_cmp) - jbegin;
+        rgts_[i]        = rgt;
     }
-}
-
-void Transcriptome::step_graph_(size_t curr, size_t len, const JunctionLocus & locus) {
-    const Junction & junc = locus.juncs[curr];
-    string space(stack_.size() * 2 + 2, ' ');
-    //cout << space << "Depth: " << stack_.size() << " Paths: " << paths_.size() << " Len: " << len << " Current: " << junc << "\n";
-
-    stack_.push_back(curr);
-
-    size_t cnt = 0;
-    for(size_t i = curr + 1; i < locus.size(); i++){
-	if(paths_.size() >= max_iter_) return;
-	const Junction & next = locus.juncs[i];
-
-	if(next.lft <= junc.rgt) continue; // Junction before this one ends
-	unsigned int d = next.lft - junc.rgt;
-	//cout << space << "  Next: " << next << " dist: " << d << "\n";
-
-	if(d > len) break;
-	step_graph_(i, len - d, locus);
-	cnt++;
+    std::sort(rgts_.begin(), rgts_.end());
+
+    longest_ext_.assign(n * (L + 1), 0);
+    for(size_t i = n; i-- > 0;){
+        const Successors & s = succs_[i];
+        for(unsigned int r = 0; r <= L; r++){
+            unsigned int & best = longest_(i, r);
+            for(size_t k = s.start; k < s.end; k++){
+                unsigned int d = locus[k].lft - locus[i].rgt;
+                if(d > r) break;
+                best = std::max(best, d + longest_(k, r - d));
+            }
+        }
     }
 
-    if(cnt == 0 && paths_.size() < max_iter_ && !check_subsets_()){
-	if(paths_.size() >= max_iter_) return;
-	if(debug_) cout << "  Path size: " << stack_.size() << "\n";
-	paths_.push_back(IndexVect());
-	std::vector<size_t> & v = paths_.back();
-
-	for(size_t i = 0; i < stack_.size(); i++){
-	    v.push_back(stack_[i]);
-	    hash_[stack_[i]].push_back(paths_.size() - 1);
-	    if(debug_) cout << "    " << locus.juncs[stack_[i]] << "\n";
-	}
-	if(debug_) cout << "\n";
+    for(size_t i = 0; i < n; i++){
+        // A path starting here must be too long to also include the closest junction before it
+        unsigned int min_used = 1;
+        std::vector<unsigned int>::const_iterator it = std::lower_bound(rgts_.begin(), rgts_.end(), locus[i].lft);
+        if(it != rgts_.begin()){
+            unsigned int d = locus[i].lft - *(it - 1);
+            if(d <= L) min_used = std::max(min_used, L - d + 1);
+        }
+        if(longest_(i, L) >= min_used){
+            step_graph_(i, 0, min_used, locus);
+        }
     }
-    stack_.pop_back();
 }
 
-bool Transcriptome::check_subsets_() {
-    std::vector<size_t>::const_iterator curr = stack_.begin();
-    const std::vector<size_t> & v = hash_[*curr];
-
-    /*
-    if(debug_){
-	cout << "Checking for path: " << stack_[0];
-	for(size_t i = 1; i < stack_.size(); i++){
-	    cout << ", " << stack_[i];
-	}
-	cout << "\nPotential Paths: " << v.size() << "\n";
-	for(size_t i = 0; i < v.size(); i++){
-	    cout << "    ";
-	    for(size_t j = 0; j < paths_[v[i]].size(); j++){
-		cout << paths_[v[i]][j] << ", ";
-	    }
-	    cout << "\n";
-	}
-	cout << "\n";
-    }
-    */
-
-    for(size_t i = 0; i < v.size(); i++){
-	std::vector<size_t>::const_iterator start = paths_[v[i]].begin();
-	std::vector<size_t>::const_iterator end   = paths_[v[i]].end();
+void Transcriptome::PathWorker::step_graph_(size_t curr, unsigned int used, unsigned int min_used, const JunctionLocus & locus) {
+    const Junction   & junc      = locus.juncs[curr];
+    const Successors & s         = succs_[curr];
+    unsigned int       remaining = tx_.read_size_ - used;
 
-	while(start != end && *start < *curr) start++;
-	size_t cnt = 0;
-	while(start != end && curr != stack_.end() && *start == *curr) {
-	    cnt++; start++; curr++;
-	}
+    stack_.push_back(curr);
 
-	if(cnt == stack_.size()){
-	    /*
-	    if(debug_){
-		const std::vector<size_t> & p = paths_[v[i]];
-		cout << "   Found match: " << p[0];
-		for(size_t i = 1; i < p.size(); i++){
-		    cout << ", " << p[i];
-		}
-		cout << "\n";
-	    }
-	    */
-	    return true;
-	}
+    bool extended = false;
+    for(size_t i = s.start; i < s.end; i++){
+	unsigned int d = locus.juncs[i].lft - junc.rgt;
+	if(d > remaining) break;
+        extended = true;
+        if(used + d + longest_(i, remaining - d) >= min_used){
+            step_graph_(i, used + d, min_used, locus);
+        }
     }
 
-    return false;
+    if(!extended){
+	if(tx_.debug_) cout << "  Path size: " << stack_.size() << "\n";
+	paths_.push_back(stack_);
+	if(tx_.debug_){
+            for(size_t i = 0; i < stack_.size(); i++){
+                cout << "    " << locus.juncs[stack_[i]] << "\n";
+            }
+            cout << "\n";
+        }
+    }
+    stack_.pop_back();
 }
 
-void Transcriptome::write_paths_(const std::vector<size_t> & p, const JunctionLocus & locus){
-    if(debug_) cout << "  Path #" << index_ << " size = " << p.size() << " tid = " << locus.tid() << "\n";
+void Transcriptome::build_path_(const IndexVect & p, const JunctionLocus & locus, PathSeq & ps){
     const PackedSequence & ref = fi_[locus.tid()].seq;
 
     for(size_t i = 0; i < p.size(); i++){
@@ -216,47 +279,426 @@ void Transcriptome::write_paths_(const std::vector<size_t> & p, const JunctionLo
         }
     }
 
-    cdna_.clear();
-    bstarts_.clear();
-    bends_.clear();
-
-    iout_ << index_ << "\t" << fi_[locus.tid()].id << "\t" 
-	  << strand2char[strand] << "\t" << (p.size() + 1) << "\t";
-    cout_ << ">" << index_ << "\n";
+    ps.tid    = locus.tid();
+    ps.strand = strand;
+    ps.cdna.clear();
+    ps.starts.clear();
+    ps.ends.clear();
 
     unsigned int jlft = locus[p[0]].lft;
     unsigned int lft  = jlft > read_size_ ? jlft - read_size_ : 0;
-    bstarts_.push_back(lft);
-    bends_.push_back(jlft);
-    for(size_t j = lft; j <= jlft; j++) cdna_.append(ref[j]);
+    ps.starts.push_back(lft);
+    ps.ends.push_back(jlft);
+    ps.cdna.append(ref, lft, jlft - lft + 1);
     jlft = locus[p[0]].rgt;
     for(size_t i = 1; i < p.size(); i++){
 	unsigned int jrgt = locus[p[i]].lft;
-	bstarts_.push_back(jlft);
-	bends_.push_back(jrgt);
-	for(size_t j = jlft; j <= jrgt; j++) cdna_.append(ref[j]);
+	ps.starts.push_back(jlft);
+	ps.ends.push_back(jrgt);
+	ps.cdna.append(ref, jlft, jrgt - jlft + 1);
 	jlft = locus[p[i]].rgt;
     }
 
-    bstarts_.push_back(jlft);
+    ps.starts.push_back(jlft);
     unsigned int rgt = std::min(jlft + read_size_, static_cast<unsigned int>(ref.length() - 1));
-    bends_.push_back(rgt);
-    for(size_t j = jlft; j <= rgt; j++) cdna_.append(ref[j]);
-    iout_ << bstarts_[0];	
-    for(size_t i = 1; i < bstarts_.size(); i++){
-	iout_ << "," << bstarts_[i];
+    ps.ends.push_back(rgt);
+    ps.cdna.append(ref, jlft, rgt - jlft + 1);
+}
+
+static const size_t KMER = 16;
+
+static uint64_t seq_hash(const PackedSequence & s){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < s.length(); i++){
+        h = (h ^ s.at_raw(i)) * 1099511628211ULL;
     }
-    iout_ << "\t" << bends_[0];	
-    for(size_t i = 1; i < bends_.size(); i++){
-	iout_ << "," << bends_[i];
+    return h ^ s.length();
+}
+
+template <typename T>
+static uint64_t set_hash(unsigned int tid, Strand strand, const T & starts, const T & ends){
+    uint64_t h = (14695981039346656037ULL ^ tid) * 1099511628211ULL;
+    h = (h ^ strand) * 1099511628211ULL;
+    for(size_t i = 0; i < starts.size(); i++){
+        h = (h ^ starts[i]) * 1099511628211ULL;
+        h = (h ^ ends[i]) * 1099511628211ULL;
     }
-    iout_ << "\n";
+    return h;
+}
+
+static uint64_t kmer_at(const PackedSequence & s, size_t pos){
+    uint64_t v = 0;
+    for(size_t i = pos; i < pos + KMER; i++) v = (v << 4) | s.at_raw(i);
+    return v;
+}
 
-    for(size_t i = 0; i < cdna_.length(); i++){
-	cout_ << cdna_[i];
-	if((i + 1) % 64 == 0) cout_ << "\n";
+static bool seq_equal(const PackedSequence & s, size_t pos, const PackedSequence & q){
+    if(pos + q.length() > s.length()) return false;
+    for(size_t i = 0; i < q.length(); i++){
+        if(s.at_raw(pos + i) != q.at_raw(i)) return false;
     }
-    if((cdna_.length() % 64) != 0) cout_ << "\n";
+    return true;
+}
 
-    index_++;
+const PackedSequence & Transcriptome::record_seq_(uint32_t id){
+    const RecordSrc & r = records_[id];
+    if(r.path != NULL && r.path->cdna.length() > 0) return r.path->cdna;
+
+    const PackedSequence & ref = fi_[r.tid].seq;
+    rec_.clear();
+    if(r.path != NULL){
+        for(size_t j = 0; j < r.path->starts.size(); j++){
+            rec_.append(ref, r.path->starts[j], r.path->ends[j] - r.path->starts[j] + 1);
+        }
+    }else{
+        const FragmentDB::Set & set = fdb_.set(r.set);
+        const FragmentDB::Block * b = fdb_.blocks(set);
+        for(size_t j = 0; j < set.size; j++){
+            rec_.append(ref, b[j].lft, b[j].rgt - b[j].lft + 1);
+        }
+    }
+    return rec_;
+}
+
+bool Transcriptome::same_set_(size_t i, const PathSeq & ps) const {
+    const FragmentDB::Set & set = fdb_.set(i);
+    if(set.id != ps.id || fdb_.strand(set) != ps.strand || set.offset != ps.offset ||
+       set.size != ps.starts.size() || fdb_.chrom(set) != fi_[ps.tid].id) return false;
+    const FragmentDB::Block * b = fdb_.blocks(set);
+    for(size_t j = 0; j < set.size; j++){
+        if(static_cast<unsigned int>(b[j].lft) != ps.starts[j] || static_cast<unsigned int>(b[j].rgt) != ps.ends[j]) return false;
+    }
+    return true;
+}
+
+/*
+  Paths are checked longest first so a contained sequence always finds its
+  container. Identical sequences are found through the hash of every record
+  written so far, contained ones through the kmers of the new records of the locus.
+*/
+void Transcriptome::collapse_(size_t n){
+    order_.resize(n);
+    for(size_t i = 0; i < n; i++) order_[i] = i;
+    std::stable_sort(order_.begin(), order_.end(), [this](size_t a, size_t b) {
+        return pseqs_[a].cdna.length() > pseqs_[b].cdna.length();
+    });
+    kmers_.clear();
+
+    for(size_t i = 0; i < n; i++){
+        PathSeq & ps = pseqs_[order_[i]];
+        ps.write  = false;
+        ps.skip   = false;
+        ps.offset = 0;
+
+        uint64_t h  = seq_hash(ps.cdna);
+        bool found  = false;
+
+        auto prange = prev_paths_.equal_range(set_hash(ps.tid, ps.strand, ps.starts, ps.ends));
+        for(auto it = prange.first; it != prange.second && !found; ++it){
+            const PathSeq & prev = *it->second;
+            if(prev.tid == ps.tid && prev.strand == ps.strand && prev.starts == ps.starts && prev.ends == ps.ends){
+                ps.id     = prev.id;
+                ps.offset = prev.offset;
+                found     = true;
+                kept_ids_++;
+            }
+        }
+
+        auto range = record_hash_.equal_range(h);
+        for(auto it = range.first; it != range.second && !found; ++it){
+            const PackedSequence & rs = record_seq_(it->second);
+            if(rs.length() == ps.cdna.length() && seq_equal(rs, 0, ps.cdna)){
+                ps.id   = it->second;
+                found   = true;
+                identical_++;
+            }
+        }
+
+        if(!found && ps.cdna.length() >= KMER){
+            auto it = kmers_.find(kmer_at(ps.cdna, 0));
+            if(it != kmers_.end()){
+                for(size_t j = 0; j < it->second.size() && !found; j++){
+                    const PathSeq & c = pseqs_[it->second[j].first];
+                    if(seq_equal(c.cdna, it->second[j].second, ps.cdna)){
+                        ps.id     = c.id;
+                        ps.offset = it->second[j].second;
+                        found     = true;
+                        contained_++;
+                    }
+                }
+            }
+        }
+
+        if(found) continue;
+
+        ps.id    = index_++;
+        ps.write = true;
+        records_.resize(index_);
+        records_[ps.id].path   = &ps;
+        records_[ps.id].tid    = ps.tid;
+        records_[ps.id].length = ps.cdna.length();
+        record_hash_.insert(std::make_pair(h, ps.id));
+
+        if(ps.cdna.length() >= KMER){
+            uint64_t v = kmer_at(ps.cdna, 0);
+            kmers_[v].push_back(std::make_pair(order_[i], 0));
+            for(size_t j = 1; j + KMER <= ps.cdna.length(); j++){
+                v = (v << 4) | ps.cdna.at_raw(j + KMER - 1);
+                kmers_[v].push_back(std::make_pair(order_[i], j));
+            }
+        }
+    }
+}
+
+template <typename T>
+static void write_list(BufferedWriter & out, const T & v){
+    out.write_uint(v[0]);
+    for(size_t j = 1; j < v.size(); j++){
+        out.put(',');
+        out.write_uint(v[j]);
+    }
+}
+
+void Transcriptome::write_blocks_(BufferedWriter & out, const PathSeq & ps){
+    out.write_uint(ps.id);
+    out.put('\t');
+    out.write(fi_[ps.tid].id);
+    out.put('\t');
+    out.put(strand2char[ps.strand]);
+    out.put('\t');
+    out.write_uint(ps.starts.size());
+    out.put('\t');
+    write_list(out, ps.starts);
+    out.put('\t');
+    write_list(out, ps.ends);
+    if(ps.offset > 0){
+        out.put('\t');
+        out.write_uint(ps.offset);
+    }
+    out.put('\n');
+}
+
+void Transcriptome::write_locus_(const JunctionLocus & locus){
+    lout_.write("L\t");
+    lout_.put(strand2char[strand_]);
+    lout_.put('\t');
+    lout_.write(fi_[locus.tid()].id);
+    lout_.put('\t');
+    lout_.write_uint(locus.size());
+    for(size_t k = 0; k < 3; k++){
+        lout_.put('\t');
+        for(size_t j = 0; j < locus.size(); j++){
+            if(k == 2){
+                lout_.put(strand2char[locus[j].strand]);
+                continue;
+            }
+            if(j > 0) lout_.put(',');
+            lout_.write_uint(k == 0 ? locus[j].lft : locus[j].rgt);
+        }
+    }
+    lout_.put('\n');
+}
+
+/*
+  Every path of the locus goes to the .loci file so it can be reused, a block
+  set is only written to the index once per record
+*/
+void Transcriptome::write_paths_(size_t n){
+    const size_t LINE = 64;
+    for(size_t i = 0; i < n; i++){
+        PathSeq & ps = pseqs_[order_[i]];
+        lout_.write("P\t");
+        write_blocks_(lout_, ps);
+
+        uint64_t key = (set_hash(ps.tid, ps.strand, ps.starts, ps.ends) ^ ps.id) * 1099511628211ULL;
+        auto range = emitted_.equal_range(key);
+        ps.skip = false;
+        for(auto it = range.first; it != range.second && !ps.skip; ++it){
+            ps.skip = same_set_(it->second, ps);
+        }
+        if(ps.skip) continue;
+        emitted_.insert(std::make_pair(key, static_cast<uint32_t>(fdb_.sets_size())));
+        if(debug_) cout << "  Path #" << ps.id << " offset = " << ps.offset << " tid = " << ps.tid << "\n";
+
+        if(live_.size() <= ps.id) live_.resize(ps.id + 1, false);
+        live_[ps.id] = true;
+        write_blocks_(iout_, ps);
+        fdb_.add(ps.id, fi_[ps.tid].id, ps.strand, ps.starts, ps.ends, ps.offset);
+
+        if(!ps.write) continue;
+
+        // From here on the record sequence is rebuilt from its block set
+        records_[ps.id].path = NULL;
+        records_[ps.id].set  = fdb_.sets_size() - 1;
+
+        // The sequence is decoded straight into the output buffer a line at a time
+        size_t len = ps.cdna.length();
+        cout_.put('>');
+        cout_.write_uint(ps.id);
+        cout_.put('\n');
+        char * out = cout_.reserve(len + len / LINE + 1);
+        char * ptr = out;
+        for(size_t j = 0; j < len; j += LINE){
+            size_t l = std::min(LINE, len - j);
+            ps.cdna.decode(ptr, j, l);
+            ptr += l;
+            *ptr++ = '\n';
+        }
+        cout_.commit(ptr - out);
+    }
+}
+
+template <typename T>
+static uint64_t juncs_hash(const T & juncs){
+    uint64_t h = 14695981039346656037ULL;
+    for(auto const & j : juncs){
+        h = (h ^ j.tid) * 1099511628211ULL;
+        h = (h ^ j.lft) * 1099511628211ULL;
+        h = (h ^ j.rgt) * 1099511628211ULL;
+        h = (h ^ j.strand) * 1099511628211ULL;
+    }
+    return h;
+}
+
+template <typename T>
+static void read_list(char * s, T & v){
+    v.clear();
+    Tokenizer tk(s, ',');
+    while(tk.has_next()) v.push_back(atoi(tk.next()));
+}
+
+void Transcriptome::load(const std::string & prefix, JunctionSet & pjuncs, JunctionSet & mjuncs) {
+    std::string fin = prefix + ".loci";
+    std::ifstream ifs(fin.c_str());
+    if(!ifs){
+        cout << "Error opening the transcriptome locuses " << fin << " for reading\n";
+        exit(1);
+    }
+    Timer ti("Loading the previous transcriptome");
+
+    std::string line;
+    Tokenizer::token_t tokens;
+    std::vector<unsigned int> lfts, rgts;
+    size_t paths = 0;
+    while(getline(ifs, line)){
+        Tokenizer::get(line, '\t', tokens);
+        if(tokens.empty()) continue;
+
+        if(tokens[0][0] == '#'){
+            if(tokens.size() == 2 && static_cast<unsigned int>(atoi(tokens[1])) != read_size_){
+                cout << "Error the previous transcriptome was built with a read size of " << tokens[1] << "\n";
+                exit(1);
+            }
+            continue;
+        }
+
+        if(tokens.size() < 7) continue;
+        FastaIndex::const_iterator fit = fi_.get_entry(tokens[2]);
+        if(fit == fi_.end()){
+            cout << "Error the chromosome " << tokens[2] << " of the previous transcriptome isn't in the reference\n";
+            exit(1);
+        }
+
+        if(tokens[0][0] == 'L'){
+            prev_.push_back(PrevLocus());
+            PrevLocus & pl = prev_.back();
+            pl.section = char2strand[static_cast<size_t>(tokens[1][0])];
+            read_list(tokens[4], lfts);
+            read_list(tokens[5], rgts);
+            const char * strands = tokens[6];
+            for(size_t j = 0; j < lfts.size() && j < rgts.size() && strands[j]; j++){
+                Junction junc(fit->tid, lfts[j], rgts[j], char2strand[static_cast<size_t>(strands[j])]);
+                pl.juncs.push_back(junc);
+                if(pl.section == PLUS) pjuncs.insert(junc);
+                else                   mjuncs.insert(junc);
+            }
+            prev_index_.insert(std::make_pair(juncs_hash(pl.juncs), prev_.size() - 1));
+        }else if(tokens[0][0] == 'P' && !prev_.empty()){
+            prev_.back().paths.push_back(PathSeq());
+            PathSeq & ps = prev_.back().paths.back();
+            ps.id     = atoi(tokens[1]);
+            ps.tid    = fit->tid;
+            ps.strand = char2strand[static_cast<size_t>(tokens[3][0])];
+            read_list(tokens[5], ps.starts);
+            read_list(tokens[6], ps.ends);
+            ps.offset = tokens.size() > 7 ? atoi(tokens[7]) : 0;
+            if(prev_ids_.size() <= ps.id) prev_ids_.resize(ps.id + 1, false);
+            prev_ids_[ps.id] = true;
+            paths++;
+        }
+    }
+
+    for(auto const & pl : prev_){
+        for(auto const & ps : pl.paths){
+            prev_paths_.insert(std::make_pair(set_hash(ps.tid, ps.strand, ps.starts, ps.ends), &ps));
+        }
+    }
+
+    // New records are appended after the previous ids
+    index_ = std::max(index_, static_cast<unsigned int>(prev_ids_.size()));
+    cout << "  Loaded " << prev_.size() << " locuses and " << paths << " paths from " << fin << "\n";
+}
+
+/*
+  A locus is reused when a previous locus of the same strand has exactly the
+  same junctions, the records of its paths are added before any new path is
+  collapsed so new paths with the same sequence keep the previous ids. The
+  sequence of a record is its longest path that starts at offset 0.
+*/
+void Transcriptome::reuse_locuses_() {
+    reuse_.assign(locuses_.size(), -1);
+    if(prev_.empty()) return;
+
+    std::vector<uint32_t> seeded;
+    for(size_t i = 0; i < locuses_.size(); i++){
+        auto range = prev_index_.equal_range(juncs_hash(locuses_[i].juncs));
+        for(auto it = range.first; it != range.second; ++it){
+            const PrevLocus & pl = prev_[it->second];
+            if(pl.section != strand_ || pl.juncs != locuses_[i].juncs) continue;
+            reuse_[i] = it->second;
+            reused_++;
+
+            for(auto const & ps : pl.paths){
+                if(ps.offset != 0) continue;
+                uint32_t len = 0;
+                for(size_t j = 0; j < ps.starts.size(); j++) len += ps.ends[j] - ps.starts[j] + 1;
+                if(records_.size() <= ps.id) records_.resize(ps.id + 1);
+                if(records_[ps.id].length < len){
+                    records_[ps.id].length = len;
+                    records_[ps.id].path   = &ps;
+                    records_[ps.id].tid  = ps.tid;
+                    seeded.push_back(ps.id);
+                }
+            }
+            break;
+        }
+    }
+
+    std::sort(seeded.begin(), seeded.end());
+    seeded.erase(std::unique(seeded.begin(), seeded.end()), seeded.end());
+    for(size_t i = 0; i < seeded.size(); i++){
+        record_hash_.insert(std::make_pair(seq_hash(record_seq_(seeded[i])), seeded[i]));
+    }
+}
+
+size_t Transcriptome::reuse_paths_(const PrevLocus & prev) {
+    size_t n = prev.paths.size();
+    if(pseqs_.size() < n) pseqs_.resize(n);
+    order_.resize(n);
+    for(size_t i = 0; i < n; i++){
+        const PathSeq & ps = prev.paths[i];
+        PathSeq       & cp = pseqs_[i];
+        cp.tid    = ps.tid;
+        cp.strand = ps.strand;
+        cp.starts = ps.starts;
+        cp.ends   = ps.ends;
+        cp.id     = ps.id;
+        cp.offset = ps.offset;
+        cp.write  = false;
+        cp.skip   = false;
+        cp.cdna.clear();
+        order_[i] = i;
+    }
+    for(auto const & j : prev.juncs) juncs_used_.insert(j);
+    return n;
 }
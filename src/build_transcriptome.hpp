@@ -22,28 +22,48 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <fstream>
 #include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/thread/thread.hpp>
 
 #include "fasta_index.hpp"
 #include "mem_pool_list.hpp"
 #include "junction.hpp"
+#include "fragment_db.hpp"
+#include "buffered_writer.hpp"
 
 namespace rnasequel {
 
 class Transcriptome {
     public:
 	Transcriptome(const std::string & prefix, const FastaIndex & fi, 
-		      unsigned int read_size, unsigned int max_iter, bool debug = false)
-	    : prefix_(prefix), fi_(fi), read_size_(read_size), max_iter_(max_iter), index_(0), strand_(UNKNOWN), debug_(debug)
+		      unsigned int read_size, unsigned int threads = 1, bool debug = false)
+	    : prefix_(prefix), fi_(fi), identical_(0), contained_(0), kept_ids_(0), reused_(0), read_size_(read_size), threads_(std::max(threads, 1U)), 
+              index_(0), strand_(UNKNOWN), debug_(debug)
 	{
 	    std::string iout = prefix + ".txt";
 	    std::string sout = prefix + ".fa";
+	    std::string lout = prefix + ".loci";
 
-	    cout_.open(sout.c_str());
-	    iout_.open(iout.c_str());
+	    if(!cout_.open(sout) || !iout_.open(iout) || !lout_.open(lout)){
+		std::cout << "Error opening the transcriptome output files " << prefix << ".[fa|txt|loci]\n";
+		exit(1);
+	    }
+	    lout_.write("#read_size\t");
+	    lout_.write_uint(read_size_);
+	    lout_.put('\n');
 	}
 
+	// Loads the locuses of an existing transcriptome (prefix.loci) so the unchanged locuses keep
+	// their fragment ids, the junctions of the old locuses are added to pjuncs and mjuncs
+	void load(const std::string & prefix, JunctionSet & pjuncs, JunctionSet & mjuncs);
+
 	void process_junctions(const JunctionSet & juncs, Strand strand);
 
+	// Writes the binary fragment database
+	void close();
+
     private:
 	typedef std::vector<Junction>   JunctionVect;
 	typedef std::vector<size_t>     IndexVect;
@@ -81,13 +101,112 @@ class Transcriptome {
             int                   rgt;
 	};
 
+	// Enumerates the paths of the locuses in [start, end), locuses are taken from a
+	// shared counter and the paths are stored by locus so the output order is fixed
+	class PathWorker {
+	    public:
+		PathWorker(const Transcriptome & tx) : tx_(tx), locuses_(NULL), results_(NULL), next_(NULL), start_(0), end_(0), running_(false) { }
+
+		void init(const std::vector<JunctionLocus> & locuses, std::vector<PathList> & results,
+			  std::atomic<size_t> & next, size_t start, size_t end) {
+		    locuses_ = &locuses;
+		    results_ = &results;
+		    next_    = &next;
+		    start_   = start;
+		    end_     = end;
+		}
+
+		void operator()();
+
+		void start() {
+		    running_ = true;
+		    thread_  = boost::thread(boost::ref(*this));
+		}
+
+		void join() {
+		    if(running_) {
+			thread_.join();
+			running_ = false;
+		    }
+		}
+
+	    private:
+		// Range of junctions that can follow a junction within the read size
+		struct Successors {
+		    Successors() : start(0), end(0) { }
+		    size_t start;
+		    size_t end;
+		};
+
+		void build_graph_(const JunctionLocus & locus);
+		void step_graph_(size_t curr, unsigned int used, unsigned int min_used, const JunctionLocus & locus);
+
+		unsigned int & longest_(size_t junc, unsigned int remaining) {
+		    return longest_ext_[junc * (tx_.read_size_ + 1) + remaining];
+		}
+
+		const Transcriptome                   & tx_;
+		const std::vector<JunctionLocus>      * locuses_;
+		std::vector<PathList>                 * results_;
+		std::atomic<size_t>                   * next_;
+		size_t                                  start_;
+		size_t                                  end_;
+
+		// Actual paths
+		PathList                                paths_;
+
+		// Current path
+		std::vector<size_t>                     stack_;
+
+		std::vector<Successors>                 succs_;
+		std::vector<unsigned int>               rgts_;
+
+		// Longest exonic extension reachable from a (junction, remaining length) state
+		std::vector<unsigned int>               longest_ext_;
+
+		boost::thread                           thread_;
+		bool                                    running_;
+	};
+
+	// The blocks and cDNA of a path and the record (fasta sequence) it belongs to
+	struct PathSeq {
+	    PathSeq() : tid(0), strand(UNKNOWN), id(0), offset(0), write(false), skip(false) { }
+
+	    unsigned int               tid;
+	    Strand                     strand;
+	    std::vector<unsigned int>  starts;
+	    std::vector<unsigned int>  ends;
+	    PackedSequence             cdna;
+	    uint32_t                   id;
+	    // Position of the path in the record sequence
+	    uint32_t                   offset;
+	    // The path is a new record
+	    bool                       write;
+	    // The record already has the same sequence and blocks
+	    bool                       skip;
+	};
+
+	// A locus of a previous transcriptome and all of the paths written for it
+	struct PrevLocus {
+	    PrevLocus() : section(UNKNOWN) { }
+
+	    Strand                     section;
+	    JunctionVect               juncs;
+	    std::vector<PathSeq>       paths;
+	};
+
 	void build_locuses_();
-	void build_graph_(JunctionLocus & locus);
-	void step_graph_(size_t curr, size_t len, const JunctionLocus & locus);
-	void write_paths_(const std::vector<size_t> & p, const JunctionLocus & locus);
 
-	// Check if the stack is a subset of an existing path
-	bool check_subsets_();
+	// Matches the locuses to the unchanged previous locuses and adds their records
+	void reuse_locuses_();
+	size_t reuse_paths_(const PrevLocus & prev);
+	void build_path_(const IndexVect & p, const JunctionLocus & locus, PathSeq & ps);
+
+	// Assigns the paths of a locus to records collapsing identical and contained sequences
+	void collapse_(size_t n);
+	void write_locus_(const JunctionLocus & locus);
+	void write_paths_(size_t n);
+	void write_blocks_(BufferedWriter & out, const PathSeq & ps);
 
 
 	std::string                        prefix_;
@@ -98,28 +217,71 @@ class Transcriptome {
 
 	JunctionSet                        juncs_used_;
 
-	PackedSequence                     cdna_;
-	std::vector<unsigned int>          bstarts_;
-	std::vector<unsigned int>          bends_;
+	// Paths of the current locus and the order they are written in
+	std::vector<PathSeq>               pseqs_;
+	std::vector<size_t>                order_;
+
+	// Where the sequence of a record comes from, the cDNA of a record isn't kept
+	// once it's written, it's rebuilt from the reference when it's compared
+	struct RecordSrc {
+	    RecordSrc() : path(NULL), tid(0), set(0), length(0) { }
+
+	    // A path of the current locus (with its cDNA) or of a previous locus
+	    const PathSeq            * path;
+	    unsigned int               tid;
+	    // Block set of the record in the fragment database once it's written
+	    uint32_t                   set;
+	    uint32_t                   length;
+	};
 
-	std::ofstream                      cout_;
-	std::ofstream                      iout_;
+	// Sequence of record id, rec_ holds it when it has to be rebuilt
+	const PackedSequence & record_seq_(uint32_t id);
+	// True if block set i of the fragment database is the block set of ps
+	bool same_set_(size_t i, const PathSeq & ps) const;
+
+	// Sources of the records written so far indexed by the hash of their sequence
+	std::vector<RecordSrc>                       records_;
+	std::unordered_multimap<uint64_t, uint32_t>  record_hash_;
+	PackedSequence                               rec_;
+
+	// Block sets written so far indexed by their hash so a set is only written once per record
+	std::unordered_multimap<uint64_t, uint32_t>  emitted_;
+
+	// Positions of the kmers of the new records in the current locus
+	std::unordered_map<uint64_t, std::vector< std::pair<uint32_t, uint32_t> > > kmers_;
+
+	size_t                             identical_;
+	size_t                             contained_;
+
+	// Locuses of the previous transcriptome indexed by the hash of their junctions
+	std::vector<PrevLocus>                       prev_;
+	std::unordered_multimap<uint64_t, size_t>    prev_index_;
+	// Paths of the previous locuses indexed by the hash of their block sets, a path of a
+	// changed locus with the same blocks as a previous path keeps its record and offset
+	std::unordered_multimap<uint64_t, const PathSeq *> prev_paths_;
+	size_t                                       kept_ids_;
+	// Previous locus reused by each locus or -1
+	std::vector<int>                             reuse_;
+	// Ids of the previous transcriptome and the ids that have been written
+	std::vector<bool>                            prev_ids_;
+	std::vector<bool>                            live_;
+	size_t                                       reused_;
+
+	// Formatted on the calling thread and written by the writer threads
+	BufferedWriter                     cout_;
+	BufferedWriter                     iout_;
+	BufferedWriter                     lout_;
+	FragmentDB                         fdb_;
 
 
 	// The locuses after grouping the juncs
 	std::vector<JunctionLocus>         locuses_;
 
-	// Actual paths
-	PathList                           paths_;
-
-	// Current path
-	std::vector<size_t>                stack_;
-
-	// Hash used to speed up checking if a path is a subpath
-	std::vector< std::vector<size_t> > hash_;
+	// Paths of the current window of locuses
+	std::vector<PathList>              results_;
 
 	unsigned int		      read_size_;
-	unsigned int		      max_iter_;
+	unsigned int		      threads_;
 	unsigned int		      index_;
 	Strand			      strand_;
 	bool                          debug_;
@@ -159,12 +159,10 @@ class Cigar {
 	void assign(const std::string & s);
 	void assign(const char * s);
 
+	// Reuses the existing list nodes where possible
 	template <typename T_it>
 	void assign(T_it start, T_it end) {
-	    _cigars.clear();
-	    while(start++ != end){
-		push_back(*start);
-	    }
+	    _cigars.assign(start, end);
 	}
 
         /*std::list implementation
@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GW_CONST_ARRAY_HPP
+#define GW_CONST_ARRAY_HPP
+
+#include <vector>
+#include <cstddef>
+#include <assert.h>
+
+namespace rnasequel {
+
+/**
+  * Read only view of a contiguous array
+  *
+  * Used by the structures that are either built in memory (the view points
+  * into an owned vector) or mapped from a merge context image.
+  */
+template <typename T>
+class ConstArray {
+    public:
+        typedef const T * const_iterator;
+
+        ConstArray() : data_(NULL), size_(0) { }
+        ConstArray(const T * data, size_t size) : data_(data), size_(size) { }
+        ConstArray(const std::vector<T> & v) : data_(v.empty() ? NULL : &v[0]), size_(v.size()) { }
+
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        const T & operator[](size_t i) const {
+            assert(i < size_);
+            return data_[i];
+        }
+
+        const T * data() const {
+            return data_;
+        }
+
+        const_iterator begin() const {
+            return data_;
+        }
+
+        const_iterator end() const {
+            return data_ + size_;
+        }
+
+    private:
+        const T * data_;
+        size_t    size_;
+};
+
+};
+
+#endif
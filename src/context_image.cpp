@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "context_image.hpp"
+#include "binary_io.hpp"
+#include "timer.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace rnasequel;
+using namespace std;
+
+const char ContextImage::MAGIC[8] = { 'R', 'S', 'Q', 'C', 'T', 'X', '1', '\0' };
+
+uint32_t ContextImage::Writer::name(const std::string & s) {
+    std::map<std::string, uint32_t>::iterator it = name_ids_.find(s);
+    if(it != name_ids_.end()) return it->second;
+    uint32_t off = names_.size();
+    names_.insert(names_.end(), s.begin(), s.end());
+    names_.push_back('\0');
+    name_ids_.insert(std::make_pair(s, off));
+    return off;
+}
+
+void ContextImage::Writer::save(const std::string & fout) {
+    add(NAMES, names_);
+
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version  = VERSION;
+    h.sections = SECTIONS;
+
+    // Section data starts after the table and every section is 8 byte aligned
+    std::vector<Section> table(SECTIONS);
+    uint64_t off = sizeof(Header) + SECTIONS * sizeof(Section);
+    for(size_t i = 0; i < table.size(); i++) {
+        off = (off + 7) & ~static_cast<uint64_t>(7);
+        table[i].offset = off;
+        table[i].count  = pending_[i].count;
+        table[i].size   = pending_[i].size;
+        table[i].pad    = 0;
+        off += pending_[i].count * pending_[i].size;
+    }
+
+    // Written to a uniquely named temporary file so a merge never maps a
+    // partial image and concurrent prepare runs don't share the temporary
+    std::string tmp = fout + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if(fd < 0) {
+        cout << "Error opening the context image " << fout << " for writing\n";
+        exit(1);
+    }
+    fchmod(fd, 0644);
+    ::close(fd);
+    {
+        BinaryWrite bw(tmp);
+        if(!bw) {
+            unlink(tmp.c_str());
+            cout << "Error opening the context image " << fout << " for writing\n";
+            exit(1);
+        }
+        bw.write<Header>(h);
+        bw.write_n(reinterpret_cast<const char *>(&table[0]), table.size() * sizeof(Section));
+        const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        uint64_t pos = sizeof(Header) + SECTIONS * sizeof(Section);
+        for(size_t i = 0; i < table.size(); i++) {
+            bw.write_n(zeros, table[i].offset - pos);
+            uint64_t bytes = table[i].count * table[i].size;
+            if(bytes > 0) bw.write_n(&pending_[i].data[0], bytes);
+            pos = table[i].offset + bytes;
+        }
+    }
+    struct stat st;
+    if(stat(tmp.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != off) {
+        unlink(tmp.c_str());
+        cout << "Error writing the context image " << fout << "\n";
+        exit(1);
+    }
+    if(rename(tmp.c_str(), fout.c_str()) != 0) {
+        unlink(tmp.c_str());
+        cout << "Error renaming the context image " << tmp << " to " << fout << "\n";
+        exit(1);
+    }
+}
+
+void ContextImage::open(const std::string & fin) {
+    close();
+    Timer ti("Mapping the merge context image");
+    file_ = fin;
+    int fd = ::open(fin.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        cout << "Error opening the context image " << fin << " for reading\n";
+        exit(1);
+    }
+
+    map_size_ = st.st_size;
+    map_ = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map_ == MAP_FAILED || map_size_ < sizeof(Header)) {
+        cout << "Error mapping the context image " << fin << "\n";
+        exit(1);
+    }
+
+    const Header * h = static_cast<const Header *>(map_);
+    if(memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        cout << "Error " << fin << " is not a merge context image (see rnasequel prepare)\n";
+        exit(1);
+    }
+    if(h->version != VERSION || h->sections != SECTIONS) {
+        cout << "Error the context image " << fin << " was built by a different version of rnasequel, rerun rnasequel prepare\n";
+        exit(1);
+    }
+
+    sections_ = reinterpret_cast<const Section *>(static_cast<const char *>(map_) + sizeof(Header));
+    if(map_size_ < sizeof(Header) + SECTIONS * sizeof(Section)) {
+        cout << "Error the context image " << fin << " is truncated\n";
+        exit(1);
+    }
+    for(size_t i = 0; i < SECTIONS; i++) {
+        if(sections_[i].offset + sections_[i].count * sections_[i].size > map_size_) {
+            cout << "Error the context image " << fin << " is truncated\n";
+            exit(1);
+        }
+    }
+}
+
+void ContextImage::close() {
+    if(map_ != NULL) {
+        munmap(map_, map_size_);
+        map_ = NULL;
+        map_size_ = 0;
+        sections_ = NULL;
+    }
+}
+
+void ContextImage::layout_error_(SectionID id) const {
+    cout << "Error section " << id << " of the context image " << file_ << " has an unexpected record size, rerun rnasequel prepare\n";
+    exit(1);
+}
@@ -0,0 +1,165 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GW_CONTEXT_IMAGE_HPP
+#define GW_CONTEXT_IMAGE_HPP
+
+#include "const_array.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+namespace rnasequel {
+
+/**
+  * Precomputed merge context (rnasequel prepare)
+  *
+  * Holds the annotation model, the prepared splice junction and splice site
+  * lists and the compiled fragment projections so merge can map them instead
+  * of rebuilding them for every sample. The file is a header and a section
+  * table followed by the raw section arrays, all references are offsets so
+  * the image is mmap'd read only and shared by concurrent merges.
+  *   Header, Section[SECTIONS], section data (8 byte aligned)
+  */
+class ContextImage {
+    public:
+        enum SectionID {
+            NAMES = 0,
+            MODEL_CHROMS,
+            MODEL_GENES,
+            MODEL_TRANSCRIPTS,
+            MODEL_EXONS,
+            MODEL_STRINGS,
+            MODEL_OFFSETS,
+            JUNC_REFS,
+            JUNC_BLOCKS,
+            TRIM_REFS,
+            TRIM_SITES,
+            FRAG_CHROMS,
+            FRAG_RECORDS,
+            FRAG_PROJECTIONS,
+            FRAG_BLOCKS,
+            SECTIONS
+        };
+
+        static const uint32_t VERSION = 1;
+
+        // Collects a copy of each section and writes the image
+        class Writer {
+            public:
+                Writer() : pending_(SECTIONS) { }
+
+                template <typename T>
+                void add(SectionID id, const std::vector<T> & v) {
+                    add(id, v.empty() ? NULL : &v[0], v.size());
+                }
+
+                template <typename T>
+                void add(SectionID id, const T * data, size_t n) {
+                    const char * ptr = reinterpret_cast<const char *>(data);
+                    pending_[id].data.assign(ptr, ptr + n * sizeof(T));
+                    pending_[id].count = n;
+                    pending_[id].size  = sizeof(T);
+                }
+
+                // Offset of the string in the image name table
+                uint32_t name(const std::string & s);
+
+                void save(const std::string & fout);
+
+            private:
+                struct Pending {
+                    Pending() : count(0), size(0) { }
+
+                    std::vector<char> data;
+                    uint64_t          count;
+                    uint32_t          size;
+                };
+
+                std::vector<Pending>             pending_;
+                std::vector<char>                names_;
+                std::map<std::string, uint32_t>  name_ids_;
+        };
+
+        ContextImage() : map_(NULL), map_size_(0), sections_(NULL) { }
+
+        ContextImage(const std::string & fin) : map_(NULL), map_size_(0), sections_(NULL) {
+            open(fin);
+        }
+
+        ~ContextImage() {
+            close();
+        }
+
+        void open(const std::string & fin);
+        void close();
+
+        bool is_open() const {
+            return map_ != NULL;
+        }
+
+        template <typename T>
+        ConstArray<T> section(SectionID id) const;
+
+        const char * name(uint32_t offset) const {
+            return section<char>(NAMES).data() + offset;
+        }
+
+    private:
+        ContextImage(const ContextImage & c);
+        ContextImage & operator=(const ContextImage & c);
+
+        struct Header {
+            char     magic[8];
+            uint32_t version;
+            uint32_t sections;
+        };
+
+        struct Section {
+            uint64_t offset;
+            uint64_t count;
+            uint32_t size;
+            uint32_t pad;
+        };
+
+        static const char MAGIC[8];
+
+        // Called when a section was written with a different record layout
+        void layout_error_(SectionID id) const;
+
+        void          * map_;
+        size_t          map_size_;
+        const Section * sections_;
+        std::string     file_;
+};
+
+template <typename T>
+ConstArray<T> ContextImage::section(SectionID id) const {
+    const Section & s = sections_[id];
+    if(s.count == 0) return ConstArray<T>();
+    if(s.size != sizeof(T)) layout_error_(id);
+    return ConstArray<T>(reinterpret_cast<const T *>(static_cast<const char *>(map_) + s.offset), s.count);
+}
+
+};
+
+#endif
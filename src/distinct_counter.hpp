@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_DISTINCT_COUNTER_HPP
+#define GW_DISTINCT_COUNTER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+namespace rnasequel {
+
+/**
+  * Bounded memory distinct value counter
+  *
+  * Values are kept exactly up to exact() distinct values, after that the counter
+  * switches to a BITS bit linear counting bitmap so a counter never uses more
+  * than a few hundred bytes. A bitmap counter has seen more than exact() values
+  * so its estimate is never lower than exact() + 1, comparisons against counts up
+  * to exact() + 1 are always exact. set_exact() is called before any counting.
+  */
+class DistinctCounter {
+    public:
+        static const size_t EXACT = 16;
+        static const size_t BITS  = 1024;
+        static const size_t WORDS = BITS / 64;
+
+        DistinctCounter() { }
+
+        // Number of values kept exactly, at least EXACT
+        static size_t exact() {
+            return limit_();
+        }
+
+        static void set_exact(size_t n) {
+            limit_() = n < EXACT ? static_cast<size_t>(EXACT) : n;
+        }
+
+        void insert(uint64_t v) {
+            if(bits_.empty()) {
+                if(std::find(exact_.begin(), exact_.end(), v) != exact_.end()) return;
+                if(exact_.size() < exact()) {
+                    exact_.push_back(v);
+                    return;
+                }
+                to_bitmap_();
+            }
+            set_(v);
+        }
+
+        void merge(const DistinctCounter & c) {
+            if(c.bits_.empty()) {
+                for(size_t i = 0; i < c.exact_.size(); i++) insert(c.exact_[i]);
+                return;
+            }
+            if(bits_.empty()) to_bitmap_();
+            for(size_t i = 0; i < WORDS; i++) bits_[i] |= c.bits_[i];
+        }
+
+        size_t size() const {
+            if(bits_.empty()) return exact_.size();
+            size_t set = 0;
+            for(size_t i = 0; i < WORDS; i++) set += __builtin_popcountll(bits_[i]);
+            // A full bitmap can't be estimated, it's well past anything we need to compare against
+            if(set == BITS) return std::max(BITS * 8, exact() + 1);
+            double est = -static_cast<double>(BITS) * std::log(static_cast<double>(BITS - set) / BITS);
+            return std::max(static_cast<size_t>(est + 0.5), exact() + 1);
+        }
+
+    private:
+        static size_t & limit_() {
+            static size_t limit = EXACT;
+            return limit;
+        }
+
+        static uint64_t hash_(uint64_t v) {
+            v ^= v >> 33;
+            v *= 0xff51afd7ed558ccdULL;
+            v ^= v >> 33;
+            v *= 0xc4ceb9fe1a85ec53ULL;
+            v ^= v >> 33;
+            return v;
+        }
+
+        void set_(uint64_t v) {
+            uint64_t h = hash_(v) % BITS;
+            bits_[h >> 6] |= 1ULL << (h & 63);
+        }
+
+        void to_bitmap_() {
+            bits_.assign(WORDS, 0);
+            for(size_t i = 0; i < exact_.size(); i++) set_(exact_[i]);
+            std::vector<uint64_t>().swap(exact_);
+        }
+
+        std::vector<uint64_t> exact_;
+        std::vector<uint64_t> bits_;
+};
+
+};
+
+#endif
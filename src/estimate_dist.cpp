@@ -23,16 +23,17 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 using namespace rnasequel;
 
-void EstimateDist::build_map_(const Model & model){
+void EstimateDist::build_map_(const CompactModel & model){
     std::vector<bool> overlaps;
-    for(Model::const_iterator it = model.begin(); it != model.end(); it++){
-	RefEstimator & ptr = refs_[it->first];
+    for(size_t c = 0; c < model.chroms_size(); c++){
+	const CompactModel::ChromRec & chrom = model.chrom(c);
+	RefEstimator & ptr = refs_[model.chrom_name(c)];
 	overlaps.clear();
-	const Model::gene_list & genes = it->second;
-	overlaps.resize(genes.size(), false);
-	for(size_t i = 0; i < genes.size(); i++){
+	const CompactModel::GeneRec * genes = model.genes_begin(chrom);
+	overlaps.resize(chrom.gene_size, false);
+	for(size_t i = 0; i < chrom.gene_size; i++){
 	    size_t j = i + 1;
-	    while(j < genes.size() && genes[i].rgt() >= genes[j].lft()){
+	    while(j < chrom.gene_size && genes[i].rgt() >= genes[j].lft()){
 		overlaps[i] = true;
 		overlaps[j] = true;
 		j++;
@@ -41,12 +42,13 @@ void EstimateDist::build_map_(const Model & model){
 
 	for(size_t i = 0; i < overlaps.size(); i++){
 	    if(!overlaps[i]){
-		if(genes[i].transcripts().size() == 1){
-		    ptr.add_isoform(genes[i].transcripts().front());
+		if(genes[i].tx_size == 1){
+		    const CompactModel::TranscriptRec & tx = model.transcript(genes[i], 0);
+		    ptr.add_isoform(tx, model.exons(tx));
 		    if(genes[i].strand() == PLUS) ptr.pi_count++;
 		    else                          ptr.mi_count++;
 		}else{
-		    size_t b = build_exons_(genes[i], ptr);
+		    size_t b = build_exons_(model, genes[i], ptr);
 		    if(genes[i].strand() == PLUS) ptr.pb_count += b;
 		    else                          ptr.mb_count += b;
 		}
@@ -55,10 +57,12 @@ void EstimateDist::build_map_(const Model & model){
     }
 }
 
-size_t EstimateDist::build_exons_(const Gene & gene, RefEstimator & e){
+size_t EstimateDist::build_exons_(const CompactModel & model, const CompactModel::GeneRec & gene, RefEstimator & e){
     std::vector<PosBlock> blocks;
-    for(size_t i = 0; i < gene.transcripts().size(); i++){
-	blocks.insert(blocks.end(), gene.transcripts()[i].exons().begin(), gene.transcripts()[i].exons().end());
+    for(size_t i = 0; i < gene.tx_size; i++){
+	const CompactModel::TranscriptRec & tx = model.transcript(gene, i);
+	const PosBlock * exons = model.exons(tx);
+	blocks.insert(blocks.end(), exons, exons + tx.exon_size);
     }
 
     std::vector<bool> overlaps(blocks.size(), false);
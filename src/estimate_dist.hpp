@@ -75,31 +75,33 @@ class LongExon : public DistBlock {
  */
 class SingleIsoform : public DistBlock {
     public:
-	SingleIsoform(const Transcript & tx) : DistBlock(tx), exons_(&tx.exons()){ }
+	SingleIsoform(const CompactModel::TranscriptRec & tx, const PosBlock * exons) : DistBlock(tx), exons_(exons), size_(tx.exon_size){ }
 
 	virtual ~SingleIsoform() {}
 
 	virtual DistEstimate insert_size(size_t p1, size_t p2, bool overlap) const {
 	    if(overlap) return DistEstimate(0, false, overlap);
-	    size_t p1i = exons_->size(), p2i = exons_->size();
-	    for(size_t i = 0; i < exons_->size(); i++){
-		if(exons_->at(i).overlaps(p1)) p1i = i;
-		if(exons_->at(i).overlaps(p2)) p2i = i;
+	    size_t p1i = size_, p2i = size_;
+	    for(size_t i = 0; i < size_; i++){
+		if(exons_[i].overlaps(p1)) p1i = i;
+		if(exons_[i].overlaps(p2)) p2i = i;
 	    }
 
 	    // One of these positions does not overlap an exon
-	    if(p1i == exons_->size() || p2i == exons_->size()) return DistEstimate(0, true, overlap);
-	    else if(p1i == p2i)                                return DistEstimate(p2 - p1 - 1, false, overlap);
+	    if(p1i == size_ || p2i == size_) return DistEstimate(0, true, overlap);
+	    else if(p1i == p2i)              return DistEstimate(p2 - p1 - 1, false, overlap);
 
-	    pos_t d = exons_->at(p1i).rgt() - p1;
-	    while(++p1i < p2i) d += exons_->at(p1i).length();
-	    d += p2 - exons_->at(p2i).lft();
+	    pos_t d = exons_[p1i].rgt() - p1;
+	    while(++p1i < p2i) d += exons_[p1i].length();
+	    d += p2 - exons_[p2i].lft();
 
 	    return DistEstimate(d, false, overlap);
 	}
 
     private:
-	const Transcript::Exons * exons_;
+	// Exons are owned by the CompactModel
+	const PosBlock * exons_;
+	size_t           size_;
 };
 
 class RefEstimator {
@@ -121,11 +123,11 @@ class RefEstimator {
 	RefEstimator() : pi_count(0), pb_count(0), mi_count(0), mb_count(0) {
 	}
 
-	void add_isoform(const Transcript & tx) {
+	void add_isoform(const CompactModel::TranscriptRec & tx, const PosBlock * exons) {
 	    if(tx.strand() == PLUS){
-		pblocks_.push_back(new SingleIsoform(tx));
+		pblocks_.push_back(new SingleIsoform(tx, exons));
 	    }else{
-		mblocks_.push_back(new SingleIsoform(tx));
+		mblocks_.push_back(new SingleIsoform(tx, exons));
 	    }
 	}
 
@@ -174,11 +176,12 @@ class EstimateDist {
 
 	}
 
-	EstimateDist(const Model & model, size_t min_exon){
+	EstimateDist(const CompactModel & model, size_t min_exon){
 	    init(model, min_exon);
 	}
 
-	void init(const Model & model, size_t min_exon){
+	// The model has to outlive the estimator
+	void init(const CompactModel & model, size_t min_exon){
 	    min_exon_ = min_exon;
 	    build_map_(model);
 	}
@@ -206,8 +209,8 @@ class EstimateDist {
 	EstimateDist(const EstimateDist & pj);
 	EstimateDist & operator=(const EstimateDist & pj);
 
-	void   build_map_(const Model & genes);
-	size_t build_exons_(const Gene & gene, RefEstimator & e);
+	void   build_map_(const CompactModel & model);
+	size_t build_exons_(const CompactModel & model, const CompactModel::GeneRec & gene, RefEstimator & e);
 
 	ref_map               refs_;
 	size_t                min_exon_;
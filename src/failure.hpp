@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_FAILURE_HPP
+#define GW_FAILURE_HPP
+
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+
+namespace rnasequel {
+
+/**
+ * An error reading or writing one of the files of a run
+ *
+ * fail() prints it and exits unless the calling thread holds a FailScope,
+ * then it's thrown as a Failure so a batch merge can fail one sample and go
+ * on with the others. The threads of a SamReader and a PairOutput hold their
+ * own scope and hand their errors to the thread using them.
+ */
+class Failure : public std::runtime_error {
+    public:
+        explicit Failure(const std::string & message) : std::runtime_error(message) { }
+};
+
+class FailScope {
+    public:
+        FailScope() : prev_(active_()) {
+            active_() = true;
+        }
+
+        ~FailScope() {
+            active_() = prev_;
+        }
+
+        static bool active() {
+            return active_();
+        }
+
+    private:
+        FailScope(const FailScope & f);
+        FailScope & operator=(const FailScope & f);
+
+        static bool & active_() {
+            static thread_local bool active = false;
+            return active;
+        }
+
+        bool prev_;
+};
+
+// The message follows "Error " when it's printed
+[[noreturn]] inline void fail(const std::string & message) {
+    if(FailScope::active()) throw Failure(message);
+    std::cout << "Error " << message << "\n";
+    exit(1);
+}
+
+};
+
+#endif
@@ -0,0 +1,447 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fastq_rename.hpp"
+#include "timer.hpp"
+#include "binary_io.hpp"
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+namespace po = boost::program_options;
+
+using namespace std;
+using namespace rnasequel;
+
+namespace {
+
+bool is_gz(const std::string & file) {
+    return file.size() > 3 && file.compare(file.size() - 3, 3, ".gz") == 0;
+}
+
+FILE * create(const std::string & fout) {
+    FILE * out = fopen(fout.c_str(), "wb");
+    if(out == NULL) {
+        cout << "Error opening the file `" << fout << "` for writing\n";
+        exit(1);
+    }
+    return out;
+}
+
+// True if the text from start is an empty line, a newline with an optional carriage return
+bool blank_line(const std::vector<char> & text, size_t start) {
+    size_t len = text.size() - start;
+    return len == 1 || (len == 2 && text[start] == '\r');
+}
+
+// Start of the line after the one p is in, every line of a batch ends with a newline
+const char * next_line(const char * p, const char * end) {
+    return static_cast<const char *>(memchr(p, '\n', end - p)) + 1;
+}
+
+}
+
+FastqRename::FastqRename(const std::vector<std::string> & inputs, const std::vector<std::string> & outputs, const std::string & mapping,
+                         size_t threads, uint64_t first, int width, int level)
+    : in_(inputs.size()), outputs_(outputs), mapping_(mapping), map_(NULL), map_gz_(is_gz(mapping)), threads_(threads),
+      first_(first), width_(width), level_(level), slots_(2 * threads + 1), rename_seq_(0), last_seq_(std::numeric_limits<size_t>::max())
+{
+    for(size_t i = 0; i < inputs.size(); i++){
+        Input & in = in_[i];
+        in.file = inputs[i];
+        in.in   = in.file == "-" ? gzdopen(0, "rb") : gzopen(in.file.c_str(), "rb");
+        if(in.in == NULL) {
+            cout << "Error opening the fastq file `" << in.file << "` for reading\n";
+            exit(1);
+        }
+        gzbuffer(in.in, 1 << 20);
+        in.buf.resize(1 << 20);
+    }
+    // Opening an output truncates it, it can't be one of the inputs or the other outputs
+    std::vector<std::string> created(outputs);
+    if(!mapping.empty()) created.push_back(mapping);
+    for(size_t i = 0; i < created.size(); i++){
+        for(size_t j = 0; j < inputs.size(); j++){
+            if(same_file(created[i], inputs[j])) {
+                cout << "Error the output `" << created[i] << "` is also the input fastq file `" << inputs[j] << "`\n";
+                exit(1);
+            }
+        }
+        for(size_t j = 0; j < i; j++){
+            if(same_file(created[i], created[j])) {
+                cout << "Error `" << created[i] << "` is used for two of the outputs\n";
+                exit(1);
+            }
+        }
+    }
+    for(size_t i = 0; i < outputs.size(); i++){
+        out_.push_back(create(outputs[i]));
+        gz_.push_back(is_gz(outputs[i]));
+    }
+    if(!mapping.empty()) map_ = create(mapping);
+}
+
+FastqRename::~FastqRename() {
+    close();
+}
+
+void FastqRename::close() {
+    for(size_t i = 0; i < in_.size(); i++){
+        if(in_[i].in != NULL) gzclose(in_[i].in);
+        in_[i].in = NULL;
+    }
+    for(size_t i = 0; i < out_.size(); i++){
+        if(out_[i] != NULL && fclose(out_[i]) != 0) {
+            cout << "Error writing the fastq file `" << outputs_[i] << "`\n";
+            exit(1);
+        }
+        out_[i] = NULL;
+    }
+    if(map_ != NULL && fclose(map_) != 0) {
+        cout << "Error writing the read name mapping `" << mapping_ << "`\n";
+        exit(1);
+    }
+    map_ = NULL;
+}
+
+bool FastqRename::Input::line(std::vector<char> & out) {
+    bool got = false;
+    while(true){
+        if(pos == end){
+            int r = eof ? 0 : gzread(in, &buf[0], buf.size());
+            if(r < 0) {
+                cout << "Error reading the fastq file `" << file << "`\n";
+                exit(1);
+            }
+            pos = 0;
+            end = r;
+            if(r == 0){
+                eof = true;
+                // The last line doesn't need a newline
+                if(got) out.push_back('\n');
+                return got;
+            }
+        }
+        const char * s  = &buf[pos];
+        const char * nl = static_cast<const char *>(memchr(s, '\n', end - pos));
+        size_t len = nl == NULL ? end - pos : nl - s + 1;
+        out.insert(out.end(), s, s + len);
+        pos += len;
+        got  = true;
+        if(nl != NULL) return true;
+    }
+}
+
+void FastqRename::reader_() {
+    size_t n = in_.size();
+    for(size_t seq = 0; ; seq++){
+        Batch & b = slots_[seq % slots_.size()];
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            while(b.state != EMPTY) cond_.wait(lock);
+        }
+
+        b.reads = 0;
+        b.error.clear();
+        for(size_t m = 0; m < n; m++) b.text[m].clear();
+        bool eof = false;
+        while(b.reads < BATCH){
+            size_t ended = 0;
+            for(size_t m = 0; m < n; m++){
+                size_t lines = 0, blank = 0, start = b.text[m].size();
+                while(lines < 4 && in_[m].line(b.text[m])){
+                    // Empty lines are allowed after the last read
+                    if(lines == 0 && blank_line(b.text[m], start)) {
+                        b.text[m].resize(start);
+                        blank++;
+                        continue;
+                    }
+                    lines++;
+                }
+                if(blank > 0 && lines > 0) {
+                    cout << "Error the fastq file `" << in_[m].file << "` has an empty line before a read\n";
+                    exit(1);
+                }else if(lines == 0) {
+                    ended++;
+                }else if(lines < 4) {
+                    cout << "Error the last read of the fastq file `" << in_[m].file << "` is truncated\n";
+                    exit(1);
+                }
+            }
+            if(ended == n) {
+                eof = true;
+                break;
+            }else if(ended > 0) {
+                cout << "Error the fastq files `" << in_[0].file << "` and `" << in_[1].file << "` have different numbers of reads\n";
+                exit(1);
+            }
+            b.reads++;
+        }
+
+        boost::mutex::scoped_lock lock(mtx_);
+        b.eof   = eof;
+        b.state = READ;
+        if(eof) last_seq_ = seq;
+        cond_.notify_all();
+        if(eof) return;
+    }
+}
+
+void FastqRename::worker_() {
+    while(true){
+        size_t seq;
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            while(rename_seq_ <= last_seq_ && slots_[rename_seq_ % slots_.size()].state != READ) cond_.wait(lock);
+            if(rename_seq_ > last_seq_) return;
+            seq = rename_seq_++;
+            slots_[seq % slots_.size()].state = RENAMING;
+        }
+
+        Batch & b = slots_[seq % slots_.size()];
+        rename_(b, first_ + seq * BATCH);
+
+        boost::mutex::scoped_lock lock(mtx_);
+        b.state = RENAMED;
+        cond_.notify_all();
+    }
+}
+
+void FastqRename::rename_(Batch & b, uint64_t first) {
+    size_t n = in_.size();
+    const char * p[2];
+    const char * end[2];
+    for(size_t m = 0; m < n; m++){
+        p[m]   = b.text[m].empty() ? NULL : &b.text[m][0];
+        end[m] = p[m] + b.text[m].size();
+        b.out[m].clear();
+        b.out[m].reserve(b.text[m].size());
+    }
+    b.map.clear();
+
+    char id[32];
+    for(size_t r = 0; r < b.reads; r++){
+        int len = snprintf(id, sizeof(id), "%0*llu", width_, static_cast<unsigned long long>(first + r));
+        const char * ns = NULL, * ne = NULL;
+        for(size_t m = 0; m < n; m++){
+            const char * l1 = p[m];
+            const char * l2 = next_line(l1, end[m]);
+            const char * l3 = next_line(l2, end[m]);
+            const char * l4 = next_line(l3, end[m]);
+            p[m] = next_line(l4, end[m]);
+            if(*l1 != '@' || *l3 != '+') {
+                ostringstream os;
+                os << "Error read " << first - first_ + r + 1 << " of the fastq file `" << in_[m].file << "` isn't a fastq record\n";
+                b.error = os.str();
+                return;
+            }
+
+            // The name ends at the first space, the /1 and /2 mate suffixes aren't part of it
+            const char * s = l1 + 1, * e = s;
+            while(e < l2 && !isspace(*e)) e++;
+            if(n == 2 && e - s >= 2 && e[-2] == '/' && (e[-1] == '1' || e[-1] == '2')) e -= 2;
+            if(m == 0) {
+                ns = s;
+                ne = e;
+            }else if(e - s != ne - ns || memcmp(s, ns, e - s) != 0) {
+                ostringstream os;
+                os << "Error the mates of read " << first - first_ + r + 1 << " have different names `" << string(ns, ne) << "` and `" << string(s, e) << "`\n";
+                b.error = os.str();
+                return;
+            }
+
+            std::vector<char> & out = b.out[m];
+            out.push_back('@');
+            out.insert(out.end(), id, id + len);
+            out.push_back('\n');
+            out.insert(out.end(), l2, l3);
+            out.push_back('+');
+            out.push_back('\n');
+            out.insert(out.end(), l4, p[m]);
+        }
+        if(map_ != NULL) {
+            b.map.insert(b.map.end(), id, id + len);
+            b.map.push_back('\t');
+            b.map.insert(b.map.end(), ns, ne);
+            b.map.push_back('\n');
+        }
+    }
+
+    // The text buffers aren't needed anymore, they take the compressed output
+    for(size_t m = 0; m < n; m++){
+        if(gz_[m]) compress_(b.out[m], b.text[m]);
+    }
+    if(map_gz_) compress_(b.map, b.text[0]);
+}
+
+void FastqRename::compress_(std::vector<char> & data, std::vector<char> & tmp) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 31 window bits write a gzip header and trailer, the batches are joined as gzip members
+    deflateInit2(&zs, level_, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    tmp.resize(deflateBound(&zs, data.size()));
+    zs.next_in   = reinterpret_cast<Bytef *>(data.empty() ? NULL : &data[0]);
+    zs.avail_in  = data.size();
+    zs.next_out  = reinterpret_cast<Bytef *>(&tmp[0]);
+    zs.avail_out = tmp.size();
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        cout << "Error compressing the renamed reads\n";
+        exit(1);
+    }
+    tmp.resize(zs.total_out);
+    deflateEnd(&zs);
+    data.swap(tmp);
+}
+
+void FastqRename::write_(const std::vector<char> & data, FILE * out, const std::string & fout) {
+    if(!data.empty() && fwrite(&data[0], 1, data.size(), out) != data.size()) {
+        cout << "Error writing the file `" << fout << "`\n";
+        exit(1);
+    }
+}
+
+size_t FastqRename::run() {
+    Timer ti("Renaming the reads");
+    boost::thread reader(&FastqRename::reader_, this);
+    std::vector<boost::thread> workers;
+    for(size_t i = 0; i < threads_; i++){
+        workers.push_back(boost::thread(&FastqRename::worker_, this));
+    }
+
+    size_t total = 0;
+    for(size_t seq = 0; ; seq++){
+        Batch & b = slots_[seq % slots_.size()];
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            while(b.state != RENAMED) cond_.wait(lock);
+        }
+        if(!b.error.empty()) {
+            cout << b.error;
+            exit(1);
+        }
+        // An empty input still gets a valid (empty) gzip member
+        if(b.reads > 0 || seq == 0) {
+            for(size_t m = 0; m < out_.size(); m++) write_(b.out[m], out_[m], outputs_[m]);
+            if(map_ != NULL) write_(b.map, map_, mapping_);
+        }
+        total += b.reads;
+
+        bool eof = b.eof;
+        boost::mutex::scoped_lock lock(mtx_);
+        b.state = EMPTY;
+        cond_.notify_all();
+        if(eof) break;
+    }
+
+    reader.join();
+    for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+    close();
+    return total;
+}
+
+void rename_init_options(int argc, char *argv[], po::variables_map & vm) {
+    po::options_description generic("Arguments");
+    generic.add_options()
+    ("output,o", po::value<string>(), "Output prefix, the reads are written to <prefix>_1.fq.gz and <prefix>_2.fq.gz (<prefix>.fq.gz for single end reads)")
+    ("map,m", po::value<string>(), "Write the original read names to this file (<new name> <original name>, gzipped if it ends with .gz)")
+    ("start,s", po::value<uint64_t>()->default_value(1), "Name of the first read")
+    ("width,w", po::value<int>()->default_value(0), "Zero pad the names to this width so they also sort as plain strings")
+    ("level,l", po::value<int>()->default_value(6), "Gzip compression level (1-9)")
+    ("plain", "Write uncompressed fastq files (.fq)")
+    ("threads,t", po::value< unsigned int >()->default_value(4), "Number of threads to use for renaming and compressing")
+    ("help,h", "help message")
+    ;
+
+    po::options_description hidden("Hidden Options");
+    hidden.add_options()
+    ("inputs", po::value< vector<string> >(), "Input fastq files")
+    ;
+
+    po::options_description cmdline_options;
+    cmdline_options.add(generic).add(hidden);
+
+    po::positional_options_description pd;
+    pd.add("inputs", -1);
+
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(pd).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "Usage: " << endl;
+        cout << "rnasequel " << string(argv[0]) << " [options] -o <prefix> <reads1.fq.gz> [reads2.fq.gz]\n" << endl;
+        cout << generic << "\n";
+        exit(0);
+    }
+
+    bool error = false;
+
+    if(vm.count("output") == 0) {
+        cout << "An output prefix must be specified\n";
+        error = true;
+    }
+
+    if(vm.count("inputs") == 0 || vm["inputs"].as< vector<string> >().size() > 2) {
+        cout << "One fastq file or the two fastq files of the pairs must be specified\n";
+        error = true;
+    }
+
+    if(vm["threads"].as<unsigned int>() == 0) {
+        cout << "At least one thread has to be used\n";
+        error = true;
+    }
+
+    if(vm["width"].as<int>() < 0 || vm["width"].as<int>() > 20) {
+        cout << "The name width has to be between 0 and 20\n";
+        error = true;
+    }
+
+    if(vm["level"].as<int>() < 1 || vm["level"].as<int>() > 9) {
+        cout << "The compression level has to be between 1 and 9\n";
+        error = true;
+    }
+
+    if(error) exit(1);
+}
+
+int rnasequel::rename_fastq(int argc, char *argv[]) {
+    po::variables_map vm;
+    rename_init_options(argc, argv, vm);
+    Timer ti("Total renaming time");
+
+    const vector<string> & inputs = vm["inputs"].as< vector<string> >();
+    string prefix = vm["output"].as<string>();
+    string ext    = vm.count("plain") > 0 ? ".fq" : ".fq.gz";
+    vector<string> outputs;
+    if(inputs.size() == 1) {
+        outputs.push_back(prefix + ext);
+    }else{
+        outputs.push_back(prefix + "_1" + ext);
+        outputs.push_back(prefix + "_2" + ext);
+    }
+
+    FastqRename rename(inputs, outputs, vm.count("map") > 0 ? vm["map"].as<string>() : "", vm["threads"].as<unsigned int>(),
+                       vm["start"].as<uint64_t>(), vm["width"].as<int>(), vm["level"].as<int>());
+    size_t total = rename.run();
+    cout << "Renamed " << total << (inputs.size() == 1 ? " reads\n" : " read pairs\n");
+    return 0;
+}
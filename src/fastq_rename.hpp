@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_FASTQ_RENAME_HPP
+#define GW_FASTQ_RENAME_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <zlib.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace rnasequel {
+
+/**
+ * Renames the reads of one or two (paired) fastq files to integers
+ *
+ * A reader thread cuts the inputs (plain or gzip) into batches of BATCH
+ * reads, worker threads rename the batches and compress every batch of a
+ * .gz output into its own gzip member, the batches are written in the
+ * input order. The mates of a pair get the same name and the original
+ * names can be written to a tab separated mapping file.
+ */
+class FastqRename {
+    public:
+        static const size_t BATCH = 1UL << 16;
+
+        FastqRename(const std::vector<std::string> & inputs, const std::vector<std::string> & outputs, const std::string & mapping,
+                    size_t threads, uint64_t first = 1, int width = 0, int level = Z_DEFAULT_COMPRESSION);
+        ~FastqRename();
+
+        // Renames every read, returns the number of reads (pairs) renamed
+        size_t run();
+        void close();
+
+    private:
+        FastqRename(const FastqRename & f);
+        FastqRename & operator=(const FastqRename & f);
+
+        enum State { EMPTY, READ, RENAMING, RENAMED };
+
+        struct Input {
+            Input() : in(NULL), pos(0), end(0), eof(false) { }
+
+            // Appends the next line with its newline to out, false at the end of the file
+            bool line(std::vector<char> & out);
+
+            std::string         file;
+            gzFile              in;
+            std::vector<char>   buf;
+            size_t              pos;
+            size_t              end;
+            bool                eof;
+        };
+
+        struct Batch {
+            Batch() : text(2), out(2), reads(0), state(EMPTY), eof(false) { }
+
+            std::vector< std::vector<char> >    text;
+            std::vector< std::vector<char> >    out;
+            std::vector<char>                   map;
+            size_t                              reads;
+            // Why the batch couldn't be renamed, empty if it's fine
+            std::string                         error;
+            State                               state;
+            bool                                eof;
+        };
+
+        void reader_();
+        void worker_();
+        void rename_(Batch & b, uint64_t first);
+        // Compresses data into a gzip member, tmp is used as the output buffer
+        void compress_(std::vector<char> & data, std::vector<char> & tmp);
+        void write_(const std::vector<char> & data, FILE * out, const std::string & fout);
+
+        std::vector<Input>          in_;
+        std::vector<std::string>    outputs_;
+        std::vector<FILE *>         out_;
+        std::vector<bool>           gz_;
+        std::string                 mapping_;
+        FILE                      * map_;
+        bool                        map_gz_;
+        size_t                      threads_;
+        uint64_t                    first_;
+        int                         width_;
+        int                         level_;
+
+        std::vector<Batch>          slots_;
+        size_t                      rename_seq_;
+        size_t                      last_seq_;
+        boost::mutex                mtx_;
+        boost::condition_variable   cond_;
+};
+
+int rename_fastq(int argc, char * argv[]);
+
+};
+
+#endif
@@ -0,0 +1,233 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fragment_db.hpp"
+#include "binary_io.hpp"
+#include "tokenizer.hpp"
+#include "timer.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace rnasequel;
+using namespace std;
+
+const char FragmentDB::MAGIC[8] = { 'R', 'S', 'Q', 'F', 'D', 'B', '2', '\0' };
+
+struct SetIDCmp {
+    bool operator()(const FragmentDB::Set & a, const FragmentDB::Set & b) const {
+        return a.id < b.id;
+    }
+};
+
+bool FragmentDB::is_binary(const std::string & fin) {
+    ifstream ifs(fin.c_str(), ios::binary);
+    char magic[sizeof(MAGIC)];
+    if(!ifs.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void FragmentDB::open(const std::string & fin) {
+    close();
+    if(fin.empty()) return;
+    if(is_binary(fin)) {
+        map_binary_(fin);
+    } else {
+        read_text_(fin);
+    }
+}
+
+void FragmentDB::close() {
+    if(map_ != NULL) {
+        munmap(map_, map_size_);
+        map_ = NULL;
+        map_size_ = 0;
+    }
+    oblocks_.clear();
+    osets_.clear();
+    orecords_.clear();
+    sorted_ = true;
+    chrom_ids_.clear();
+    chroms_.clear();
+    sync_();
+}
+
+void FragmentDB::sync_() {
+    if(map_ != NULL) return;
+    blocks_   = oblocks_.empty() ? NULL : &oblocks_[0];
+    sets_     = osets_.empty() ? NULL : &osets_[0];
+    records_  = orecords_.empty() ? NULL : &orecords_[0];
+    nblocks_  = oblocks_.size();
+    nsets_    = osets_.size();
+    nrecords_ = orecords_.size();
+}
+
+void FragmentDB::finish_() {
+    if(map_ != NULL) return;
+    if(!sorted_) std::stable_sort(osets_.begin(), osets_.end(), SetIDCmp());
+    sorted_ = true;
+
+    orecords_.assign(osets_.empty() ? 0 : osets_.back().id + 1, Record());
+    for(size_t i = 0; i < osets_.size(); i++) {
+        Record & r = orecords_[osets_[i].id];
+        if(r.size == 0) r.start = i;
+        r.size++;
+    }
+    sync_();
+}
+
+uint32_t FragmentDB::chrom_id_(const std::string & chrom) {
+    std::map<std::string, uint32_t>::iterator it = chrom_ids_.find(chrom);
+    if(it != chrom_ids_.end()) return it->second;
+    uint32_t id = chroms_.size();
+    chrom_ids_.insert(std::make_pair(chrom, id));
+    chroms_.push_back(chrom);
+    return id;
+}
+
+void FragmentDB::read_text_(const std::string & fin) {
+    ifstream ifs(fin.c_str());
+    if(!ifs) {
+        cout << "Error opening the spanning junction database " << fin << " for reading\n";
+        exit(1);
+    }
+    Timer ti("Building the fragment index");
+
+    std::string line;
+    Tokenizer::token_t tokens;
+    std::vector<pos_t> starts, ends;
+    while(getline(ifs, line)) {
+	Tokenizer::get(line, '\t', tokens);
+        if(tokens.size() != 6 && tokens.size() != 7) continue;
+        uint32_t id     = atoi(tokens[0]);
+        Strand   strand = char2strand[static_cast<size_t>(tokens[2][0])];
+        size_t   bcount = atoi(tokens[3]);
+        uint32_t offset = tokens.size() == 7 ? atoi(tokens[6]) : 0;
+
+        starts.clear();
+        ends.clear();
+        Tokenizer bs(tokens[4], ','), be(tokens[5], ',');
+        while(bs.has_next() && be.has_next()) {
+            starts.push_back(atoi(bs.next()));
+            ends.push_back(atoi(be.next()));
+        }
+        if(bcount != starts.size()){
+            cout << "Block length error " << starts.size() << " vs " << bcount << "\n";
+        }
+        add(id, tokens[1], strand, starts, ends, offset);
+    }
+    finish_();
+}
+
+void FragmentDB::map_binary_(const std::string & fin) {
+    Timer ti("Mapping the fragment index");
+    int fd = ::open(fin.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        cout << "Error opening the fragment database " << fin << " for reading\n";
+        exit(1);
+    }
+
+    map_size_ = st.st_size;
+    map_ = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map_ == MAP_FAILED || map_size_ < sizeof(Header)) {
+        cout << "Error mapping the fragment database " << fin << "\n";
+        exit(1);
+    }
+
+    const char   * ptr = static_cast<const char *>(map_);
+    const Header * h   = reinterpret_cast<const Header *>(ptr);
+    // The counts are checked one at a time so a damaged header can't overflow the size
+    if(h->nblocks > map_size_ / sizeof(Block) || h->nsets > map_size_ / sizeof(Set) ||
+       h->nrecords > map_size_ / sizeof(Record) || h->names > map_size_) {
+        cout << "Error the fragment database " << fin << " is truncated\n";
+        exit(1);
+    }
+    size_t bsize = sizeof(Header) + h->nblocks * sizeof(Block) + h->nsets * sizeof(Set) + h->nrecords * sizeof(Record);
+    if(map_size_ < bsize + h->names) {
+        cout << "Error the fragment database " << fin << " is truncated\n";
+        exit(1);
+    }
+
+    nblocks_  = h->nblocks;
+    nsets_    = h->nsets;
+    nrecords_ = h->nrecords;
+    blocks_   = reinterpret_cast<const Block *>(ptr + sizeof(Header));
+    sets_     = reinterpret_cast<const Set *>(blocks_ + nblocks_);
+    records_  = reinterpret_cast<const Record *>(sets_ + nsets_);
+
+    const char * names = ptr + bsize;
+    const char * end   = names + h->names;
+    if(names < end && end[-1] != '\0') {
+        cout << "Error the fragment database " << fin << " is damaged, the chromosome names aren't terminated\n";
+        exit(1);
+    }
+    while(names < end) {
+        chroms_.push_back(names);
+        names += chroms_.back().size() + 1;
+    }
+
+    // Every set and record has to point inside the mapped arrays
+    for(size_t i = 0; i < nsets_; i++) {
+        const Set & s = sets_[i];
+        if(static_cast<uint64_t>(s.start) + s.size > nblocks_ || s.chrom >= chroms_.size()) {
+            cout << "Error the fragment database " << fin << " is damaged, set " << i << " is out of range\n";
+            exit(1);
+        }
+    }
+    for(size_t i = 0; i < nrecords_; i++) {
+        const Record & r = records_[i];
+        if(static_cast<uint64_t>(r.start) + r.size > nsets_) {
+            cout << "Error the fragment database " << fin << " is damaged, record " << i << " is out of range\n";
+            exit(1);
+        }
+    }
+}
+
+void FragmentDB::save(const std::string & fout) {
+    finish_();
+    BinaryWrite bw(fout);
+    if(!bw) {
+        cout << "Error opening the fragment database " << fout << " for writing\n";
+        exit(1);
+    }
+
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.nblocks  = nblocks_;
+    h.nsets    = nsets_;
+    h.nrecords = nrecords_;
+    h.names    = 0;
+    for(size_t i = 0; i < chroms_.size(); i++) h.names += chroms_[i].size() + 1;
+
+    bw.write<Header>(h);
+    bw.write_n(reinterpret_cast<const char *>(blocks_), nblocks_ * sizeof(Block));
+    bw.write_n(reinterpret_cast<const char *>(sets_), nsets_ * sizeof(Set));
+    bw.write_n(reinterpret_cast<const char *>(records_), nrecords_ * sizeof(Record));
+    for(size_t i = 0; i < chroms_.size(); i++) {
+        bw.write_n(chroms_[i].c_str(), chroms_[i].size() + 1);
+    }
+}
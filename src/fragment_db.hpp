@@ -0,0 +1,206 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_FRAGMENT_DB_H
+#define GW_FRAGMENT_DB_H
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <assert.h>
+
+namespace rnasequel {
+
+/**
+  * Flat fragment (transcriptome path) database
+  *
+  * Each transcriptome sequence (record) is the cDNA of one or more genomic
+  * block sets, a set starts at an offset in the sequence of its record.
+  * Records index a range of the set array which is sorted by the record id
+  * and sets point into a single block array. The binary (.fdb) layout is:
+  *   Header, Block[nblocks], Set[nsets], Record[nrecords], chromosome names ('\0' separated)
+  * so a binary database is mmap'd and used without any parsing. The text
+  * transcriptome index (.txt) is still supported and is parsed into the same
+  * arrays.
+  */
+class FragmentDB {
+    public:
+        struct Block {
+            Block() : lft(0), rgt(0), r_lft(0), r_rgt(0) { }
+            Block(pos_t l, pos_t r, pos_t rl, pos_t rr) : lft(l), rgt(r), r_lft(rl), r_rgt(rr) { }
+
+            // Genomic lft and rgt position
+            pos_t lft;
+            pos_t rgt;
+
+            // Position relative to the cDNA of the fragment
+            pos_t r_lft;
+            pos_t r_rgt;
+        };
+
+        struct Set {
+            Set() : id(0), chrom(0), strand(UNKNOWN), start(0), size(0), offset(0) { }
+
+            uint32_t id;
+            uint32_t chrom;
+            uint32_t strand;
+            uint32_t start;
+            uint32_t size;
+            // Position of the first block in the record sequence
+            uint32_t offset;
+        };
+
+        struct Record {
+            Record() : start(0), size(0) { }
+
+            uint32_t start;
+            uint32_t size;
+        };
+
+	FragmentDB() : map_(NULL), map_size_(0), sorted_(true), blocks_(NULL), sets_(NULL), records_(NULL), nblocks_(0), nsets_(0), nrecords_(0) { }
+
+        FragmentDB(const std::string & fin) : map_(NULL), map_size_(0), sorted_(true), blocks_(NULL), sets_(NULL), records_(NULL), nblocks_(0), nsets_(0), nrecords_(0) {
+            open(fin);
+        }
+
+        ~FragmentDB() {
+            close();
+        }
+
+        // Opens a binary database or parses a text transcriptome index
+        void open(const std::string & fin);
+        void close();
+
+        // Writes the database in the binary format
+        void save(const std::string & fout);
+
+        // Adds a block set to record id, sets can be added in any order
+        template <typename T>
+        void add(uint32_t id, const std::string & chrom, Strand strand, const T & starts, const T & ends, uint32_t offset = 0);
+
+        static bool is_binary(const std::string & fin);
+
+        // Number of records
+        size_t size() const {
+            return nrecords_;
+        }
+
+        size_t sets_size() const {
+            return nsets_;
+        }
+
+        size_t blocks_size() const {
+            return nblocks_;
+        }
+
+        const Record & operator[](size_t id) const {
+            assert(id < nrecords_);
+            return records_[id];
+        }
+
+        const Set & set(size_t i) const {
+            assert(i < nsets_);
+            return sets_[i];
+        }
+
+        const Block * blocks(const Set & s) const {
+            return blocks_ + s.start;
+        }
+
+        Strand strand(const Set & s) const {
+            return static_cast<Strand>(s.strand);
+        }
+
+        const std::string & chrom(const Set & s) const {
+            return chroms_[s.chrom];
+        }
+
+        const std::vector<std::string> & chroms() const {
+            return chroms_;
+        }
+
+    private:
+        FragmentDB(const FragmentDB & db);
+        FragmentDB & operator=(const FragmentDB & db);
+
+        struct Header {
+            char     magic[8];
+            uint64_t nblocks;
+            uint64_t nsets;
+            uint64_t nrecords;
+            uint64_t names;
+        };
+
+        static const char MAGIC[8];
+
+        void read_text_(const std::string & fin);
+        void map_binary_(const std::string & fin);
+        void sync_();
+
+        // Sorts the sets by record and builds the record index
+        void finish_();
+
+        uint32_t chrom_id_(const std::string & chrom);
+
+        // Memory mapped binary database
+        void                              * map_;
+        size_t                              map_size_;
+
+        // Owned storage used when parsing or building a database
+        std::vector<Block>                  oblocks_;
+        std::vector<Set>                    osets_;
+        std::vector<Record>                 orecords_;
+        bool                                sorted_;
+        std::map<std::string, uint32_t>     chrom_ids_;
+
+        const Block                       * blocks_;
+        const Set                         * sets_;
+        const Record                      * records_;
+        size_t                              nblocks_;
+        size_t                              nsets_;
+        size_t                              nrecords_;
+        std::vector<std::string>            chroms_;
+};
+
+template <typename T>
+void FragmentDB::add(uint32_t id, const std::string & chrom, Strand strand, const T & starts, const T & ends, uint32_t offset) {
+    assert(map_ == NULL && starts.size() == ends.size());
+    if(!osets_.empty() && osets_.back().id > id) sorted_ = false;
+    osets_.push_back(Set());
+    Set & s = osets_.back();
+    s.id     = id;
+    s.chrom  = chrom_id_(chrom);
+    s.strand = strand;
+    s.start  = oblocks_.size();
+    s.size   = starts.size();
+    s.offset = offset;
+
+    pos_t p = 0;
+    for(size_t i = 0; i < starts.size(); i++) {
+        pos_t len = ends[i] - starts[i] + 1;
+        oblocks_.push_back(Block(starts[i], ends[i], p, p + len - 1));
+        p += len;
+    }
+    sync_();
+}
+
+}; // namespace rnasequel
+#endif
@@ -124,8 +124,8 @@ void FragmentSize::calculate_size_(ReadPair & p) {
             p.fragment_fail() = true;
             p.discordant() = true;
             if(max_gene_dist_ > 0 && dist <= max_gene_dist_){
-                intervals_->find_overlap_ids(p.ref(), p.s1().rlft(), p.s1().rrgt(), r1_genes_, iresults_, p.strand());
-                intervals_->find_overlap_ids(p.ref(), p.s2().rlft(), p.s2().rrgt(), r2_genes_, iresults_, p.strand());
+                intervals_->find_overlaps(p.ref(), p.s1().rlft(), p.s1().rrgt(), r1_genes_, iresults_, p.strand());
+                intervals_->find_overlaps(p.ref(), p.s2().rlft(), p.s2().rrgt(), r2_genes_, iresults_, p.strand());
                 std::sort(r1_genes_.begin(), r1_genes_.end());
                 std::sort(r2_genes_.begin(), r2_genes_.end());
                 auto it1 = r1_genes_.begin(), it2 = r2_genes_.begin();
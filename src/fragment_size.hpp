@@ -95,8 +95,8 @@ class FragmentSize {
 	Stranded                    stranded_;
 	ReadPairFactory             factory_;
         GeneIntervals::IntervalVect iresults_;
-        std::vector<std::string>    r1_genes_;
-        std::vector<std::string>    r2_genes_;
+        GeneIntervals::GeneList     r1_genes_;
+        GeneIntervals::GeneList     r2_genes_;
         int                         max_dist_;
         int                         max_gene_dist_;
         int                         fb_dist_;
@@ -91,7 +91,7 @@ void FragmentMap::_read(ifstream &ifs) {
 }
 
 void FragmentMap::_read_line(Tokenizer::token_t & tokens) {
-    if(tokens.size() != 6) return;
+    if(tokens.size() < 6) return;
     size_t id     = atoi(tokens[0]);
     char * ref    = tokens[1];
     Strand strand = char2strand[static_cast<size_t>(tokens[2][0])];
@@ -17,13 +17,20 @@ You should have received a copy of the GNU General Public License
 along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #include "gtf.hpp"
 #include <fstream>
+#include <cstring>
 #include "tokenizer.hpp"
 #include "timer.hpp"
+#include "binary_io.hpp"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/copy.hpp>
+#include <boost/thread/thread.hpp>
 
 using namespace std;
 using namespace rnasequel;
@@ -35,162 +42,594 @@ typedef boost::unordered_map< std::string, size_t >      TranscriptMap;
 typedef GeneMap::iterator g_iterator;
 typedef TranscriptMap::iterator tx_iterator;
 
-void GTF::parse(const std::string & file, Model & m) {
-    boost::iostreams::filtering_istream in;
-    std::ifstream                       ifs;
-    bool gz = file.rfind(".gz") == (file.length() - 3);
-    ifs.open(file.c_str(), std::ios_base::in | std::ios_base::binary);
+/*
+  A parsed exon / start_codon / stop_codon line, the strings point into the
+  line buffer which must outlive the record
+*/
+struct GTFLine {
+    enum Type { SKIP, EXON, START_CODON, STOP_CODON, ERROR };
+
+    GTFLine() : type(SKIP), chrom(NULL), source(NULL), gid(NULL), tid(NULL), pid(NULL), gname(NULL), strand('.'), lft(0), rgt(0), line_no(0) { }
+
+    Type         type;
+    const char * chrom;
+    const char * source;
+    const char * gid;
+    const char * tid;
+    const char * pid;
+    const char * gname;
+    char         strand;
+    pos_t        lft;
+    pos_t        rgt;
+    size_t       line_no;
+    std::string  error;
+};
+
+static void parse_line(char * line, size_t line_no, std::vector<char *> & tokens, GTFLine & rec) {
+    rec.type    = GTFLine::SKIP;
+    rec.line_no = line_no;
+    if(line[0] == '#' || line[0] == 'G' || line[0] == 'H' || line[0] == '\0') return;
+
+    Tokenizer::get(line, '\t', tokens);
+
+    if(tokens.size() < 9 || tokens.size() > 10){
+        rec.type  = GTFLine::ERROR;
+        rec.error = "number of tokens = " + std::to_string(tokens.size());
+        return;
+    }
 
-    if(!ifs) {
-        std::cout << "Error opening the gtf file `" << file << "` for reading\n";
-        exit(1);
+    if(strcmp(tokens[2], "exon") == 0)             rec.type = GTFLine::EXON;
+    else if(strcmp(tokens[2], "start_codon") == 0) rec.type = GTFLine::START_CODON;
+    else if(strcmp(tokens[2], "stop_codon") == 0)  rec.type = GTFLine::STOP_CODON;
+    else return;
+
+    char * tags = tokens[8];
+    rec.gid   = NULL;
+    rec.tid   = NULL;
+    rec.pid   = NULL;
+    rec.gname = NULL;
+
+    while(*tags != '\0'){
+        while(*tags == ' ') tags++;
+        if(*tags == '\0') break;
+        char * keyp = tags;
+        while(*(++tags) != ' ');
+        *tags = '\0';
+        tags += 2;
+        char * valp = tags;
+        while(*(++tags) != '"');
+        *tags = '\0';
+        tags++;
+        if(*tags != ';'){
+            rec.type  = GTFLine::ERROR;
+            rec.error.assign("keyp = ").append(keyp).append(" valp = ").append(valp);
+            return;
+        }
+
+        if(strcmp("gene_name", keyp) == 0){
+            rec.gname = valp;
+        }else if(strcmp("gene_id", keyp) == 0){
+            rec.gid = valp;
+        }else if(strcmp("transcript_id", keyp) == 0){
+            rec.tid = valp;
+        }else if(strcmp("protein_id", keyp) == 0){
+            rec.pid = valp;
+        }
+
+        tags++;
     }
 
-    if(gz) {
-        in.push(boost::iostreams::gzip_decompressor());
+    if(rec.gid == NULL || rec.tid == NULL){
+        rec.type  = GTFLine::ERROR;
+        rec.error = "missing gene_id or transcript_id";
+        return;
     }
-    in.push(ifs);
 
-    Timer ti("Total GTF parsing time");
+    rec.chrom  = tokens[0];
+    rec.source = tokens[1];
+    rec.strand = *tokens[6];
+    rec.lft    = atoi(tokens[3]) - 1;
+    rec.rgt    = atoi(tokens[4]) - 1;
+}
 
-    {
+// Adds the parsed lines to the model in file order
+class ModelBuilder {
+    public:
+        ModelBuilder(const std::string & file, Model & m) : file_(file), m_(m), gene_ptr_(0), tx_ptr_(0) { }
+
+        void add(const GTFLine & rec) {
+            if(rec.type == GTFLine::SKIP) return;
+            if(rec.type == GTFLine::ERROR){
+                std::cout << "Error malformed GTF file: " << file_ << " at line: " << rec.line_no << " " << rec.error << "\n";
+                exit(1);
+            }
+
+            if(chrom_id_ != rec.chrom){
+                chrom_id_ = rec.chrom;
+                chrom_it_ = m_.chrom(chrom_id_);
+            }
+
+            if(last_gene_ != rec.gid){
+                last_gene_ = rec.gid;
+                pair<g_iterator, bool> res = gmap_.insert(GeneMap::value_type(last_gene_, 0));
+                if(res.second){
+                    res.first->second = chrom_it_->second.size();
+                    chrom_it_->second.push_back(Gene());
+                    Gene & gene = chrom_it_->second.back();
+                    gene.id()        = rec.gid;
+                    gene.name()      = rec.gname == NULL ? "" : rec.gname;
+                    gene.strand()    = char2strand[static_cast<size_t>(rec.strand)];
+                    gene.ref()       = chrom_id_;
+                }
+                gene_ptr_ = res.first->second;
+            }
+
+            Gene & gene = chrom_it_->second[gene_ptr_];
+
+            if(last_tx_ != rec.tid){
+                last_tx_ = rec.tid;
+                pair<tx_iterator, bool> res = tmap_.insert(TranscriptMap::value_type(last_tx_, 0));
+                if(res.second){
+                    res.first->second = gene.transcripts().size();
+                    gene.transcripts().push_back(Transcript());
+                    Transcript & tx = gene.transcripts().back();
+                    tx.source() = rec.source;
+                    tx.strand() = char2strand[static_cast<size_t>(rec.strand)];
+                    tx.id()     = rec.tid;
+                    if(rec.pid != NULL) tx.pid() = rec.pid;
+                }
+                tx_ptr_ = res.first->second;
+            }
+
+            Transcript & tx = gene.transcripts()[tx_ptr_];
+
+            if(rec.type == GTFLine::EXON){
+                tx.add_exon(rec.lft, rec.rgt);
+            }else if(rec.type == GTFLine::START_CODON){
+                tx.set_coding();
+                if(tx.strand() == PLUS){
+                    tx.cds_start() = rec.lft;
+                }else{
+                    tx.cds_end()   = rec.rgt;
+                }
+            }else if(rec.type == GTFLine::STOP_CODON){
+                tx.set_coding();
+                if(tx.strand() == PLUS){
+                    tx.cds_end()   = rec.rgt;
+                }else{
+                    tx.cds_start() = rec.lft;
+                }
+            }
+        }
 
-    Timer ti2("Time parsing the GTF file");
+    private:
+        const std::string & file_;
+        Model             & m_;
+        GeneMap             gmap_;
+        TranscriptMap       tmap_;
+        size_t              gene_ptr_;
+        size_t              tx_ptr_;
+        std::string         chrom_id_;
+        std::string         last_gene_;
+        std::string         last_tx_;
+        Model::iterator     chrom_it_;
+};
+
+// Parses the lines of a chunk of an uncompressed GTF file held in memory
+class GTFChunkParser {
+    public:
+        GTFChunkParser() : start_(NULL), end_(NULL), lines_(0), running_(false) { }
+
+        void init(char * start, char * end) {
+            start_ = start;
+            end_   = end;
+        }
 
-    GeneMap       gmap;
-    TranscriptMap tmap;
-    size_t gene_ptr = 0, tx_ptr = 0;
+        void operator()() {
+            recs_.clear();
+            lines_ = 0;
+            char * p = start_;
+            while(p < end_){
+                char * nl = static_cast<char *>(memchr(p, '\n', end_ - p));
+                if(nl == NULL) nl = end_;
+                *nl = '\0';
+                if(nl > p && *(nl - 1) == '\r') *(nl - 1) = '\0';
+                GTFLine rec;
+                parse_line(p, lines_, tokens_, rec);
+                if(rec.type != GTFLine::SKIP) recs_.push_back(rec);
+                lines_++;
+                if(rec.type == GTFLine::ERROR) break;
+                p = nl + 1;
+            }
+        }
 
-    std::string line, gene_id, tx_id, chrom_id, last_gene, last_tx;
-    std::vector<char *> tokens;
-    std::vector< std::pair<char *, char *> > tag_tokens;
-    Model::iterator chrom_it;
-    unsigned int line_no = 0;
+        void start() {
+            running_ = true;
+            thread_  = boost::thread(boost::ref(*this));
+        }
 
+        void join() {
+            if(running_){
+                thread_.join();
+                running_ = false;
+            }
+        }
 
+        const std::vector<GTFLine> & records() const {
+            return recs_;
+        }
+
+        size_t lines() const {
+            return lines_;
+        }
+
+    private:
+        char                     * start_;
+        char                     * end_;
+        size_t                     lines_;
+        std::vector<char *>        tokens_;
+        std::vector<GTFLine>       recs_;
+        boost::thread              thread_;
+        bool                       running_;
+};
+
+static void parse_stream(const std::string & file, std::istream & in, Model & m) {
+    ModelBuilder builder(file, m);
+    std::string line;
+    std::vector<char *> tokens;
+    GTFLine rec;
+    size_t line_no = 0;
     while(getline(in, line)) {
-	if(line[0] == '#' || line[0] == 'G' || line[0] == 'H'){
-	    line_no++;
-	    continue;
-	}
+        parse_line(&line[0], line_no++, tokens, rec);
+        builder.add(rec);
+    }
+}
 
-	Tokenizer::get(line, '\t', tokens);
+// Bytes of the GTF read for each parser thread at a time
+const size_t GTF_CHUNK = 1UL << 22;
 
-	if(tokens.size() < 9 || tokens.size() > 10){
-	    std::cout << "Error malformed GTF file: " << file << " at line: " << line_no << " number of tokens = " << tokens.size() << "\n";
-	    exit(1);
-	}
+/*
+  The file is read GTF_CHUNK bytes per thread at a time and split into one
+  chunk per thread at line boundaries, the chunks are parsed in parallel and
+  added to the model in order so the model is the same as a sequential parse.
+  The line cut off at the end of a read is carried to the next one
+*/
+static void parse_parallel(const std::string & file, std::ifstream & ifs, Model & m, unsigned int threads) {
+    std::vector<GTFChunkParser> parsers(threads);
+    ModelBuilder builder(file, m);
+    size_t line_no = 0;
+    // One spare byte for the terminator of a last line without a newline
+    std::vector<char> buffer(threads * GTF_CHUNK + 1);
+    size_t size = 0;
+    bool   eof  = false;
+    while(!eof || size > 0){
+        if(!eof){
+            if(buffer.size() < size + GTF_CHUNK + 1) buffer.resize(size + GTF_CHUNK + 1);
+            ifs.read(&buffer[size], buffer.size() - size - 1);
+            size += ifs.gcount();
+            eof   = !ifs;
+            if(eof && !ifs.eof()){
+                std::cout << "Error reading the gtf file `" << file << "`\n";
+                exit(1);
+            }
+        }
 
-	if(strcmp(tokens[2], "exon") != 0 
-		&& strcmp(tokens[2], "stop_codon") != 0
-		&& strcmp(tokens[2], "start_codon") != 0) continue;
-
-	char * tags = tokens[8];
-
-	char * gid = NULL;
-	char * tid = NULL;
-	char * pid = NULL;
-	char * gname = NULL;
-
-        //std::cout << "  tags = '" << tags << "'\n";
-	//char * tname = NULL;
-
-	while(*tags != '\0'){
-            if(*tags == '\0') break;
-	    while(*tags == ' ') tags++;
-            if(*tags == '\0') break;
-	    char * keyp = tags;
-	    while(*(++tags) != ' ');
-	    *tags = '\0';
-	    tags += 2;
-	    char * valp = tags;
-	    while(*(++tags) != '"');
-	    *tags = '\0';
-	    tags++;
-	    if(*tags != ';'){
-		std::cout << "Error malformed GTF file: " << file << " at line: " << line_no << " keyp = " << keyp << " valp = " << valp << "\n";
-		exit(1);
-	    }
+        // Only whole lines are parsed until the end of the file, a longer line is read further
+        size_t used = size;
+        if(!eof){
+            while(used > 0 && buffer[used - 1] != '\n') used--;
+            if(used == 0) continue;
+        }
 
-	    if(strcmp("gene_name", keyp) == 0){
-		gname = valp;
-	    }else if(strcmp("gene_id", keyp) == 0){
-		gid = valp;
-	    }else if(strcmp("transcript_id", keyp) == 0){
-		tid = valp;
-	    //}else if(strcmp("transcript_name", keyp) == 0){
-		//tname = valp;
-	    }else if(strcmp("protein_id", keyp) == 0){
-		pid = valp;
-	    }
+        char * p   = &buffer[0];
+        char * end = p + used;
+        for(size_t i = 0; i < parsers.size(); i++){
+            char * cend = i + 1 == parsers.size() ? end : std::min(end, p + used / threads);
+            while(cend < end && *cend != '\n') cend++;
+            parsers[i].init(p, cend);
+            p = cend < end ? cend + 1 : end;
+        }
 
-	    tags++;
-	}
+        for(size_t i = 1; i < parsers.size(); i++){
+            parsers[i].start();
+        }
+        parsers[0]();
+        for(size_t i = 1; i < parsers.size(); i++){
+            parsers[i].join();
+        }
 
-	if(gid == NULL || tid == NULL){
-	    std::cout << "Error malformed GTF file: " << file << " at line: " << line_no << "\n";
-	    exit(1);
-	}
+        for(size_t i = 0; i < parsers.size(); i++){
+            const std::vector<GTFLine> & recs = parsers[i].records();
+            for(size_t j = 0; j < recs.size(); j++){
+                if(recs[j].type == GTFLine::ERROR){
+                    GTFLine rec = recs[j];
+                    rec.line_no += line_no;
+                    builder.add(rec);
+                }
+                builder.add(recs[j]);
+            }
+            line_no += parsers[i].lines();
+        }
 
-	chrom_id = tokens[0];
-	chrom_it = m.chrom(chrom_id);
-	gene_id  = gid;
-	tx_id    = tid;
-
-	if(last_gene != gene_id){
-	    pair<g_iterator, bool> res = gmap.insert(GeneMap::value_type(gene_id, 0));
-	    if(res.second){
-		res.first->second = chrom_it->second.size();
-		chrom_it->second.push_back(Gene());
-		Gene & gene = chrom_it->second.back();
-		gene.id()        = gid;
-		gene.name()      = gname == NULL ? "" : gname;
-		gene.strand()    = char2strand[static_cast<size_t>(*tokens[6])];
-                gene.ref()       = chrom_id;
-	    }
-	    last_gene = gene_id;
-	    gene_ptr = res.first->second;
-	}
+        std::copy(buffer.begin() + used, buffer.begin() + size, buffer.begin());
+        size -= used;
+    }
+}
 
-	Gene & gene = chrom_it->second[gene_ptr];
-
-	if(last_tx != tx_id){
-	    pair<tx_iterator, bool> res = tmap.insert(TranscriptMap::value_type(tx_id, 0));
-	    if(res.second){
-		res.first->second = gene.transcripts().size();
-		gene.transcripts().push_back(Transcript());
-		Transcript & tx = gene.transcripts().back();
-		tx.source() = tokens[1];
-		tx.strand() = char2strand[static_cast<size_t>(*tokens[6])];
-		tx.id()     = tid;
-		if(pid != NULL) tx.pid() = pid;
-	    }
-	    last_tx = tx_id; 
-	    tx_ptr = res.first->second;
-	}
+/*
+  Binary annotation cache, written next to the GTF (file.cache) unless
+  --gtf-cache moves it or --no-gtf-cache turns it off. It's only used when the size, inode, modification and change times and a hash of
+  sampled blocks of the GTF match so it's checked without reading the whole
+  file. An edit that keeps the size, lands within the same second as the
+  cached timestamps and leaves the sampled blocks alone isn't detected,
+  delete the cache after rewriting a GTF that way. The body is followed by
+  its length and hash so a truncated or damaged cache is parsed again
+*/
+static const char     CACHE_MAGIC[8] = { 'R', 'S', 'Q', 'G', 'T', 'F', '2', '\0' };
+static const size_t   CACHE_SAMPLES  = 16;
+static const size_t   CACHE_SAMPLE   = 1 << 16;
 
-	Transcript & tx = gene.transcripts()[tx_ptr];
+struct CacheKey {
+    CacheKey() : size(0), inode(0), mtime(0), ctime(0), hash(0) { }
 
-	if(strcmp(tokens[2], "exon") == 0){
-	    tx.add_exon(atoi(tokens[3]) - 1, atoi(tokens[4]) - 1);
-	}else if(strcmp(tokens[2], "start_codon") == 0){
-	    tx.set_coding();
-	    if(tx.strand() == PLUS){
-		tx.cds_start() = atoi(tokens[3]) - 1;
-	    }else{
-		tx.cds_end()   = atoi(tokens[4]) - 1;
-	    }
-	}else if(strcmp(tokens[2], "stop_codon") == 0){
-	    tx.set_coding();
-	    if(tx.strand() == PLUS){
-		tx.cds_end()   = atoi(tokens[4]) - 1;
-	    }else{
-		tx.cds_start() = atoi(tokens[3]) - 1;
-	    }
-	}
+    bool operator==(const CacheKey & k) const {
+        return size == k.size && inode == k.inode && mtime == k.mtime && ctime == k.ctime && hash == k.hash;
+    }
 
-	line_no++;
+    uint64_t size;
+    uint64_t inode;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint64_t hash;
+};
 
+static const size_t   CACHE_HEADER   = sizeof(CACHE_MAGIC) + sizeof(CacheKey);
+static const size_t   CACHE_TRAILER  = 2 * sizeof(uint64_t);
+
+static void fnv_hash(uint64_t & hash, const char * data, size_t n) {
+    for(size_t j = 0; j < n; j++){
+        hash = (hash ^ static_cast<unsigned char>(data[j])) * 1099511628211ULL;
+    }
+}
+
+// Hashes the n bytes of the stream from its current position, false if it's shorter
+static bool fnv_stream(std::istream & in, uint64_t n, uint64_t & hash) {
+    hash = 14695981039346656037ULL;
+    std::vector<char> block(1 << 20);
+    while(n > 0){
+        in.read(&block[0], std::min<uint64_t>(n, block.size()));
+        size_t r = in.gcount();
+        if(r == 0) return false;
+        fnv_hash(hash, &block[0], r);
+        n -= r;
+    }
+    return true;
+}
+
+static bool cache_key(const std::string & file, CacheKey & key) {
+    struct stat st;
+    if(stat(file.c_str(), &st) != 0) return false;
+    key.size  = st.st_size;
+    key.inode = st.st_ino;
+    key.mtime = st.st_mtime;
+    key.ctime = st.st_ctime;
+    key.hash  = 14695981039346656037ULL;
+
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if(!ifs) return false;
+    std::vector<char> block(CACHE_SAMPLE);
+    for(size_t i = 0; i < CACHE_SAMPLES; i++){
+        uint64_t pos = key.size > CACHE_SAMPLE ? (key.size - CACHE_SAMPLE) / (CACHE_SAMPLES - 1) * i : 0;
+        ifs.seekg(pos);
+        ifs.read(&block[0], block.size());
+        size_t n = ifs.gcount();
+        ifs.clear();
+        fnv_hash(key.hash, &block[0], n);
+        if(key.size <= CACHE_SAMPLE) break;
+    }
+    return true;
+}
+
+class StringTable {
+    public:
+        uint32_t add(const std::string & s) {
+            std::pair<boost::unordered_map<std::string, uint32_t>::iterator, bool> res = ids_.insert(std::make_pair(s, strs_.size()));
+            if(res.second) strs_.push_back(s);
+            return res.first->second;
+        }
+
+        const std::vector<std::string> & strings() const {
+            return strs_;
+        }
+
+    private:
+        boost::unordered_map<std::string, uint32_t> ids_;
+        std::vector<std::string>                    strs_;
+};
+
+static void save_cache(const std::string & cache, const CacheKey & key, const Model & m) {
+    StringTable table;
+    for(Model::const_iterator it = m.begin(); it != m.end(); ++it){
+        table.add(it->first);
+        for(size_t i = 0; i < it->second.size(); i++){
+            const Gene & g = it->second[i];
+            table.add(g.id());
+            table.add(g.name());
+            table.add(g.ref());
+            for(Gene::const_iterator tx = g.begin(); tx != g.end(); ++tx){
+                table.add(tx->id());
+                table.add(tx->pid());
+                table.add(tx->source());
+            }
+        }
+    }
+
+    // A unique temporary name so concurrent runs on the same GTF don't write the same file
+    std::string tmp = cache + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if(fd < 0) return;
+    fchmod(fd, 0644);
+    ::close(fd);
+    {
+        BinaryWrite bw(tmp);
+        if(!bw) {
+            unlink(tmp.c_str());
+            return;
+        }
+        bw.write_n(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        bw.write<CacheKey>(key);
+
+        const std::vector<std::string> & strs = table.strings();
+        bw.write64(strs.size());
+        for(size_t i = 0; i < strs.size(); i++){
+            bw.write_str(strs[i]);
+        }
+
+        bw.write64(m.size());
+        for(Model::const_iterator it = m.begin(); it != m.end(); ++it){
+            bw.write32(table.add(it->first));
+            bw.write64(it->second.size());
+            for(size_t i = 0; i < it->second.size(); i++){
+                const Gene & g = it->second[i];
+                bw.write32(table.add(g.id()));
+                bw.write32(table.add(g.name()));
+                bw.write32(table.add(g.ref()));
+                bw.write<PosBlock>(g);
+                bw.write64(g.transcripts().size());
+                for(Gene::const_iterator tx = g.begin(); tx != g.end(); ++tx){
+                    bw.write32(table.add(tx->id()));
+                    bw.write32(table.add(tx->pid()));
+                    bw.write32(table.add(tx->source()));
+                    bw.write<PosBlock>(*tx);
+                    bw.write<pos_t>(tx->cds_start());
+                    bw.write<pos_t>(tx->cds_end());
+                    bw.write8(tx->coding());
+                    bw.write_vector(tx->exons());
+                }
+            }
+        }
+    }
+
+    // The length and hash of the body are appended after it's written
+    uint64_t body = 0, hash = 0;
+    bool ok = false;
+    {
+        std::ifstream ifs(tmp.c_str(), std::ios::binary);
+        ifs.seekg(0, std::ios::end);
+        uint64_t size = ifs.tellg();
+        if(ifs && size >= CACHE_HEADER){
+            body = size - CACHE_HEADER;
+            ifs.seekg(CACHE_HEADER);
+            ok = fnv_stream(ifs, body, hash);
+        }
+    }
+    if(ok){
+        FILE * fp = fopen(tmp.c_str(), "ab");
+        ok = fp != NULL;
+        if(ok){
+            ok = fwrite(&body, sizeof(body), 1, fp) == 1 && fwrite(&hash, sizeof(hash), 1, fp) == 1;
+            ok = fclose(fp) == 0 && ok;
+        }
+    }
+
+    // Renamed into place so a partially written cache is never used
+    if(!ok || rename(tmp.c_str(), cache.c_str()) != 0) unlink(tmp.c_str());
+}
+
+static bool load_cache(const std::string & cache, const CacheKey & key, Model & m) {
+    {
+        std::ifstream ifs(cache.c_str(), std::ios::binary);
+        char     magic[sizeof(CACHE_MAGIC)];
+        CacheKey ckey;
+        if(!ifs.read(magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0) return false;
+        if(!ifs.read(reinterpret_cast<char *>(&ckey), sizeof(ckey)) || !(ckey == key)) return false;
+
+        // The body must have the length and hash stored after it
+        ifs.seekg(0, std::ios::end);
+        uint64_t size = ifs.tellg();
+        if(!ifs || size < CACHE_HEADER + CACHE_TRAILER) return false;
+        uint64_t body = size - CACHE_HEADER - CACHE_TRAILER, clen = 0, chash = 0, hash = 0;
+        ifs.seekg(CACHE_HEADER + body);
+        if(!ifs.read(reinterpret_cast<char *>(&clen), sizeof(clen)) || !ifs.read(reinterpret_cast<char *>(&chash), sizeof(chash))) return false;
+        if(clen != body) return false;
+        ifs.seekg(CACHE_HEADER);
+        if(!fnv_stream(ifs, body, hash) || hash != chash) return false;
+    }
+
+    BinaryRead br(cache, 1 << 20);
+    br.seek(CACHE_HEADER);
+
+    std::vector<std::string> strs(br.read64());
+    for(size_t i = 0; i < strs.size(); i++){
+        br.read_str(strs[i]);
+    }
+
+    size_t nchroms = br.read64();
+    for(size_t c = 0; c < nchroms; c++){
+        Model::gene_list & genes = m[strs[br.read32()]];
+        genes.resize(br.read64());
+        for(size_t i = 0; i < genes.size(); i++){
+            Gene & g = genes[i];
+            g.id()   = strs[br.read32()];
+            g.name() = strs[br.read32()];
+            g.ref()  = strs[br.read32()];
+            br.read<PosBlock>(g);
+            g.transcripts().resize(br.read64());
+            for(Gene::iterator tx = g.begin(); tx != g.end(); ++tx){
+                tx->id()     = strs[br.read32()];
+                tx->pid()    = strs[br.read32()];
+                tx->source() = strs[br.read32()];
+                br.read<PosBlock>(*tx);
+                br.read<pos_t>(tx->cds_start());
+                br.read<pos_t>(tx->cds_end());
+                uint8_t coding = 0;
+                br.read8(coding);
+                if(coding) tx->set_coding();
+                br.read_vector(tx->exons());
+            }
+        }
+    }
+    return true;
+}
+
+std::string GTF::cache_file(const boost::program_options::variables_map & vm) {
+    if(vm.count("no-gtf-cache") > 0) return "";
+    if(vm.count("gtf-cache") > 0) return vm["gtf-cache"].as<std::string>();
+    return vm["gtf"].as<std::string>() + ".cache";
+}
+
+void GTF::parse(const std::string & file, Model & m, unsigned int threads, const std::string & cache) {
+    Timer ti("Total GTF parsing time");
+
+    CacheKey    key;
+    bool        keyed = !cache.empty() && cache_key(file, key);
+    if(keyed && load_cache(cache, key, m)){
+        std::cout << "  Loaded the annotation from the cache " << cache << "\n";
+        return;
+    }else if(keyed && access(cache.c_str(), F_OK) == 0){
+        std::cout << "  The cache " << cache << " is stale or damaged, parsing the GTF again\n";
+    }
+
+    std::ifstream ifs;
+    bool gz = file.rfind(".gz") == (file.length() - 3);
+    ifs.open(file.c_str(), std::ios_base::in | std::ios_base::binary);
+
+    if(!ifs) {
+        std::cout << "Error opening the gtf file `" << file << "` for reading\n";
+        exit(1);
+    }
+
+    {
+
+    Timer ti2("Time parsing the GTF file");
+
+    if(gz) {
+        boost::iostreams::filtering_istream in;
+        in.push(boost::iostreams::gzip_decompressor());
+        in.push(ifs);
+        parse_stream(file, in, m);
+    }else{
+        parse_parallel(file, ifs, m, std::max(threads, 1U));
     }
 
     }
@@ -201,9 +640,7 @@ void GTF::parse(const std::string & file, Model & m) {
     for(Model::iterator it = m.begin(); it != m.end(); ++it){
 	for(size_t i = 0; i < it->second.size(); ++i){
 	    Gene & g = it->second[i];
-	    //cout << g.id() << " size: " << g.transcripts().size() << "\n";
 	    for(Gene::iterator tx_it = g.begin(); tx_it != g.end(); ++tx_it){
-		//cout << "    " << tx_it->id() << " size: " << tx_it->exons().size() << "\n";
 		g.lft() = std::min(g.lft(), tx_it->lft());    
 		g.rgt() = std::max(g.rgt(), tx_it->rgt());    
 		if(tx_it->cds_start() == MAX_POS) tx_it->cds_start() = 0;
@@ -218,12 +655,5 @@ void GTF::parse(const std::string & file, Model & m) {
 
     }
 
-    /*
-    for(Model::iterator it = m.begin(); it != m.end(); ++it){
-	for(size_t i = 0; i < it->second.size(); ++i){
-	    Gene & g = it->second[i];
-            cout << g << "\n";
-        }
-    }
-    */
+    if(keyed) save_cache(cache, key, m);
 }
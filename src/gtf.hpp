@@ -25,6 +25,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <map>
 #include "models.hpp"
 #include <boost/unordered_map.hpp>
+#include <boost/program_options/variables_map.hpp>
 
 namespace rnasequel {
 
@@ -34,7 +35,11 @@ class GTF {
 
 	}
 
-	static void parse(const std::string & file, Model & m);
+	// Uncompressed files are parsed with threads and the parsed model is cached in cache, an empty name doesn't cache
+	static void parse(const std::string & file, Model & m, unsigned int threads = 1, const std::string & cache = "");
+
+	// The cache of the --gtf-cache and --no-gtf-cache options, <gtf>.cache by default
+	static std::string cache_file(const boost::program_options::variables_map & vm);
 
     private:
 };
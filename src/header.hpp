@@ -21,6 +21,8 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #define GW_BAM_HEADER
 
 #include <string>
+#include <cstring>
+#include <cstdlib>
 #include <bam/bam.h>
 #include <vector>
 #include <stdint.h>
@@ -85,6 +87,8 @@ class BamHeader {
         }
 
         void from_index(const FastaIndex & fi);
+        // A copy of the header with its sort order (@HD SO) set to order
+        void copy_sorted(const BamHeader & bh, const std::string & order);
 
 
     private:
@@ -108,6 +112,25 @@ inline void BamHeader::set_cstruct(bam_header_t *bh) {
     }
 }
 
+// The header text with its sort order set to order
+inline std::string sort_order_text(const char * text, size_t len, const std::string & order) {
+    std::string t(text, len);
+    while(!t.empty() && t[t.size() - 1] == '\0') t.erase(t.size() - 1);
+    if(t.compare(0, 3, "@HD") != 0) return "@HD\tVN:1.0\tSO:" + order + "\n" + t;
+
+    size_t eol = t.find('\n');
+    if(eol == std::string::npos) eol = t.size();
+    size_t so = t.find("\tSO:");
+    if(so == std::string::npos || so > eol){
+        t.insert(eol, "\tSO:" + order);
+    }else{
+        size_t end = t.find_first_of("\t\n", so + 1);
+        if(end == std::string::npos) end = t.size();
+        t.replace(so + 4, end - so - 4, order);
+    }
+    return t;
+}
+
 inline int32_t BamHeader::chrom2tid(const std::string &c) const {
     boost::unordered_map<std::string, int32_t>::const_iterator it;
     it = _ref2tid.find(c);
@@ -130,6 +153,29 @@ inline void BamHeader::from_index(const FastaIndex & fi) {
     }
 }
 
+inline void BamHeader::copy_sorted(const BamHeader & bh, const std::string & order) {
+    _dest = true;
+    if(_bh != NULL) bam_header_destroy(_bh);
+    _bh = bam_header_init();
+
+    const bam_header_t * h = bh.cstruct();
+    _bh->n_targets     = h->n_targets;
+    _bh->target_name   = (char**)malloc((h->n_targets + 1) * sizeof(char*));
+    _bh->target_len    = (uint32_t*)malloc((h->n_targets + 1) * sizeof(uint32_t));
+    for(int32_t i = 0; i < h->n_targets; i++){
+        _bh->target_len[i]  = h->target_len[i];
+        _bh->target_name[i] = strdup(h->target_name[i]);
+    }
+
+    std::string text = sort_order_text(h->text, h->l_text, order);
+    _bh->l_text = text.size();
+    _bh->text   = (char*)malloc(text.size() + 1);
+    memcpy(_bh->text, text.c_str(), text.size() + 1);
+
+    _tid2ref.clear();
+    set_cstruct(_bh);
+}
+
 };
 
 #endif
@@ -74,6 +74,15 @@ class MemPoolList{
             return _items.front();
         }
 
+        // Inserts a copy of v before pos
+        T & insert(iterator pos, const T & v){
+            if(_pool->empty()) return *_items.insert(pos, v);
+            _items.splice(pos, *_pool, _pool->begin());
+            --pos;
+            *pos = v;
+            return *pos;
+        }
+
         T & pool_add_front(){
             if(_pool->empty()) _pool->push_back(T());
             return _pool->front();
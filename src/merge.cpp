@@ -35,20 +35,54 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "resolve_fragments.hpp"
 #include "splice_trim.hpp"
 #include "pair_output.hpp"
+#include "prepare.hpp"
+#include "context_image.hpp"
+#include "tokenizer.hpp"
+#include "failure.hpp"
+#include <boost/thread/mutex.hpp>
+#include <fstream>
+#include <cstdio>
+#include <memory>
+#include <limits>
+#include <set>
 
 namespace po = boost::program_options;
 
 using namespace std;
 using namespace rnasequel;
 
-void merge_init_options(int argc, char *argv[], po::variables_map & vm) {
+// Parses --shard i/N into a 0 based index, returns false if it's missing or malformed
+bool parse_shard(const po::variables_map & vm, size_t & i, size_t & n) {
+    if(vm.count("shard") == 0) return false;
+    const string & s = vm["shard"].as<string>();
+    size_t p = s.find('/');
+    if(p == string::npos || p == 0 || p + 1 == s.size()) return false;
+    i = strtoul(s.substr(0, p).c_str(), NULL, 10);
+    n = strtoul(s.substr(p + 1).c_str(), NULL, 10);
+    if(i < 1 || i > n) return false;
+    i--;
+    return true;
+}
+
+// fragsize shares the merge options, it adds --combine and doesn't write alignments
+void merge_init_options(int argc, char *argv[], po::variables_map & vm, bool fragsize = false) {
     po::options_description generic("Arguments");
     generic.add_options()
     ("ref,r", po::value< string >(), "The indexed reference prefix")
     ("gtf,g", po::value< string >(), "GTF file (optional)")
-    ("fragments,f", po::value<string>(), "Transcriptome index prefix")
+    ("gtf-cache", po::value< string >(), "Parsed annotation cache, loaded instead of the GTF when it matches and written after parsing it (default <gtf>.cache)")
+    ("no-gtf-cache", "Don't read or write the parsed annotation cache")
+    ("fragments,f", po::value<string>(), "Transcriptome fragment database (.fdb or .txt)")
+    ("context,x", po::value<string>(), "Merge context image from rnasequel prepare (replaces --gtf and --fragments)")
     ("output,o", po::value<string>(), "Output Prefix")
-    ("threads,t", po::value< unsigned int >()->default_value(4), "Number of threads to use for processing")
+    ("batch,b", po::value<string>(), "Sample manifest, one tab separated sample per line: <output prefix> <ref1.bam> <juncs1.bam> <ref2.bam> <juncs2.bam>, or <output prefix> <ref.bam> <juncs.bam> when both mates are in the same files")
+    ("samples,s", po::value<unsigned int>()->default_value(1), "Number of batch samples merged at the same time, the threads are split between them")
+    ("parallel-output", "Compress the output of every thread on its own and join the pieces by copying blocks, the reads of a thread stay together instead of following the input order")
+    ("input-order", "The bam files are in the order the aligner wrote them (the read order of the fastq files) instead of sorted by read name, the reference bam files need every read")
+    ("sorted", "Write the output sorted by coordinate with its index (.bai)")
+    ("sort-mem", po::value<unsigned int>()->default_value(768), "Memory budget (MB) of --sorted, sorted runs that don't fit are kept in temporary files")
+    ("shard", po::value<string>(), "Only use the read names of shard i of N (i/N, 1 based), the shards of a sample split its reads without overlap")
+    ("threads,t", po::value< unsigned int >()->default_value(4), "Number of threads to use for processing, sam inputs are parsed with up to half of them")
     ("help,h", "help message")
     ;
 
@@ -64,6 +98,10 @@ void merge_init_options(int argc, char *argv[], po::variables_map & vm) {
     ("min-obs", po::value<unsigned int>()->default_value(100000), "Minimum number of fragment size observations required")
     ("max-repeat", po::value<unsigned int>()->default_value(10), "Maximum number of repeat pairs")
     ("frag-sizes,F", po::value< string >(), "Previously estimated fragment sizes")
+    ("replay-mem", po::value<unsigned int>()->default_value(1024), "Memory budget (MB) for keeping the read groups used for the estimation so they aren't read again when merging, 0 to disable")
+    ("single-pass", "Merge while the distribution is estimated, pairs that depend on it are resolved again with the final distribution at the end")
+    ("provisional-obs", po::value<unsigned int>()->default_value(20000), "Number of observations for the provisional distribution used by --single-pass")
+    ("sample-windows", po::value<unsigned int>()->default_value(0), "Estimate from this many evenly spaced windows of the input instead of its start, 0 to read from the start")
     //("min-unique,u", po::value< unsigned int >()->default_value(3), "Minimum number of unique reads mapping across the junction")
     //("end-prop,e", po::value< double >()->default_value(0.85), "Proportion of reads that fall within the end region of a read (defined when junctions are extracted)")
     ;
@@ -98,11 +136,20 @@ void merge_init_options(int argc, char *argv[], po::variables_map & vm) {
     ("juncs2", po::value< string >(), "Read 2 Junction Alignment Bam File")
     ;
 
+    po::options_description combine("Combining Distributions");
+    combine.add_options()
+    ("combine", po::value< vector<string> >()->multitoken(), "Add up the raw counts of these distributions (-dist.txt files) into one normalized distribution instead of reading alignments")
+    ;
+
     po::options_description cmdline_options;
     cmdline_options.add(generic).add(fragments).add(alignment).add(hidden);
 
     po::options_description visible;
     visible.add(generic).add(alignment).add(fragments);
+    if(fragsize){
+        cmdline_options.add(combine);
+        visible.add(combine);
+    }
 
     po::positional_options_description pd;
     pd.add("refs1",1);
@@ -115,212 +162,432 @@ void merge_init_options(int argc, char *argv[], po::variables_map & vm) {
 
     if (vm.count("help")) {
         cout << "Usage: " << endl;
-        cout << "rnasequel " << string(argv[0]) << " [options] <ref1.bam> <ref2.bam> <juncs1.bam> <juncs2.bam>\n" << endl;
+        cout << "rnasequel " << string(argv[0]) << " [options] <ref1.bam> <juncs1.bam> <ref2.bam> <juncs2.bam>\n" << endl;
+        cout << "rnasequel " << string(argv[0]) << " [options] <ref.bam> <juncs.bam> (both mates in each file)\n" << endl;
         cout << visible << "\n";
         exit(0);
     }
 
     bool error = false;
 
-    if(vm.count("output") == 0) {
-        cout << "An output prefix must be specified\n";
+    if(fragsize && vm.count("combine") > 0) {
+        if(vm.count("output") == 0) {
+            cout << "An output prefix must be specified\n";
+            exit(1);
+        }
+        return;
+    }
+
+    if(fragsize && vm.count("batch") > 0) {
+        cout << "The fragment sizes are estimated for one sample at a time\n";
         error = true;
+    }else if(vm.count("batch") > 0) {
+        if(vm.count("output") > 0 || vm.count("refs1") > 0 || vm.count("juncs1") > 0 || vm.count("refs2") > 0 || vm.count("juncs2") > 0) {
+            cout << "The output prefix and alignment files are given by the batch manifest\n";
+            error = true;
+        }
+        if(vm["samples"].as<unsigned int>() == 0) {
+            cout << "At least one sample has to be merged at a time\n";
+            error = true;
+        }
+    }else{
+        if(vm.count("output") == 0) {
+            cout << "An output prefix must be specified\n";
+            error = true;
+        }
+
+        if(vm.count("refs1") == 0) {
+            cout << "A reference alignment bam file for read 1 must be specified\n";
+            error = true;
+        }
+
+        if(vm.count("juncs1") == 0){
+            cout << "A transcriptome alignment bam file for read 1 be specified\n";
+            error = true;
+        }
+
+        // Without the read 2 files the read 1 files hold both mates
+        if(vm.count("refs2") > 0 && vm.count("juncs2") == 0){
+            cout << "A transcriptome alignment bam file for read 2 be specified\n";
+            error = true;
+        }
     }
 
-    if(vm.count("refs1") == 0) {
-        cout << "A reference alignment bam file for read 1 must be specified\n";
+    if(vm.count("ref") == 0) {
+        cout << "The indexed reference genome prefix must be specified\n";
         error = true;
     }
 
-    if(vm.count("juncs1") == 0){
-        cout << "A transcriptome alignment bam file for read 1 be specified\n";
+    if(vm.count("context") > 0) {
+        if(vm.count("fragments") > 0 || vm.count("gtf") > 0) {
+            cout << "The GTF and fragment index are part of the context image and can't be specified with it\n";
+            error = true;
+        }
+    }else if(vm.count("fragments") == 0) {
+        cout << "The fragment index must be specified\n";
         error = true;
     }
 
-    if(vm.count("refs2") == 0) {
-        cout << "A reference alignment bam file for read 2 must be specified\n";
+    if(vm.count("single-pass") > 0 && vm.count("frag-sizes") > 0) {
+        cout << "A single pass merge estimates the fragment sizes and can't be used with --frag-sizes\n";
         error = true;
     }
 
-    if(vm.count("juncs2") == 0){
-        cout << "A transcriptome alignment bam file for read 2 be specified\n";
+    size_t si, sn;
+    if(vm.count("shard") > 0 && !parse_shard(vm, si, sn)) {
+        cout << "The shard has to be given as i/N with 1 <= i <= N\n";
         error = true;
     }
 
-    if(vm.count("ref") == 0) {
-        cout << "The indexed reference genome prefix must be specified\n";
+    if(vm.count("shard") > 0 && vm["sample-windows"].as<unsigned int>() > 0) {
+        cout << "Sampling windows span the whole input and can't be used with a shard\n";
         error = true;
     }
 
-    if(vm.count("fragments") == 0) {
-        cout << "The fragment index must be specified\n";
+    if(vm["sample-windows"].as<unsigned int>() > 0 && vm["obs"].as<int>() <= 0) {
+        cout << "Sampling windows needs a number of observations to split between them (--obs)\n";
+        error = true;
+    }
+
+    if(vm.count("input-order") > 0 && (vm.count("shard") > 0 || vm["sample-windows"].as<unsigned int>() > 0)) {
+        cout << "Shards and sampling windows seek by read name and need bam files sorted by read name, they can't be used with --input-order\n";
+        error = true;
+    }
+
+    if(vm.count("sorted") > 0 && vm.count("parallel-output") > 0) {
+        cout << "Sorted output and parallel output can't be used together\n";
         error = true;
     }
 
     if(error) exit(1);
 }
 
-int rnasequel::merge_alignments(int argc, char *argv[]) {
-    po::variables_map vm;
-    merge_init_options(argc,argv,vm);
+struct MergeSample {
+    std::string output;
+    std::string refs1;
+    std::string juncs1;
+    std::string refs2;
+    std::string juncs2;
+};
 
-    bool debug = false;
+/**
+ * Reference, annotation, fragment and junction state that is loaded once
+ * and shared by every sample of a run
+ */
+struct MergeShared {
+    MergeShared(const po::variables_map & vm);
 
-    FastaIndex fi(vm["ref"].as<string>());
-    fi.load_all();
+    FastaIndex          fi;
+    ContextImage        context;
+    CompactModel        model;
+    ResolveFragments    rf;
+    SpliceTrimmer       strimmer;
+    SizeDist            no_dist;
+    PairJunctions       pjuncs;
+    GeneIntervals       gene_intervals;
+    EstimateDist        estimate_dist;
+    Stranded            stranded;
+    int                 fb_dist;
+};
 
-    ResolveFragments rf;
-    SpliceTrimmer strimmer(vm["intron-trim"].as<unsigned int>());
-    Model model;
-    int fb_dist = vm["max-fallback-dist"].as<int>();
-    if(vm.count("gtf") > 0){
-        GTF::parse(vm["gtf"].as<string>(), model);
-        fb_dist = 0;
-        model.sort_genes();
-    }
-    Stranded stranded(vm.count("first-strand") ? Stranded::FIRST_STRAND : (vm.count("second-strand") ? Stranded::SECOND_STRAND : Stranded::UNSTRANDED));
-    GeneIntervals gene_intervals;
+MergeShared::MergeShared(const po::variables_map & vm) 
+    : fi(vm["ref"].as<string>()), strimmer(vm["intron-trim"].as<unsigned int>()), 
+      pjuncs(no_dist, vm["min-length"].as<unsigned int>()), 
+      stranded(vm.count("first-strand") ? Stranded::FIRST_STRAND : (vm.count("second-strand") ? Stranded::SECOND_STRAND : Stranded::UNSTRANDED)),
+      fb_dist(vm["max-fallback-dist"].as<int>())
+{
+    fi.load_all();
+    if(vm.count("context") > 0){
+        context.open(vm["context"].as<string>());
+        model.load(context);
+        if(model.genes_size() > 0) fb_dist = 0;
+        rf.open(context);
+        pjuncs.load(context);
+        strimmer.load(context);
+    }else{
+        if(vm.count("gtf") > 0){
+            // Only the compact copy is kept, the parsed model is released here
+            Model parsed;
+            GTF::parse(vm["gtf"].as<string>(), parsed, vm["threads"].as<unsigned int>(), GTF::cache_file(vm));
+            fb_dist = 0;
+            parsed.sort_genes();
+            model.build(parsed);
+        }
+        rf.open(vm["fragments"].as<string>());
+        build_merge_junctions(model, rf.fragment_db(), pjuncs, strimmer);
+    }
     gene_intervals.build(model);
-    SizeDist      size_dist(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
-    PairJunctions pjuncs(size_dist, vm["min-length"].as<unsigned int>());
-    EstimateDist estimate_dist(model, vm["min-exon"].as<unsigned int>());
+    estimate_dist.init(model, vm["min-exon"].as<unsigned int>());
+}
 
-    {
+void read_manifest(const std::string & fin, std::vector<MergeSample> & samples) {
+    ifstream ifs(fin.c_str());
+    if(!ifs) {
+        cout << "Error opening the sample manifest " << fin << " for reading\n";
+        exit(1);
+    }
+    std::string line;
+    Tokenizer::token_t tokens;
+    std::set<std::string> outputs;
+    size_t lnum = 0;
+    while(getline(ifs, line)) {
+        lnum++;
+        if(line.empty() || line[0] == '#') continue;
+        Tokenizer::get(line, '\t', tokens);
+        if(tokens.size() != 5 && tokens.size() != 3) {
+            cout << "Error line " << lnum << " of the sample manifest " << fin << " does not have 3 or 5 columns\n";
+            exit(1);
+        }
+        MergeSample s;
+        s.output = tokens[0];
+        s.refs1  = tokens[1];
+        s.juncs1 = tokens[2];
+        if(tokens.size() == 5) {
+            s.refs2  = tokens[3];
+            s.juncs2 = tokens[4];
+        }
+        // Two samples writing to the same prefix would overwrite each other's output
+        if(!outputs.insert(s.output).second) {
+            cout << "Error line " << lnum << " of the sample manifest " << fin << " repeats the output prefix " << s.output << "\n";
+            exit(1);
+        }
+        samples.push_back(s);
+    }
+    if(samples.empty()) {
+        cout << "Error the sample manifest " << fin << " is empty\n";
+        exit(1);
+    }
+}
 
-        const size_t STEP = 5000;
-        PairedReader reader(vm["refs1"].as<string>(), vm["juncs1"].as<string>(), 
-                            vm["refs2"].as<string>(), vm["juncs2"].as<string>(), STEP);
+/**
+ * Restricts the reader to the read names of the shard. A boundary is the first name
+ * the four files line up on after seeking to i/N of their size, every shard finds the
+ * same boundaries so shard i covers the names from boundary i up to boundary i + 1
+ */
+void apply_shard(const po::variables_map & vm, const MergeSample & sample, PairedReader & reader) {
+    size_t i, n;
+    if(!parse_shard(vm, i, n)) return;
+    if(i + 1 < n){
+        PairedReader next(sample.refs1, sample.juncs1, sample.refs2, sample.juncs2, 1);
+        next.seek(1.0 * (i + 1) / n);
+        reader.set_end(next.start());
+    }
+    if(i > 0) reader.seek(1.0 * i / n);
+}
 
-        rf.open(reader.tx1_header(), reader.ref1_header(), vm["fragments"].as<string>());
-        {
-            Timer ti("Building the splice junction maps");
-            pjuncs.set_model(model);
-
-            for(auto const & m : rf.fragment_map()){
-                for(auto const & s : m.second){
-                    for(size_t i = 1; i < s.size(); i++){
-                        pjuncs.add_junction(m.first, PosBlock(s[i - 1].rgt, s[i].lft, s.strand()));
-                        strimmer.add_junction(m.first, s[i - 1].rgt, s[i].lft);
-                    }
-                }
-            }
+// Piped input can only be read once and sam text can't be seeked in, false if the options need to seek
+bool check_streams(const po::variables_map & vm, const MergeSample & sample, bool & stream) {
+    stream = BamReader::is_stream(sample.refs1) || BamReader::is_stream(sample.juncs1) || 
+             BamReader::is_stream(sample.refs2) || BamReader::is_stream(sample.juncs2);
+    bool sam = BamReader::is_sam(sample.refs1) || BamReader::is_sam(sample.juncs1) || 
+               BamReader::is_sam(sample.refs2) || BamReader::is_sam(sample.juncs2);
+    if(sam && (vm.count("shard") > 0 || vm["sample-windows"].as<unsigned int>() > 0)) {
+        cout << "Error shards and sampling windows seek in the input, they need bam files and can't be used with sam or piped input\n";
+        return false;
+    }
+    return true;
+}
 
-            pjuncs.prepare();
-            strimmer.merge();
+// Adds the fragment size observations of a sample to size_dist until min_obs are found and
+// returns their number, the groups read are kept in prefix while replay is set and they fit the budget
+size_t estimate_sizes(const po::variables_map & vm, MergeShared & shared, PairedReader & reader, const ResolveFragments & rf, 
+                      PairJunctions & pjuncs, SizeDist & size_dist, int min_obs, unsigned int nthreads, bool progress,
+                      GroupStore & prefix, size_t budget, bool & replay, std::ostream & log) {
+    bool   debug   = false;
+    size_t windows = vm["sample-windows"].as<unsigned int>();
+
+    std::vector< std::unique_ptr<PairEstimator> > threads(nthreads);
+    std::vector<GroupStore>     stores(nthreads);
+    for(size_t i = 0; i < threads.size(); i++){
+        threads[i].reset(new PairEstimator);
+        threads[i]->set_debug(debug);
+        threads[i]->set_params(vm["min-score"].as<double>(), vm["min-length"].as<unsigned int>());
+        threads[i]->score_filter.set_scores(vm["match"].as<int>(), vm["mismatch"].as<int>(),
+                                   vm["gap-open"].as<int>(), vm["gap-ext"].as<int>(), vm["canonical-motifs"].as<string>(),
+                                   vm["score-GTAG"].as<int>(), vm["score-canonical"].as<int>(), 
+                                   vm["score-non-canonical"].as<int>());
+        threads[i]->score_filter.set_seqs(shared.fi, reader.ref1_header());
+        threads[i]->trimmer = &shared.strimmer;
+        threads[i]->pair_factory.set_stranded(shared.stranded);
+        threads[i]->rf = &rf;
+        threads[i]->score_filter.set_intron_penalties(vm["big-intron-size"].as<unsigned int>(), vm["big-intron-penalty"].as<int>());
+        threads[i]->score_diff = vm["score-diff"].as<unsigned int>();
+        threads[i]->score_filter.set_filtering_params(vm["min-score"].as<double>(), vm["score-diff"].as<unsigned int>() * 2, vm["max-edit-dist"].as<int>());
+        threads[i]->dist.init(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
+        threads[i]->fsize.init(pjuncs, shared.estimate_dist, threads[i]->dist, shared.stranded, shared.gene_intervals, 
+                                vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), shared.fb_dist, vm["score-bonus"].as<int>());
+        threads[i]->record = replay ? &stores[i] : NULL;
+    }
+    size_t total = 0;
+    Timer ti("Total Time Estimating Fragment Sizes", log);
+    size_t window = 0;
+    string last;
+    while(true){
+        if(!reader.load_input()){
+            // The window reached the end of the files, the remaining windows start past it
+            if(windows == 0 || ++window >= windows) break;
+            reader.seek(1.0 * window / windows, last);
+            continue;
+        }
+        size_t start   = 0;
+        size_t num_per = reader.count() / threads.size();
+        size_t extra   = reader.count() - num_per * threads.size();
+        for(size_t i = 0; i < threads.size(); i++){
+            size_t end = start + num_per;
+            if(extra > 0){
+                end++;
+                extra--;
+            }
+            //log << "i: " << i << " Start: " << start << " end: " << end << " sz = " << reader.count() << "\n";
+            threads[i]->init(reader.input.begin() + start, reader.input.begin() + end);
+            start = end;
         }
-        //FragmentSize fragment_size(pjuncs, estimate_dist, size_dist, stranded, gene_intervals, 
-        //        vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), fb_dist, vm["score-bonus"].as<int>());
 
+        for(size_t i = 1; i < threads.size(); i++){
+            threads[i]->start();
+        }
+        threads[0]->operator()();
+        //log << "0: " << threads[0]->num_passed << " " << threads[0]->num_used << "\n";
 
+        int obs = threads[0]->num_passed;
+        size_t unq = threads[0]->num_used;
+        for(size_t i = 1; i < threads.size(); i++){
+            threads[i]->join();
+            unq += threads[i]->num_used;
+            obs += threads[i]->num_passed;
+            //log << i << ": " << threads[i]->num_passed << " " << threads[i]->num_used << "\n";
+        }
 
-        //("score-GTAG", po::value<int>()->default_value(-3), "Score penalty for GT-AG splice junctions")
-        //("score-canonical", po::value<int>()->default_value(-6), "Score penalty for canonical junctions (see canonical-motifs option)")
-        //("score-non-canonical", po::value<int>()->default_value(-12))
-        if(vm.count("frag-sizes") == 0){
-            std::vector<PairEstimator*> threads(vm["threads"].as<unsigned int>());
+        if(replay){
             for(size_t i = 0; i < threads.size(); i++){
-                threads[i] = new PairEstimator;
-                threads[i]->set_debug(debug);
-                threads[i]->set_params(vm["min-score"].as<double>(), vm["min-length"].as<unsigned int>());
-                threads[i]->score_filter.set_scores(vm["match"].as<int>(), vm["mismatch"].as<int>(),
-                                           vm["gap-open"].as<int>(), vm["gap-ext"].as<int>(), vm["canonical-motifs"].as<string>(),
-                                           vm["score-GTAG"].as<int>(), vm["score-canonical"].as<int>(), 
-                                           vm["score-non-canonical"].as<int>());
-                threads[i]->score_filter.set_seqs(fi, reader.ref1_header());
-                threads[i]->trimmer = &strimmer;
-                threads[i]->pair_factory.set_stranded(stranded);
-                threads[i]->rf = &rf;
-                threads[i]->score_filter.set_intron_penalties(vm["big-intron-size"].as<unsigned int>(), vm["big-intron-penalty"].as<int>());
-                threads[i]->score_diff = vm["score-diff"].as<unsigned int>();
-                threads[i]->score_filter.set_filtering_params(vm["min-score"].as<double>(), vm["score-diff"].as<unsigned int>() * 2, vm["max-edit-dist"].as<int>());
-                threads[i]->dist.init(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
-                threads[i]->fsize.init(pjuncs, estimate_dist, threads[i]->dist, stranded, gene_intervals, 
-                                        vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), fb_dist, vm["score-bonus"].as<int>());
+                prefix.append(stores[i]);
+                stores[i].clear();
             }
-            size_t total = 0;
-            Timer ti("Total Time Estimating Fragment Sizes");
-            int min_obs = vm["obs"].as<int>();
-            while(reader.load_input() > 0){
-                size_t start   = 0;
-                size_t num_per = reader.count() / threads.size();
-                size_t extra   = reader.count() - num_per * threads.size();
+            if(prefix.bytes() > budget){
+                replay = false;
+                prefix.release();
                 for(size_t i = 0; i < threads.size(); i++){
-                    size_t end = start + num_per;
-                    if(extra > 0){
-                        end++;
-                        extra--;
-                    }
-                    //cout << "i: " << i << " Start: " << start << " end: " << end << " sz = " << reader.count() << "\n";
-                    threads[i]->init(reader.input.begin() + start, reader.input.begin() + end);
-                    start = end;
-                }
-
-                for(size_t i = 1; i < threads.size(); i++){
-                    threads[i]->start();
-                }
-                threads[0]->operator()();
-                //cout << "0: " << threads[0]->num_passed << " " << threads[0]->num_used << "\n";
-
-                int obs = threads[0]->num_passed;
-                size_t unq = threads[0]->num_used;
-                for(size_t i = 1; i < threads.size(); i++){
-                    threads[i]->join();
-                    unq += threads[i]->num_used;
-                    obs += threads[i]->num_passed;
-                    //cout << i << ": " << threads[i]->num_passed << " " << threads[i]->num_used << "\n";
+                    threads[i]->record = NULL;
+                    stores[i].release();
                 }
+            }
+        }
 
-                if(min_obs > 0 && obs >= min_obs){
-                    break;
-                }
+        if(min_obs > 0 && obs >= min_obs){
+            break;
+        }
 
-                total = reader.total();
-                if(total % 1000000 == 0){
-                    time_t e = ti.elapsed();
-                    if(e > 0){
-                        cout  << "\33[2K\rObservations: " << obs << " [" << std::setprecision(2) << std::fixed << (100.0 * obs / min_obs) << "% complete] Total processed: " << total << " " << (total / e) << " pair groups / second";
-                        cout.flush();
-                    }
-                }
+        // Each window contributes an equal share of the observations
+        if(windows > 0){
+            last = reader.last_qname();
+            if(obs >= static_cast<int>(1.0 * min_obs * (window + 1) / windows)){
+                if(++window >= windows) break;
+                reader.seek(1.0 * window / windows, last);
             }
-            cout << "\n\nTotal: " << reader.total() << "\n";
-            size_t obs = 0;
-            for(size_t i = 0; i < threads.size(); i++){
-                obs += threads[i]->num_passed;
-                size_dist += threads[i]->dist;
-                delete threads[i];
+        }
+
+        total = reader.total();
+        if(progress && total % 1000000 == 0){
+            time_t e = ti.elapsed();
+            if(e > 0){
+                log  << "\33[2K\rObservations: " << obs << " [" << std::setprecision(2) << std::fixed << (100.0 * obs / min_obs) << "% complete] Total processed: " << total << " " << (total / e) << " pair groups / second";
+                log.flush();
             }
-            if(obs < vm["min-obs"].as<unsigned int>()){
-                cout << "Error only observed " << obs << " observations\n";
+        }
+    }
+    log << "\n\nTotal: " << reader.total() << "\n";
+    size_t obs = 0;
+    for(size_t i = 0; i < threads.size(); i++){
+        obs += threads[i]->num_passed;
+        size_dist += threads[i]->dist;
+    }
+    return obs;
+}
+
+// Estimates the fragment size distribution of a sample and merges its alignments
+// Batch samples write their report to <prefix>-report.txt instead of stdout
+int merge_sample_(const po::variables_map & vm, MergeShared & shared, const MergeSample & sample, unsigned int nthreads, bool batch, bool progress, std::ostream & log) {
+    bool debug = false;
+
+    ResolveFragments rf;
+    SizeDist      size_dist(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
+    PairJunctions pjuncs(shared.pjuncs, size_dist);
+
+    // Groups merged while estimating, replayed into the resolver if they fit the budget
+    GroupStore prefix;
+    size_t     budget = static_cast<size_t>(vm["replay-mem"].as<unsigned int>()) << 20;
+    // Sampled windows aren't a prefix of the input so they can't be replayed
+    size_t     windows = vm["sample-windows"].as<unsigned int>();
+    bool       replay = budget > 0 && vm.count("frag-sizes") == 0 && windows == 0;
+    // A single pass merge only estimates a provisional distribution up front
+    bool       single = vm.count("single-pass") > 0;
+    bool       stream = false;
+    if(!check_streams(vm, sample, stream)) return 1;
+    if(stream && vm.count("frag-sizes") == 0){
+        if(!single) {
+            log << "Error the piped input of " << sample.output << " can only be read once, it needs --single-pass or --frag-sizes\n";
+            return 1;
+        }
+        // The groups of the provisional estimate can't be read again
+        replay = true;
+        budget = std::numeric_limits<size_t>::max();
+    }
+    std::unique_ptr<PairedReader> reader(new PairedReader(sample.refs1, sample.juncs1, sample.refs2, sample.juncs2, 5000, vm.count("input-order") > 0));
+    apply_shard(vm, sample, *reader);
+
+    {
+        rf.open(reader->tx1_header(), reader->ref1_header(), shared.rf);
+        //FragmentSize fragment_size(pjuncs, estimate_dist, size_dist, stranded, gene_intervals, 
+        //        vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), shared.fb_dist, vm["score-bonus"].as<int>());
+
+
+
+        //("score-GTAG", po::value<int>()->default_value(-3), "Score penalty for GT-AG splice junctions")
+        //("score-canonical", po::value<int>()->default_value(-6), "Score penalty for canonical junctions (see canonical-motifs option)")
+        //("score-non-canonical", po::value<int>()->default_value(-12))
+        if(vm.count("frag-sizes") == 0){
+            int    min_obs = single ? static_cast<int>(vm["provisional-obs"].as<unsigned int>()) : vm["obs"].as<int>();
+            size_t obs     = estimate_sizes(vm, shared, *reader, rf, pjuncs, size_dist, min_obs, nthreads, progress, prefix, budget, replay, log);
+            if(obs < (single ? 1 : vm["min-obs"].as<unsigned int>())){
+                log << "Error only observed " << obs << " observations for " << sample.output << "\n";
                 return 1;
             }
-            size_dist.normalize();
-            {
-                string fname = vm["output"].as<string>() + "-dist.txt";
+            size_dist.normalize(log);
+            if(!single){
+                string fname = sample.output + "-dist.txt";
                 ofstream out(fname.c_str());
                 size_dist.save_normed(out);
             }
-            cout << "Used: " << size_dist.count() << " observations to calculate the fragment size distribution\n\n";
+            log << "Used: " << size_dist.count() << " observations to calculate the " << (single ? "provisional " : "") << "fragment size distribution\n\n";
         }else{
             string fdist = vm["frag-sizes"].as<string>();
             ifstream in(fdist.c_str());
-            size_dist.load(in);
+            size_dist.load(in, log);
             in.close();
-            cout << "Loaded: " << size_dist.count() << " observations to calculate the fragment size distribution\n\n";
+            log << "Loaded: " << size_dist.count() << " observations to calculate the fragment size distribution\n\n";
         }
-        cout << "\n\n";
+        log << "\n\n";
     }
 
     {
         const size_t STEP = 10000;
-        PairedReader reader(vm["refs1"].as<string>(), vm["juncs1"].as<string>(), 
-                            vm["refs2"].as<string>(), vm["juncs2"].as<string>(), STEP);
+        // The estimation reader is positioned after the replayed groups, it's
+        // only reopened if the estimation consumed groups that weren't kept
+        if(vm.count("frag-sizes") == 0 && !replay){
+            reader.reset(new PairedReader(sample.refs1, sample.juncs1, sample.refs2, sample.juncs2, STEP, vm.count("input-order") > 0));
+            apply_shard(vm, sample, *reader);
+        }else{
+            reader->set_input_size(STEP);
+        }
+        if(replay) log << "Replaying " << prefix.size() << " read groups (" << (prefix.bytes() >> 20) << " MB) from the estimation\n";
 
-        size_t N = max(vm["threads"].as<unsigned int>() - 1, 1U);
-        PairOutput output_worker(vm["output"].as<string>() + ".bam", reader.ref1_header(), N);
-        std::vector<PairResolver*> threads(N);
+        size_t N = max(nthreads - 1, 1U);
+        PairOutput::Mode mode = vm.count("sorted") ? PairOutput::SORTED : (vm.count("parallel-output") ? PairOutput::PARTS : PairOutput::ORDERED);
+        // The groups a single pass resolves again are written after the others
+        PairOutput output_worker(sample.output + ".bam", reader->ref1_header(), N, mode, static_cast<size_t>(vm["sort-mem"].as<unsigned int>()) << 20, !single);
+        std::vector< std::unique_ptr<PairResolver> > threads(N);
         for(size_t i = 0; i < threads.size(); i++){
-            threads[i] = new PairResolver;
+            threads[i].reset(new PairResolver);
             threads[i]->set_debug(debug);
             threads[i]->set_params(vm["min-score"].as<double>(), vm["min-length"].as<unsigned int>());
             threads[i]->score_filter.set_scores(vm["match"].as<int>(), vm["mismatch"].as<int>(),
@@ -328,33 +595,60 @@ int rnasequel::merge_alignments(int argc, char *argv[]) {
                                        vm["score-GTAG"].as<int>(), vm["score-canonical"].as<int>(), 
                                        vm["score-non-canonical"].as<int>());
             threads[i]->score_filter.set_intron_penalties(vm["big-intron-size"].as<unsigned int>(), vm["big-intron-penalty"].as<int>());
-            threads[i]->score_filter.set_seqs(fi, reader.ref1_header());
+            threads[i]->score_filter.set_seqs(shared.fi, reader->ref1_header());
             threads[i]->score_filter.set_filtering_params(vm["min-score"].as<double>(), vm["score-diff"].as<unsigned int>() * 2, vm["max-edit-dist"].as<int>());
-            threads[i]->trimmer = &strimmer;
-            threads[i]->pair_factory.set_stranded(stranded);
+            threads[i]->trimmer = &shared.strimmer;
+            threads[i]->pair_factory.set_stranded(shared.stranded);
             threads[i]->rf = &rf;
             threads[i]->score_diff = vm["score-diff"].as<unsigned int>();
             threads[i]->max_repeat = vm["max-repeat"].as<unsigned int>();
             threads[i]->max_dist   = vm["max-discordant-dist"].as<int>();
             //threads[i]->dist.init(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
-            threads[i]->fsize.init(pjuncs, estimate_dist, size_dist, stranded, gene_intervals, 
-                                    vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), fb_dist, vm["score-bonus"].as<int>());
+            threads[i]->fsize.init(pjuncs, shared.estimate_dist, size_dist, shared.stranded, shared.gene_intervals, 
+                                    vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), shared.fb_dist, vm["score-bonus"].as<int>());
         }
         if(debug) threads[0]->set_debug(true);
+
+        // Single pass: the resolvers estimate the final distribution and set aside the groups
+        // that depend on it, these are spilled to a temporary file in chunks
+        const size_t SPILL = 64 << 20;
+        std::vector<GroupStore> dstores(single ? threads.size() : 0);
+        GroupStore  deferred;
+        BinaryWrite spill_out;
+        string      spill_file = sample.output + "-deferred.tmp";
+        size_t      spill_chunks = 0, spill_groups = 0;
+        int         max_obs = vm["obs"].as<int>();
+        if(single){
+            if(!spill_out.open(spill_file)){
+                log << "Error opening the temporary file " << spill_file << " for writing\n";
+                return 1;
+            }
+            for(size_t i = 0; i < threads.size(); i++){
+                threads[i]->defer       = &dstores[i];
+                threads[i]->estimate    = true;
+                threads[i]->score_bonus = vm["score-bonus"].as<int>();
+                threads[i]->dist.init(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
+                threads[i]->efsize.init(pjuncs, shared.estimate_dist, threads[i]->dist, shared.stranded, shared.gene_intervals, 
+                                        vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), shared.fb_dist, vm["score-bonus"].as<int>());
+            }
+        }
+
         size_t total = 0;
-        Timer ti("Total Time Merging Pairs");
-        while(reader.load_input() > 0){
+        Timer ti("Total Time Merging Pairs", log);
+        // Resolves count groups, from the store starting at offset or from the reader's input
+        auto resolve = [&](size_t count, const GroupStore * store, size_t offset) {
             size_t start   = 0;
-            size_t num_per = reader.count() / threads.size();
-            size_t extra   = reader.count() - num_per * threads.size();
+            size_t num_per = count / threads.size();
+            size_t extra   = count - num_per * threads.size();
             for(size_t i = 0; i < threads.size(); i++){
                 size_t end = start + num_per;
                 if(extra > 0){
                     end++;
                     extra--;
                 }
-                //cout << "i: " << i << " Start: " << start << " end: " << end << " sz = " << reader.count() << "\n";
-                threads[i]->init(reader.input.begin() + start, reader.input.begin() + end);
+                //log << "i: " << i << " Start: " << start << " end: " << end << " sz = " << reader.count() << "\n";
+                if(store != NULL) threads[i]->init(*store, offset + start, offset + end);
+                else              threads[i]->init(reader->input.begin() + start, reader->input.begin() + end);
                 start = end;
             }
 
@@ -364,13 +658,15 @@ int rnasequel::merge_alignments(int argc, char *argv[]) {
             threads[0]->operator()();
             size_t unique = threads[0]->counts.unique_pair;
             size_t totalp = threads[0]->counts.total;
-            //cout << "0: " << threads[0]->num_passed << " " << threads[0]->num_used << "\n";
+            size_t obs    = threads[0]->num_passed;
+            //log << "0: " << threads[0]->num_passed << " " << threads[0]->num_used << "\n";
 
             for(size_t i = 1; i < threads.size(); i++){
                 threads[i]->join();
                 unique += threads[i]->counts.unique_pair;
                 totalp += threads[i]->counts.total;
-                //cout << i << ": " << threads[i]->num_passed << " " << threads[i]->num_used << "\n";
+                obs    += threads[i]->num_passed;
+                //log << i << ": " << threads[i]->num_passed << " " << threads[i]->num_used << "\n";
             }
 
             // Make sure we are done writing this round of output
@@ -379,29 +675,107 @@ int rnasequel::merge_alignments(int argc, char *argv[]) {
                 output_worker.pools[i].clear();
                 output_worker.pools[i].swap(threads[i]->output);
             }
-
             output_worker.start();
-            total = reader.total();
-            if(total % 1000000 == 0){
+
+            if(!dstores.empty()){
+                for(size_t i = 0; i < threads.size(); i++){
+                    deferred.append(dstores[i]);
+                    dstores[i].clear();
+                }
+                if(deferred.bytes() > SPILL){
+                    deferred.save(spill_out);
+                    spill_chunks++;
+                    spill_groups += deferred.size();
+                    deferred.clear();
+                }
+                if(max_obs > 0 && obs >= static_cast<size_t>(max_obs)){
+                    for(size_t i = 0; i < threads.size(); i++) threads[i]->estimate = false;
+                }
+            }
+
+            total += count;
+            if(progress && total % 1000000 == 0){
                 time_t e = ti.elapsed();
                 if(e > 0){
-                    cout  << "\33[2K\r Unique = " << unique << " [" << std::fixed << std::setprecision(2) << (100.0 * unique / totalp) << "] Total Test = " << totalp 
+                    log  << "\33[2K\r Unique = " << unique << " [" << std::fixed << std::setprecision(2) << (100.0 * unique / totalp) << "] Total Test = " << totalp 
                           << " Total processed: " << total << " " << (total / e) << " pair groups / second";
-                    cout.flush();
+                    log.flush();
                 }
             }
+        };
+
+        for(size_t r = 0; r < prefix.size(); r += STEP){
+            resolve(std::min(STEP, prefix.size() - r), &prefix, r);
+        }
+        prefix.release();
+        while(reader->load_input() > 0){
+            resolve(reader->count(), NULL, 0);
+        }
+
+        SizeDist final_dist(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
+        std::unique_ptr<PairJunctions> final_juncs;
+        if(single){
+            if(!deferred.empty()){
+                deferred.save(spill_out);
+                spill_chunks++;
+                spill_groups += deferred.size();
+            }
+            deferred.release();
+            dstores.clear();
+            spill_out.close();
+
+            size_t obs = 0;
+            for(size_t i = 0; i < threads.size(); i++){
+                obs += threads[i]->num_passed;
+                final_dist += threads[i]->dist;
+            }
+            log << "\n\n";
+            if(obs < vm["min-obs"].as<unsigned int>()){
+                log << "Error only observed " << obs << " observations for " << sample.output << "\n";
+                output_worker.discard();
+                std::remove(spill_file.c_str());
+                return 1;
+            }
+            final_dist.normalize(log);
+            {
+                string fname = sample.output + "-dist.txt";
+                ofstream out(fname.c_str());
+                final_dist.save_normed(out);
+            }
+            log << "Used: " << final_dist.count() << " observations to calculate the fragment size distribution\n";
+            log << "Resolving " << spill_groups << " read groups again with the final distribution\n";
+
+            final_juncs.reset(new PairJunctions(shared.pjuncs, final_dist));
+            for(size_t i = 0; i < threads.size(); i++){
+                threads[i]->defer    = NULL;
+                threads[i]->estimate = false;
+                threads[i]->fsize.init(*final_juncs, shared.estimate_dist, final_dist, shared.stranded, shared.gene_intervals, 
+                                       vm["max-gene-dist"].as<int>(), vm["max-dist"].as<int>(), shared.fb_dist, vm["score-bonus"].as<int>());
+            }
+
+            BinaryRead spill_in(spill_file);
+            GroupStore chunk;
+            for(size_t c = 0; c < spill_chunks; c++){
+                chunk.load(spill_in);
+                for(size_t r = 0; r < chunk.size(); r += STEP){
+                    resolve(std::min(STEP, chunk.size() - r), &chunk, r);
+                }
+            }
+            spill_in.close();
+            std::remove(spill_file.c_str());
         }
         // Write out remaining reads
         output_worker.start();
         output_worker.join();
-        output_worker.close();
+        output_worker.close(log);
         PairResolver::OutputCounts counts;
         for(size_t i = 0; i < threads.size(); i++){
             counts += threads[i]->counts;
-            delete threads[i];
         }
-        std::cout << "\n\n";
-        Report<unsigned int> rep(cout);
+        log << "\n\n";
+        ofstream rout;
+        if(batch) rout.open((sample.output + "-report.txt").c_str());
+        Report<unsigned int> rep(batch ? rout : log);
         rep
             ("Unique Pairs", counts.unique_pair)
             ("Repeat Pairs", counts.repeat_pair)
@@ -420,3 +794,235 @@ int rnasequel::merge_alignments(int argc, char *argv[]) {
 
     return 0;
 }
+
+/**
+ * Output of a batch sample merged next to others, every line is prefixed
+ * with the sample and written to stdout whole under a lock the samples share
+ */
+class SampleLog : public std::ostream {
+    public:
+        SampleLog(const std::string & sample, boost::mutex & mutex) : std::ostream(NULL), buf_(sample, mutex) {
+            rdbuf(&buf_);
+        }
+
+    private:
+        class LineBuf : public std::streambuf {
+            public:
+                LineBuf(const std::string & sample, boost::mutex & mutex) : prefix_("[" + sample + "] "), mutex_(mutex) { }
+
+                ~LineBuf() {
+                    if(!line_.empty()) overflow('\n');
+                }
+
+            protected:
+                int overflow(int c) {
+                    if(c == traits_type::eof()) return traits_type::not_eof(c);
+                    if(c != '\n'){
+                        line_ += static_cast<char>(c);
+                    }else if(!line_.empty()){
+                        boost::mutex::scoped_lock lock(mutex_);
+                        std::cout << prefix_ << line_ << "\n";
+                        std::cout.flush();
+                        line_.clear();
+                    }
+                    return c;
+                }
+
+                std::streamsize xsputn(const char * s, std::streamsize n) {
+                    for(std::streamsize i = 0; i < n; i++) overflow(static_cast<unsigned char>(s[i]));
+                    return n;
+                }
+
+            private:
+                std::string     prefix_;
+                boost::mutex  & mutex_;
+                std::string     line_;
+        };
+
+        LineBuf buf_;
+};
+
+// A failed sample is reported and its partial output removed, it doesn't stop the other samples
+int merge_sample(const po::variables_map & vm, MergeShared & shared, const MergeSample & sample, unsigned int nthreads, bool batch, bool progress, std::ostream & log) {
+    FailScope scope;
+    try {
+        return merge_sample_(vm, shared, sample, nthreads, batch, progress, log);
+    } catch(const Failure & e) {
+        log << "Error " << e.what() << "\n";
+        std::remove((sample.output + "-deferred.tmp").c_str());
+        return 1;
+    }
+}
+
+/**
+ * Merges batch samples one after another, several workers can run side
+ * by side each with its share of the threads
+ */
+class SampleWorker {
+    public:
+        SampleWorker(const po::variables_map & vm, MergeShared & shared, const std::vector<MergeSample> & samples, 
+                     size_t & next, boost::mutex & mutex, boost::mutex & out_mutex, unsigned int threads, bool progress) 
+            : failed(0), vm_(vm), shared_(shared), samples_(samples), next_(next), mutex_(mutex), out_mutex_(out_mutex), threads_(threads), 
+              progress_(progress), running_(false)
+        {
+
+        }
+
+        void operator()() {
+            while(true){
+                size_t i;
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    i = next_++;
+                }
+                if(i >= samples_.size()) break;
+                // A single worker has stdout to itself and keeps the progress lines
+                std::unique_ptr<SampleLog> log(progress_ ? NULL : new SampleLog(samples_[i].output, out_mutex_));
+                std::ostream & out = log ? *log : cout;
+                out << "Merging sample " << (i + 1) << " of " << samples_.size() << ": " << samples_[i].output << "\n";
+                if(merge_sample(vm_, shared_, samples_[i], threads_, true, progress_, out) != 0) failed++;
+            }
+        }
+
+        void start() {
+            running_ = true;
+            thread_  = boost::thread(boost::ref(*this));
+        }
+
+        void join() {
+            if(running_) {
+                thread_.join();
+                running_ = false;
+            }
+        }
+
+        size_t failed;
+
+    private:
+        const po::variables_map          & vm_;
+        MergeShared                      & shared_;
+        const std::vector<MergeSample>   & samples_;
+        size_t                           & next_;
+        boost::mutex                     & mutex_;
+        // Serializes the output of the samples
+        boost::mutex                     & out_mutex_;
+        unsigned int                       threads_;
+        bool                               progress_;
+        boost::thread                      thread_;
+        bool                               running_;
+};
+
+int rnasequel::merge_alignments(int argc, char *argv[]) {
+    po::variables_map vm;
+    merge_init_options(argc,argv,vm);
+
+    std::vector<MergeSample> samples;
+    if(vm.count("batch") > 0){
+        read_manifest(vm["batch"].as<string>(), samples);
+    }else{
+        MergeSample s;
+        s.output = vm["output"].as<string>();
+        s.refs1  = vm["refs1"].as<string>();
+        s.juncs1 = vm["juncs1"].as<string>();
+        if(vm.count("refs2") > 0) {
+            s.refs2  = vm["refs2"].as<string>();
+            s.juncs2 = vm["juncs2"].as<string>();
+        }
+        samples.push_back(s);
+    }
+
+    MergeShared shared(vm);
+
+    unsigned int nthreads = vm["threads"].as<unsigned int>();
+    size_t nworkers = vm.count("batch") == 0 ? 1 : std::min<size_t>(vm["samples"].as<unsigned int>(), samples.size());
+    unsigned int per = std::max(nthreads / static_cast<unsigned int>(nworkers), 1U);
+    // A sample reads two files at once, parsing sam takes up to half of its threads
+    SamReader::set_parsers(per / 4);
+    if(vm.count("batch") == 0){
+        return merge_sample(vm, shared, samples.front(), nthreads, false, true, cout);
+    }
+
+    size_t next = 0;
+    boost::mutex mutex, out_mutex;
+    std::vector<SampleWorker*> workers(nworkers);
+    for(size_t i = 0; i < workers.size(); i++){
+        workers[i] = new SampleWorker(vm, shared, samples, next, mutex, out_mutex, per, nworkers == 1);
+    }
+    for(size_t i = 1; i < workers.size(); i++){
+        workers[i]->start();
+    }
+    workers[0]->operator()();
+    size_t failed = workers[0]->failed;
+    for(size_t i = 1; i < workers.size(); i++){
+        workers[i]->join();
+        failed += workers[i]->failed;
+    }
+    for(size_t i = 0; i < workers.size(); i++){
+        delete workers[i];
+    }
+    if(failed > 0){
+        cout << "Error " << failed << " of " << samples.size() << " samples failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+int rnasequel::fragment_sizes(int argc, char *argv[]) {
+    po::variables_map vm;
+    merge_init_options(argc, argv, vm, true);
+
+    SizeDist size_dist(vm["confidence"].as<double>(), vm["max-fragment"].as<unsigned int>());
+    if(vm.count("combine") > 0){
+        const vector<string> & files = vm["combine"].as< vector<string> >();
+        for(size_t i = 0; i < files.size(); i++){
+            ifstream in(files[i].c_str());
+            if(!in){
+                cout << "Error opening the fragment size distribution " << files[i] << " for reading\n";
+                return 1;
+            }
+            SizeDist part(vm["confidence"].as<double>(), 0);
+            part.load(in);
+            size_t before = size_dist.count();
+            size_dist += part;
+            if(size_dist.count() - before < part.count()){
+                cout << "  " << (part.count() - (size_dist.count() - before)) << " observations of " << files[i] 
+                     << " are larger than the maximum fragment size (--max-fragment) and aren't used\n";
+            }
+        }
+        cout << "Combined " << files.size() << " distributions with " << size_dist.count() << " observations\n";
+    }else{
+        MergeShared shared(vm);
+        MergeSample sample;
+        sample.refs1  = vm["refs1"].as<string>();
+        sample.juncs1 = vm["juncs1"].as<string>();
+        if(vm.count("refs2") > 0) {
+            sample.refs2  = vm["refs2"].as<string>();
+            sample.juncs2 = vm["juncs2"].as<string>();
+        }
+        bool stream;
+        if(!check_streams(vm, sample, stream)) return 1;
+        PairedReader reader(sample.refs1, sample.juncs1, sample.refs2, sample.juncs2, 5000, vm.count("input-order") > 0);
+        apply_shard(vm, sample, reader);
+        ResolveFragments rf;
+        rf.open(reader.tx1_header(), reader.ref1_header(), shared.rf);
+        PairJunctions pjuncs(shared.pjuncs, size_dist);
+        GroupStore prefix;
+        bool replay = false;
+        size_t obs = estimate_sizes(vm, shared, reader, rf, pjuncs, size_dist, vm["obs"].as<int>(), vm["threads"].as<unsigned int>(), true, prefix, 0, replay, cout);
+        if(obs < vm["min-obs"].as<unsigned int>()){
+            cout << "Error only observed " << obs << " observations\n";
+            return 1;
+        }
+    }
+
+    size_dist.normalize();
+    string fname = vm["output"].as<string>() + "-dist.txt";
+    ofstream out(fname.c_str());
+    if(!out){
+        cout << "Error opening the fragment size distribution " << fname << " for writing\n";
+        return 1;
+    }
+    size_dist.save_normed(out);
+    cout << "Used: " << size_dist.count() << " observations to calculate the fragment size distribution\n";
+    return 0;
+}
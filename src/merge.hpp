@@ -23,6 +23,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 namespace rnasequel {
 
 int merge_alignments(int argc, char * argv[]);
+int fragment_sizes(int argc, char * argv[]);
 
 };
 
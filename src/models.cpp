@@ -44,3 +44,88 @@ bool Transcript::has_junction(PosBlock p) const {
     }
     return found;
 }
+
+uint32_t CompactModel::intern_(const std::string & s, std::map<std::string, uint32_t> & ids) {
+    std::pair<std::map<std::string, uint32_t>::iterator, bool> res = ids.insert(std::make_pair(s, ooffsets_.size()));
+    if(res.second) {
+        ooffsets_.push_back(ostrings_.size());
+        ostrings_.insert(ostrings_.end(), s.begin(), s.end());
+        ostrings_.push_back('\0');
+    }
+    return res.first->second;
+}
+
+void CompactModel::build(const Model & m) {
+    std::map<std::string, uint32_t> ids;
+    size_t ngenes = 0, ntxs = 0, nexons = 0;
+    for(Model::const_iterator it = m.begin(); it != m.end(); ++it) {
+        ngenes += it->second.size();
+        for(size_t i = 0; i < it->second.size(); i++) {
+            ntxs += it->second[i].transcripts().size();
+            for(Gene::const_iterator tx = it->second[i].begin(); tx != it->second[i].end(); ++tx) {
+                nexons += tx->exons().size();
+            }
+        }
+    }
+
+    ochroms_.reserve(m.size());
+    ogenes_.reserve(ngenes);
+    otxs_.reserve(ntxs);
+    oexons_.reserve(nexons);
+
+    for(Model::const_iterator it = m.begin(); it != m.end(); ++it) {
+        ochroms_.push_back(ChromRec());
+        ChromRec & c  = ochroms_.back();
+        c.name       = intern_(it->first, ids);
+        c.gene_start = ogenes_.size();
+        c.gene_size  = it->second.size();
+        for(size_t i = 0; i < it->second.size(); i++) {
+            const Gene & g = it->second[i];
+            ogenes_.push_back(GeneRec());
+            GeneRec & cg = ogenes_.back();
+            static_cast<PosBlock &>(cg) = g;
+            cg.id       = intern_(g.id(), ids);
+            cg.name     = intern_(g.name(), ids);
+            cg.tx_start = otxs_.size();
+            cg.tx_size  = g.transcripts().size();
+            for(Gene::const_iterator tx = g.begin(); tx != g.end(); ++tx) {
+                otxs_.push_back(TranscriptRec());
+                TranscriptRec & ct = otxs_.back();
+                static_cast<PosBlock &>(ct) = *tx;
+                ct.id         = intern_(tx->id(), ids);
+                ct.gene       = ogenes_.size() - 1;
+                ct.exon_start = oexons_.size();
+                ct.exon_size  = tx->exons().size();
+                oexons_.insert(oexons_.end(), tx->exons().begin(), tx->exons().end());
+            }
+        }
+    }
+    sync_();
+}
+
+void CompactModel::sync_() {
+    chroms_  = ConstArray<ChromRec>(ochroms_);
+    genes_   = ConstArray<GeneRec>(ogenes_);
+    txs_     = ConstArray<TranscriptRec>(otxs_);
+    exons_   = ConstArray<PosBlock>(oexons_);
+    strings_ = ConstArray<char>(ostrings_);
+    offsets_ = ConstArray<uint32_t>(ooffsets_);
+}
+
+void CompactModel::save(ContextImage::Writer & w) const {
+    w.add(ContextImage::MODEL_CHROMS, chroms_.data(), chroms_.size());
+    w.add(ContextImage::MODEL_GENES, genes_.data(), genes_.size());
+    w.add(ContextImage::MODEL_TRANSCRIPTS, txs_.data(), txs_.size());
+    w.add(ContextImage::MODEL_EXONS, exons_.data(), exons_.size());
+    w.add(ContextImage::MODEL_STRINGS, strings_.data(), strings_.size());
+    w.add(ContextImage::MODEL_OFFSETS, offsets_.data(), offsets_.size());
+}
+
+void CompactModel::load(const ContextImage & img) {
+    chroms_  = img.section<ChromRec>(ContextImage::MODEL_CHROMS);
+    genes_   = img.section<GeneRec>(ContextImage::MODEL_GENES);
+    txs_     = img.section<TranscriptRec>(ContextImage::MODEL_TRANSCRIPTS);
+    exons_   = img.section<PosBlock>(ContextImage::MODEL_EXONS);
+    strings_ = img.section<char>(ContextImage::MODEL_STRINGS);
+    offsets_ = img.section<uint32_t>(ContextImage::MODEL_OFFSETS);
+}
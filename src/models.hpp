@@ -30,6 +30,8 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include "types.hpp"
 #include "seed.hpp"
+#include "const_array.hpp"
+#include "context_image.hpp"
 
 namespace rnasequel {
 
@@ -138,6 +140,10 @@ class Transcript : public PosBlock {
 	    return _exons;
 	}
 
+	Exons & exons() {
+	    return _exons;
+	}
+
         const std::string & source() const {
             return _src;
         }
@@ -359,5 +365,121 @@ inline void Model::sort_genes() {
     }
 }
 
+/**
+  * Compact read only copy of a Model for the long running tools
+  *
+  * Ids and names are interned in a single string table, the transcripts of
+  * a gene are a range of one transcript array and the exons of a transcript
+  * a range of one exon array so the annotation is a few flat vectors with
+  * 32-bit ids. The Model can be dropped once this is built. The arrays can
+  * also be mapped from a merge context image.
+  */
+class CompactModel {
+    public:
+        struct GeneRec : public PosBlock {
+            GeneRec() : id(0), name(0), tx_start(0), tx_size(0) { }
+
+            uint32_t id;
+            uint32_t name;
+            uint32_t tx_start;
+            uint32_t tx_size;
+        };
+
+        struct TranscriptRec : public PosBlock {
+            TranscriptRec() : id(0), gene(0), exon_start(0), exon_size(0) { }
+
+            uint32_t id;
+            uint32_t gene;
+            uint32_t exon_start;
+            uint32_t exon_size;
+        };
+
+        struct ChromRec {
+            ChromRec() : name(0), gene_start(0), gene_size(0) { }
+
+            uint32_t name;
+            uint32_t gene_start;
+            uint32_t gene_size;
+        };
+
+        CompactModel() { }
+
+        CompactModel(const Model & m) {
+            build(m);
+        }
+
+        void build(const Model & m);
+
+        // Stores the model in a merge context image or maps it from one
+        void save(ContextImage::Writer & w) const;
+        void load(const ContextImage & img);
+
+        size_t chroms_size() const {
+            return chroms_.size();
+        }
+
+        const ChromRec & chrom(size_t i) const {
+            return chroms_[i];
+        }
+
+        const char * chrom_name(size_t i) const {
+            return str(chroms_[i].name);
+        }
+
+        // Genes of a chromosome in the Model's (sorted) order
+        const GeneRec * genes_begin(const ChromRec & c) const {
+            return genes_.begin() + c.gene_start;
+        }
+
+        const GeneRec * genes_end(const ChromRec & c) const {
+            return genes_begin(c) + c.gene_size;
+        }
+
+        const GeneRec & gene(uint32_t i) const {
+            return genes_[i];
+        }
+
+        size_t genes_size() const {
+            return genes_.size();
+        }
+
+        const TranscriptRec & transcript(const GeneRec & g, size_t i) const {
+            assert(i < g.tx_size);
+            return txs_[g.tx_start + i];
+        }
+
+        const PosBlock * exons(const TranscriptRec & tx) const {
+            return exons_.begin() + tx.exon_start;
+        }
+
+        const char * str(uint32_t id) const {
+            return &strings_[offsets_[id]];
+        }
+
+    private:
+        CompactModel(const CompactModel & m);
+        CompactModel & operator=(const CompactModel & m);
+
+        uint32_t intern_(const std::string & s, std::map<std::string, uint32_t> & ids);
+        void     sync_();
+
+        // Owned storage when built from a Model
+        std::vector<ChromRec>         ochroms_;
+        std::vector<GeneRec>          ogenes_;
+        std::vector<TranscriptRec>    otxs_;
+        std::vector<PosBlock>         oexons_;
+        std::vector<char>             ostrings_;
+        std::vector<uint32_t>         ooffsets_;
+
+        ConstArray<ChromRec>          chroms_;
+        ConstArray<GeneRec>           genes_;
+        ConstArray<TranscriptRec>     txs_;
+        ConstArray<PosBlock>          exons_;
+
+        // '\0' separated strings and the offset of each string id
+        ConstArray<char>              strings_;
+        ConstArray<uint32_t>          offsets_;
+};
+
 }; // namespace gw
 #endif
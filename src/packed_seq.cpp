@@ -66,6 +66,49 @@ void PackedSequence::write(std::ostream & out, size_t start , size_t end) const
     }
 }
 
+/*
+  Two ASCII bases for every packed byte, the table is built on first use
+  so it doesn't depend on the static initialization order of nt16_to_base
+*/
+static const char * nt16_pair_table() {
+    static char table[512];
+    static bool init = false;
+    if(!init) {
+        for(size_t i = 0; i < 256; i++) {
+            table[i * 2]     = nt16_to_base[i >> 4];
+            table[i * 2 + 1] = nt16_to_base[i & 0xF];
+        }
+        init = true;
+    }
+    return table;
+}
+
+void PackedSequence::decode(char * out, size_t start, size_t n) const {
+    assert(start + n <= _length);
+    static const char * table = nt16_pair_table();
+    size_t p   = start;
+    size_t end = start + n;
+
+    // Unaligned bases until p is at a byte boundary
+    if((p & 1) && p < end) {
+        *out++ = nt16_to_base[at_raw(p++)];
+    }
+
+    // Whole words, 8 bytes to 16 bases through the pair table
+    while(p + 16 <= end) {
+        uint64_t w = word_at_(p);
+        for(int k = 56; k >= 0; k -= 8) {
+            memcpy(out, table + ((w >> k) & 0xFFUL) * 2, 2);
+            out += 2;
+        }
+        p += 16;
+    }
+
+    while(p < end) {
+        *out++ = nt16_to_base[at_raw(p++)];
+    }
+}
+
 PackedSequence::PackedSequence(const std::string & s) {
     assign(s);
 }
@@ -98,7 +141,7 @@ PackedSequence & PackedSequence::operator=(const char * s) {
     return *this;
 }
 
-void PackedSequence::copy_from(uint8_t * b, size_t l) {
+void PackedSequence::copy_from(const uint8_t * b, size_t l) {
     /**
      * TODO: Deal with big endian systems
      */
@@ -127,7 +170,7 @@ void PackedSequence::copy_from(uint8_t * b, size_t l) {
 }
 
 
-void PackedSequence::copy_to(uint8_t * b) {
+void PackedSequence::copy_to(uint8_t * b) const {
     /**
      * TODO: Deal with big endian systems
      */
@@ -163,6 +206,34 @@ PackedSequence &  PackedSequence::append(const PackedSequence & s) {
     return *this;
 }
 
+PackedSequence & PackedSequence::append(const PackedSequence & s, size_t start, size_t n) {
+    assert(start + n <= s._length);
+    size_t d   = _length;
+    size_t end = start + n;
+    _seq.resize((_length + n + 15) >> 4, 0);
+    _length += n;
+
+    // Bases until the destination is word aligned
+    while((d & 0xFUL) && start < end) {
+        uint64_t x = (~d & 0xFUL) << 2;
+        _seq[d >> 4] = (_seq[d >> 4] & ~(0xFUL << x)) | (static_cast<uint64_t>(s.at_raw(start)) << x);
+        d++;
+        start++;
+    }
+
+    while(start + 16 <= end) {
+        _seq[d >> 4] = s.word_at_(start);
+        d     += 16;
+        start += 16;
+    }
+
+    // Keep the unused bases of the last word cleared
+    if(start < end) {
+        _seq[d >> 4] = s.word_at_(start) & (~0UL << ((16 - (end - start)) << 2));
+    }
+    return *this;
+}
+
 PackedSequence & PackedSequence::append(const char * s) {
     while(*s++){
 	append(*s);
@@ -70,13 +70,13 @@ class PackedSequence {
         /*
          * Copy from an already packed buffer (useful for my bam library)
          */
-        void copy_from(uint8_t * b, size_t l);
+        void copy_from(const uint8_t * b, size_t l);
 
         /*
          * Copy the packed buffer (useful for my bam library)
          * the buffer must be long enough to hold all of the characters
         */
-        void copy_to(uint8_t *b);
+        void copy_to(uint8_t *b) const;
 
         bool operator<(const PackedSequence & s) const {
             for(size_t i = 0; i < std::min(length(), s.length()); i++){
@@ -151,6 +151,9 @@ class PackedSequence {
         void binary_read(BinaryRead & fin, size_t l);
         void write(std::ostream & out, size_t start = 0, size_t end = 0) const;
 
+        // Writes the bases [start, start + n) to out as ASCII, out must hold n characters
+        void decode(char * out, size_t start, size_t n) const;
+
         PackedSequence & append(char c) {
             if(!(_length & 0xF)) {
                 //std::cout << (char)c << " --> " << debug_binary((uint64_t)base_to_nt16[(size_t)c]) << "\n";
@@ -176,6 +179,8 @@ class PackedSequence {
 
         PackedSequence & append(const std::string & s);
         PackedSequence & append(const PackedSequence & s);
+        // Appends s[start, start + n) a packed word at a time
+        PackedSequence & append(const PackedSequence & s, size_t start, size_t n);
     	PackedSequence & append(const char * s);
     	PackedSequence & append(const char * s, size_t n);
 
@@ -263,6 +268,16 @@ class PackedSequence {
 	}
 
     protected:
+        // The 16 bases starting at p packed into a word, bases past the end are undefined
+        uint64_t word_at_(size_t p) const {
+            size_t   w = p >> 4;
+            uint64_t o = (p & 0xFUL) << 2;
+            if(o == 0) return _seq[w];
+            uint64_t v = _seq[w] << o;
+            if(w + 1 < _seq.size()) v |= _seq[w + 1] >> (64 - o);
+            return v;
+        }
+
         std::vector<uint64_t>    _seq;
         size_t                   _length;
 };
@@ -101,9 +101,66 @@ bool remove_overlaps(vector<BamRead*> & reads){
 
     return rem;
 }
+void GroupStore::add(const vector<BamRead*> & merged1, const vector<BamRead*> & merged2) {
+    Group g;
+    g.offset = data_.size();
+    g.n1     = merged1.size();
+    g.n2     = merged2.size();
+    for(auto p : merged1) p->pack(data_);
+    for(auto p : merged2) p->pack(data_);
+    groups_.push_back(g);
+}
+
+void GroupStore::append(const GroupStore & s) {
+    uint64_t shift = data_.size();
+    data_.insert(data_.end(), s.data_.begin(), s.data_.end());
+    for(auto g : s.groups_){
+        g.offset += shift;
+        groups_.push_back(g);
+    }
+}
+
+void GroupStore::save(BinaryWrite & bw) const {
+    bw.write_vector(groups_);
+    bw.write_vector(data_);
+}
+
+void GroupStore::load(BinaryRead & br) {
+    br.read_vector(groups_);
+    br.read_vector(data_);
+}
+
+void GroupStore::get(size_t i, VectorPool<BamRead> & reads1, VectorPool<BamRead> & reads2, 
+                     vector<BamRead*> & merged1, vector<BamRead*> & merged2) const {
+    const Group & g = groups_[i];
+    const uint8_t * p = &data_[0] + g.offset;
+    reads1.clear();
+    reads2.clear();
+    for(uint32_t j = 0; j < g.n1; j++){
+        reads1.push_back();
+        p = reads1.back().unpack(p);
+    }
+    for(uint32_t j = 0; j < g.n2; j++){
+        reads2.push_back();
+        p = reads2.back().unpack(p);
+    }
+    // Pointers are taken once the pools are filled as they may reallocate
+    merged1.clear();
+    merged2.clear();
+    for(auto it = reads1.begin(); it != reads1.end(); it++) merged1.push_back(&*it);
+    for(auto it = reads2.begin(); it != reads2.end(); it++) merged2.push_back(&*it);
+}
+
 void PairBuilder::init(PairedReader::input_pairs::iterator start, PairedReader::input_pairs::iterator end) {
-    start_ = start;
-    end_   = end;
+    start_  = start;
+    end_    = end;
+    replay_ = NULL;
+}
+
+void PairBuilder::init(const GroupStore & store, size_t start, size_t end) {
+    replay_ = &store;
+    rstart_ = start;
+    rend_   = end;
 }
 
 void PairBuilder::merge_reads(ReadGroup & ref, ReadGroup & tx, vector<BamRead*> & merged, int read_num) {
@@ -137,25 +194,39 @@ void PairBuilder::merge_reads(ReadGroup & ref, ReadGroup & tx, vector<BamRead*>
         it->tags.clear();
         it->flag.read1 = read_num == 1;
         it->flag.read2 = read_num == 2;
-        //cout << "  Tx:  " << *it << "\n";
-        if(!it->aligned()) it->filtered() = true;
-        else rf->resolve(*it);
         it->flag.secondary = false;
+        //cout << "  Tx:  " << *it << "\n";
+        if(!it->aligned()) {
+            it->filtered() = true;
+            continue;
+        }
 
-        //if(debug && !it->filtered()) cout << "    spliced: " << *it << "\n";
-        if(!it->filtered() && min_length > 0) rf->trim(*it, min_length, 0);
-        if(!it->filtered()){
-            trimmer->trim(*it);
-            if(it->cigar.has_skip()){
-                merged.push_back(&*it);
-            }else{
-                it->filtered() = true;
-            }
+        // Sequences shared by several block sets are resolved once per set, the copies
+        // are inserted before the current read so they aren't visited again
+        for(size_t s = 1; s < rf->sets(*it); s++){
+            BamRead & c = tx.insert(it, *it);
+            rf->resolve(c, cigar_buffer_, s);
+            add_resolved_(c, merged);
         }
+        rf->resolve(*it, cigar_buffer_);
+        add_resolved_(*it, merged);
     }
     remove_dups_(merged);
 }
 
+void PairBuilder::add_resolved_(BamRead & r, vector<BamRead*> & merged) {
+    //if(debug && !r.filtered()) cout << "    spliced: " << r << "\n";
+    if(!r.filtered() && min_length > 0) rf->trim(r, min_length, 0);
+    if(!r.filtered()){
+        trimmer->trim(r);
+        if(r.cigar.has_skip()){
+            merged.push_back(&r);
+        }else{
+            r.filtered() = true;
+        }
+    }
+}
+
 void PairBuilder::filter_reads(ReadGroup & ref, ReadGroup & tx, vector<BamRead*> & merged, int read_num) {
     // Filter low scoring alignments
     int max_score = 0;
@@ -221,6 +292,16 @@ void PairBuilder::remove_dups_(vector<BamRead *> & merged) {
 void PairBuilder::operator()() {
     size_t i = 0;
     reset();
+    if(replay_ != NULL){
+        for(size_t g = rstart_; g < rend_; g++){
+            replay_->get(g, rreads1_, rreads2_, merged1, merged2);
+            pair_factory.build(merged1, merged2, pairs);
+            if(!merged1.empty() || !merged2.empty()){
+                process_one();
+            }
+        }
+        return;
+    }
     while(start_ != end_){
         PairedReader::InputPair & p = **start_;
         //cout << "  r1 = " << p.ref1.size() << " / " << p.tx2.size() << " r2 = " << p.ref2.size() << " / " << p.tx2.size() << "\n";
@@ -243,6 +324,7 @@ void PairBuilder::operator()() {
             cout << "\n";
         }
         */
+        if(record != NULL && (!merged1.empty() || !merged2.empty())) record->add(merged1, merged2);
         pair_factory.build(merged1, merged2, pairs);
         if(debug_) cout << "  Total pairs generated: " << pairs.size() << "\n";
         /*
@@ -261,7 +343,7 @@ void PairBuilder::operator()() {
     }
 }
 
-size_t PairEstimator::filter_pairs_() {
+size_t PairBuilder::filter_estimate_(vector<ReadPair> & pairs, unsigned int score_diff) {
     int max = 0;
     for(auto & p : pairs){
         if(!p.discordant()){
@@ -475,12 +557,45 @@ void PairResolver::handle_single_(vector<BamRead*> & merged, int read_num){
     }
 }
 
+// Decisions that the final distribution could change: a pair that only failed on its size
+// or several concordant pairs close enough for the size bonus to reorder them
+bool PairResolver::size_sensitive_() const {
+    double best = 0;
+    for(auto & p : pairs){
+        if(!p.discordant() || p.fragment_fail()) best = max(best, 1.0 * (p.r1().score() + p.r2().score()));
+    }
+    double thresh = best - score_diff * 2 - score_bonus;
+    size_t n = 0;
+    for(auto & p : pairs){
+        if((p.discordant() && !p.fragment_fail()) || p.r1().score() + p.r2().score() < thresh) continue;
+        if(p.fragment_fail()) return true;
+        n++;
+    }
+    return n > 1;
+}
+
+// Same as PairEstimator::process_one on a copy so the flags don't reach the resolution
+void PairResolver::estimate_one_() {
+    epairs_ = pairs;
+    if(filter_estimate_(epairs_, score_diff) != 1) return;
+    for(auto & p : epairs_){
+        if(!p.filtered() && efsize.estimate_size(p)) num_passed++;
+    }
+}
+
 void PairResolver::process_one() {
     bool r1_aligned = !merged1.empty() && merged1.front()->aligned();
     bool r2_aligned = !merged2.empty() && merged2.front()->aligned();
-    counts.total++;
     if(pairs.size() > 0){
+        if(estimate) estimate_one_();
         fsize.calculate_sizes(pairs);
+        if(defer != NULL && size_sensitive_()){
+            defer->add(merged1, merged2);
+            return;
+        }
+    }
+    counts.total++;
+    if(pairs.size() > 0){
         handle_pairs_();
     }else if(!r2_aligned and r1_aligned){
         //r1 singleton
@@ -499,7 +614,7 @@ void PairResolver::process_one() {
 }
 
 void PairEstimator::process_one() {
-    size_t count = filter_pairs_();
+    size_t count = filter_estimate_(pairs, score_diff);
     total++;
     if(count == 1){
         for(size_t i = 0; i < pairs.size(); i++){
@@ -29,13 +29,71 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "size_dist.hpp"
 #include "fragment_size.hpp"
 #include "vector_pool.hpp"
+#include "binary_io.hpp"
 
 namespace rnasequel {
 
+/**
+ * Compact copy of read groups after merging and filtering
+ *
+ * Lets the groups consumed while estimating the fragment size distribution
+ * be replayed into the resolver without reading and merging them again.
+ */
+class GroupStore {
+    public:
+        GroupStore() { }
+
+        void add(const std::vector<BamRead*> & merged1, const std::vector<BamRead*> & merged2);
+
+        // Appends the groups of s after the groups of this store
+        void append(const GroupStore & s);
+
+        // Writes the groups as one chunk, a file can hold any number of chunks
+        void save(BinaryWrite & bw) const;
+        // Replaces the groups with the next chunk of a file
+        void load(BinaryRead & br);
+
+        // Restores group i, merged1 and merged2 point into reads1 and reads2
+        void get(size_t i, VectorPool<BamRead> & reads1, VectorPool<BamRead> & reads2, 
+                 std::vector<BamRead*> & merged1, std::vector<BamRead*> & merged2) const;
+
+        void clear() {
+            groups_.clear();
+            data_.clear();
+        }
+
+        // Releases the memory as well
+        void release() {
+            std::vector<Group>().swap(groups_);
+            std::vector<uint8_t>().swap(data_);
+        }
+
+        size_t size() const {
+            return groups_.size();
+        }
+
+        bool empty() const {
+            return groups_.empty();
+        }
+
+        size_t bytes() const {
+            return data_.size() + groups_.size() * sizeof(Group);
+        }
+
+    private:
+        struct Group {
+            uint64_t offset;
+            uint32_t n1;
+            uint32_t n2;
+        };
+
+        std::vector<Group>      groups_;
+        std::vector<uint8_t>    data_;
+};
 
 class PairBuilder{
     public:
-        PairBuilder() : debug_(false), running_(false) {
+        PairBuilder() : record(NULL), debug_(false), replay_(NULL), running_(false) {
 
         }
 
@@ -55,6 +113,8 @@ class PairBuilder{
         void operator()();
 
         void init(PairedReader::input_pairs::iterator start, PairedReader::input_pairs::iterator end);
+        // Processes groups start to end of a store instead of reading input
+        void init(const GroupStore & store, size_t start, size_t end);
 
         void merge_reads(ReadGroup & ref, ReadGroup & tx, std::vector<BamRead*> & merged, int read_num);
         void filter_reads(ReadGroup & ref, ReadGroup & tx, std::vector<BamRead*> & merged, int read_num);
@@ -77,20 +137,32 @@ class PairBuilder{
         const ResolveFragments    * rf;
         const SpliceTrimmer       * trimmer;
         ReadPairFactory             pair_factory;
+        // When set the merged and filtered groups are copied here
+        GroupStore                * record;
         
         double                      min_score;
         unsigned int                min_length;
 
     protected:
+        // Flags everything but the concordant pairs used for the estimation, returns the number kept
+        static size_t filter_estimate_(std::vector<ReadPair> & pairs, unsigned int score_diff);
         void remove_dups_(std::vector<BamRead *> & merged);
+        void add_resolved_(BamRead & r, std::vector<BamRead *> & merged);
         PairedReader::input_pairs::iterator start_;
         PairedReader::input_pairs::iterator end_;
 
         std::vector<BamRead*>       merged1;
         std::vector<BamRead*>       merged2;
         std::vector<ReadPair>       pairs;
+        ResolveFragments::CigarBuffer cigar_buffer_;
         bool                        debug_;
 
+        const GroupStore          * replay_;
+        size_t                      rstart_;
+        size_t                      rend_;
+        VectorPool<BamRead>         rreads1_;
+        VectorPool<BamRead>         rreads2_;
+
     private:
         boost::thread               thread_;
         bool                        running_;
@@ -140,6 +212,10 @@ class PairResolver : public PairBuilder {
             }
         };
 
+        PairResolver() : defer(NULL), estimate(false), num_passed(0), score_bonus(0) {
+
+        }
+
         virtual void reset() {
             output.clear();
             pairs.clear();
@@ -153,10 +229,24 @@ class PairResolver : public PairBuilder {
         unsigned int          max_repeat;
         int                   max_dist;
 
+        // Single pass merging, fsize uses a provisional distribution and the groups
+        // its outcome depends on are stored here to be resolved again at the end
+        GroupStore          * defer;
+        // Adds the fragment size observations to dist while resolving
+        bool                  estimate;
+        SizeDist              dist;
+        FragmentSize          efsize;
+        size_t                num_passed;
+        int                   score_bonus;
+
     private:
+        bool size_sensitive_() const;
+        void estimate_one_();
         void handle_pairs_();
         void handle_single_(std::vector<BamRead*> & merged, int read_num);
         void push_unmapped_(vector<BamRead*> & merged, int read_num, bool max_repeat = false);
+
+        std::vector<ReadPair> epairs_;
 };
 
 class PairEstimator : public PairBuilder {
@@ -176,9 +266,6 @@ class PairEstimator : public PairBuilder {
         size_t         total;
         unsigned int   score_diff;
 
-    private:
-        size_t filter_pairs_();
-
 };
 
 };
@@ -23,13 +23,28 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "read_grouper.hpp"
 #include <boost/thread/thread.hpp>
 #include "timer.hpp"
+#include <iostream>
+#include <deque>
+#include <unordered_set>
 
 namespace rnasequel {
 
+/**
+ * Joins the read groups of a reference and a transcriptome alignment file
+ *
+ * The files are sorted by read name (ReadStringCmp) or with input_order they
+ * are in the order the aligner wrote them. The reference file then has every
+ * read and sets the order, a read missing from the transcriptome file has no
+ * transcriptome alignments. A transcriptome read that is among the last
+ * LOOKAHEAD reference reads passed, or isn't found in the next LOOKAHEAD,
+ * means the files are out of step and it fails.
+ */
 class PairGrouper {
     public:
+        static const size_t LOOKAHEAD = 100000;
+
 	struct pair_group {
-	    pair_group(ReadGroup::list_type & pool) : r1(&pool), r2(&pool), g1(&pool), g2(&pool) {
+	    pair_group(ReadGroup::list_type & pool, bool order = false) : r1(&pool), r2(&pool), g1(&pool), g2(&pool), input_order(order) {
 
 	    }
 
@@ -47,19 +62,36 @@ class PairGrouper {
 	    ReadGroup                g1;
 	    ReadGroup                g2;
 	    ReadStringID::value_type tmp_;
+	    bool                     input_order;
 	};
 
-        PairGrouper(size_t N, const std::string & f1, const std::string & f2)
-	    : N_(N), r1_(f1), r2_(f2) { }
+        PairGrouper(size_t N, const std::string & f1, const std::string & f2, bool input_order = false)
+	    : N_(N), r1_(f1), r2_(f2), input_order_(input_order), unmatched_(0) { }
 
         void reopen(const std::string & f1, const std::string & f2){
             r1_.open(f1);
             r2_.open(f2);
             next_id_ = "";
+            passed_.clear();
+            passed_set_.clear();
+            unmatched_ = 0;
         }
 
         bool next_group(pair_group & pg);
 
+        // Moves both files to the fraction f of their size, last is raised to the
+        // larger of their next ids
+        void seek(double f, ReadStringID::value_type & last);
+
+        void skip_to(const ReadStringID::value_type & id, bool inclusive = false) {
+            r1_.skip_to(id, inclusive);
+            r2_.skip_to(id, inclusive);
+            passed_.clear();
+            passed_set_.clear();
+            unmatched_ = 0;
+            next_id_ = "";
+        }
+
 	const BamHeader & h1() const {
 	    return r1_.header();
 	}
@@ -69,11 +101,20 @@ class PairGrouper {
 	}
  
     private:
+        // Joins the groups of r2_ to the equal groups of r1_ without comparing names
+        bool next_ordered_(pair_group & pg);
+
 	size_t                              N_;
 	ReadGrouper                         r1_;
 	ReadGrouper                         r2_;
         ReadStringID                        get_id_;
 	ReadStringID::value_type            next_id_;
+	bool                                input_order_;
+        // Read names of the last LOOKAHEAD reference groups of the input order
+        std::deque<ReadStringID::value_type>                    passed_;
+        std::unordered_multiset<ReadStringID::value_type>       passed_set_;
+        // Reference groups passed since the last transcriptome group was joined
+        size_t                                                  unmatched_;
 };
 
 inline bool PairGrouper::pair_group::next_group() {
@@ -90,6 +131,15 @@ inline bool PairGrouper::pair_group::next_group() {
 	while(!r1.empty() && r1.front().qname() == g1.back().qname()){
 	    g1.splice(r1, r1.begin());
 	}
+    }else if(input_order){
+        // r2 only holds the groups joined to a group of r1
+	tmp_ = r1.front().qname();
+	while(!r1.empty() && r1.front().qname() == tmp_){
+	    g1.splice(r1, r1.begin());
+	}
+	while(!r2.empty() && r2.front().qname() == tmp_){
+	    g2.splice(r2, r2.begin());
+	}
     }else{
 	tmp_ = std::min(r1.front().qname(), r2.front().qname(), ReadStringCmp());
 	while(!r1.empty() && r1.front().qname() == tmp_){
@@ -103,9 +153,20 @@ inline bool PairGrouper::pair_group::next_group() {
     return true;
 }
 
+inline void PairGrouper::seek(double f, ReadStringID::value_type & last) {
+    ReadGrouper * rs[2] = { &r1_, &r2_ };
+    for(size_t i = 0; i < 2; i++){
+        if(rs[i]->seek(static_cast<uint64_t>(f * rs[i]->file_size())) && (last.empty() || ReadStringCmp()(last, rs[i]->next_id()))){
+            last = rs[i]->next_id();
+        }
+    }
+    next_id_ = "";
+}
+
 inline bool PairGrouper::next_group(pair_group & pg) {
     pg.r1.clear();
     pg.r2.clear();
+    if(input_order_) return next_ordered_(pg);
     unsigned int cnt = 0;
     while(cnt < N_){
 	next_id_ = std::min(r1_.next_id(), r2_.next_id(), ReadStringCmp());
@@ -140,6 +201,41 @@ inline bool PairGrouper::next_group(pair_group & pg) {
     return cnt > 0;
 }
 
+inline bool PairGrouper::next_ordered_(pair_group & pg) {
+    unsigned int cnt = 0;
+    while(cnt < N_){
+        if(!r1_.has_next()){
+            if(r2_.has_next()){
+                fail("the transcriptome alignments of " + std::string(r2_.next_id()) + " aren't in the order of the reference alignments, "
+                     "the input order needs every read in the reference bam files");
+            }
+            break;
+        }
+        next_id_ = r1_.next_id();
+        r1_.load_next(pg.r1, false);
+        passed_.push_back(next_id_);
+        passed_set_.insert(next_id_);
+        if(passed_.size() > LOOKAHEAD){
+            passed_set_.erase(passed_set_.find(passed_.front()));
+            passed_.pop_front();
+        }
+
+        if(r2_.has_next() && r2_.next_id() == next_id_){
+            r2_.load_next(pg.r2, false);
+            unmatched_ = 0;
+            if(r2_.has_next() && passed_set_.count(r2_.next_id()) > 0){
+                fail("the transcriptome alignments of " + r2_.next_id() + " come after reference alignments that follow them, "
+                     "the input order needs the reads in the same order in the reference and transcriptome bam files");
+            }
+        }else if(r2_.has_next() && ++unmatched_ > LOOKAHEAD){
+            fail("the transcriptome alignments of " + r2_.next_id() + " aren't in the next " + std::to_string(LOOKAHEAD) + " reads of the "
+                 "reference alignments, the input order needs every read in the reference bam files in the same order");
+        }
+        cnt++;
+    }
+    return cnt > 0;
+}
+
 };
 
 #endif
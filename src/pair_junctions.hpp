@@ -30,7 +30,10 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "read_pair.hpp"
 #include "models.hpp"
 #include "header.hpp"
+#include "const_array.hpp"
+#include "context_image.hpp"
 #include <boost/unordered_map.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace rnasequel {
 
@@ -54,7 +57,17 @@ class RefJunctions {
         };
 
 	typedef std::vector<JuncBlock>			    JuncList;
-        typedef JuncList::const_iterator                    const_iterator;
+        typedef ConstArray<JuncBlock>                       JuncView;
+        typedef JuncView::const_iterator                    const_iterator;
+
+        // Junction ranges of a reference in a merge context image
+        struct ImageRef {
+            uint32_t name;
+            uint32_t pstart;
+            uint32_t psize;
+            uint32_t mstart;
+            uint32_t msize;
+        };
 
 	struct DistPosCmp {
 	    bool operator()(const PosBlock *b1, int p){
@@ -62,25 +75,26 @@ class RefJunctions {
 	    }
 	};
 
-	void add_gene(const Gene & gene){
-	    for(size_t i = 0; i < gene.transcripts().size(); i++){
-		add_tx_(gene.transcripts()[i]);
+	void add_gene(const CompactModel & model, const CompactModel::GeneRec & gene){
+	    for(size_t i = 0; i < gene.tx_size; i++){
+		const CompactModel::TranscriptRec & tx = model.transcript(gene, i);
+		add_tx_(tx, model.exons(tx));
 	    }
 	}
 
 	void add_junction(unsigned int lft, unsigned int rgt, Strand strand){
             if(strand == PLUS)
-                pjuncs_.push_back(JuncBlock(lft, rgt, strand));
+                opjuncs_.push_back(JuncBlock(lft, rgt, strand));
             else{
-                mjuncs_.push_back(JuncBlock(lft, rgt, strand));
+                omjuncs_.push_back(JuncBlock(lft, rgt, strand));
             }
 	}
 
 	void add_junction(const PosBlock & junc){
             if(junc.strand() == PLUS)
-                pjuncs_.push_back(JuncBlock(junc.lft(), junc.rgt(), junc.strand()));
+                opjuncs_.push_back(JuncBlock(junc.lft(), junc.rgt(), junc.strand()));
             else if(junc.strand() == MINUS){
-                mjuncs_.push_back(JuncBlock(junc.lft(), junc.rgt(), junc.strand()));
+                omjuncs_.push_back(JuncBlock(junc.lft(), junc.rgt(), junc.strand()));
             }
 	}
 
@@ -89,8 +103,16 @@ class RefJunctions {
         }
 
         void prepare() {
-            prepare_(pjuncs_);
-            prepare_(mjuncs_);
+            prepare_(opjuncs_);
+            prepare_(omjuncs_);
+            pjuncs_ = JuncView(opjuncs_);
+            mjuncs_ = JuncView(omjuncs_);
+        }
+
+        // Uses prepared junctions stored in a merge context image
+        void map(const ImageRef & ref, const JuncView & blocks){
+            pjuncs_ = JuncView(blocks.data() + ref.pstart, ref.psize);
+            mjuncs_ = JuncView(blocks.data() + ref.mstart, ref.msize);
         }
 
 	size_t find_minus(unsigned int p) const {
@@ -101,11 +123,11 @@ class RefJunctions {
             return find_(pjuncs_, p);
 	}
 
-        const JuncList & pjuncs() const {
+        const JuncView & pjuncs() const {
             return pjuncs_;
         }
 
-        const JuncList & mjuncs() const {
+        const JuncView & mjuncs() const {
             return mjuncs_;
         }
 
@@ -129,7 +151,7 @@ class RefJunctions {
 
         }
 
-        size_t find_(const JuncList & juncs, unsigned int p) const{
+        size_t find_(const JuncView & juncs, unsigned int p) const{
             size_t first = 0;
             size_t count = juncs.size();
             while(count > 0){
@@ -147,19 +169,22 @@ class RefJunctions {
             return first;
         }
 
-	void add_tx_(const Transcript & tx){
-	    Transcript::junc_iterator it = tx.junc_it();
-	    while(it.next()){
-                if(it->strand() == PLUS){
-                    pjuncs_.push_back(JuncBlock(it->lft(), it->rgt(), it->strand()));
+	void add_tx_(const CompactModel::TranscriptRec & tx, const PosBlock * exons){
+	    for(size_t i = 1; i < tx.exon_size; i++){
+                if(tx.strand() == PLUS){
+                    opjuncs_.push_back(JuncBlock(exons[i - 1].rgt(), exons[i].lft(), tx.strand()));
                 }else{
-                    mjuncs_.push_back(JuncBlock(it->lft(), it->rgt(), it->strand()));
+                    omjuncs_.push_back(JuncBlock(exons[i - 1].rgt(), exons[i].lft(), tx.strand()));
                 }
 	    }
 	}
 
-        JuncList               pjuncs_;
-        JuncList               mjuncs_;
+        // Junctions collected before prepare
+        JuncList               opjuncs_;
+        JuncList               omjuncs_;
+
+        JuncView               pjuncs_;
+        JuncView               mjuncs_;
 };
 
 /**
@@ -180,7 +205,14 @@ class PairJunctions {
 	*/
 
 	PairJunctions(const SizeDist & dist, unsigned int min_exonic = 0, size_t max_iter = 500) 
-            : dist_(dist), min_exonic_(min_exonic), max_iter_(max_iter), max_dist_(0) 
+            : dist_(dist), min_exonic_(min_exonic), max_iter_(max_iter), max_dist_(0), refs_(new ref_map)
+        {
+	}
+
+        // Shares the junction maps of pj with a different size distribution, used
+        // when several samples are merged against the same annotation
+	PairJunctions(const PairJunctions & pj, const SizeDist & dist) 
+            : dist_(dist), min_exonic_(pj.min_exonic_), max_iter_(pj.max_iter_), max_dist_(pj.max_dist_), refs_(pj.refs_)
         {
 	}
 
@@ -188,28 +220,32 @@ class PairJunctions {
             max_dist_ = d;
         }
 
-	void set_model(const Model & m){
+	void set_model(const CompactModel & m){
 	    build_map_(m);
 	}
 
+        // Stores the prepared junctions in a merge context image or maps them from one
+        void save(ContextImage::Writer & w);
+        void load(const ContextImage & img);
+
 	void add_junction(const std::string & ref, const PosBlock & p){
-	    refs_[ref].add_junction(p);
+	    (*refs_)[ref].add_junction(p);
 	}
 
 	const_iterator begin() const {
-	    return refs_.begin();
+	    return refs_->begin();
 	}
 
 	const_iterator end() const {
-	    return refs_.end();
+	    return refs_->end();
 	}
 
 	iterator begin() {
-	    return refs_.begin();
+	    return refs_->begin();
 	}
 
 	iterator end() {
-	    return refs_.end();
+	    return refs_->end();
 	}
 
         void prepare() {
@@ -228,9 +264,9 @@ class PairJunctions {
 	PairJunctions(const PairJunctions & pj);
 	PairJunctions & operator=(const PairJunctions & pj);
 
-	void build_map_(const Model & genes);
+	void build_map_(const CompactModel & model);
 
-	score_pair estimate_(size_t i, const RefJunctions::JuncList & juncs, 
+	score_pair estimate_(size_t i, const RefJunctions::JuncView & juncs, 
                              unsigned int lft, unsigned int rgt, 
                              unsigned int dist, ReadPair & p, unsigned int depth) ;
 
@@ -239,21 +275,48 @@ class PairJunctions {
         size_t                         max_iter_;
         size_t                         max_dist_;
         size_t                         iter_;
-	ref_map                        refs_;
+	boost::shared_ptr<ref_map>     refs_;
 	ReadPair                       pair_;
         size_t                         size_;
         unsigned int                   down_;
 };
 
-inline void PairJunctions::build_map_(const Model & model) {
-    for(Model::const_iterator it = model.begin(); it != model.end(); it++){
-	RefJunctions & ptr = refs_[it->first];
-	for(Model::gene_list::const_iterator it2 = it->second.begin(); it2 != it->second.end(); it2++){
-	    ptr.add_gene(*it2);    
+inline void PairJunctions::build_map_(const CompactModel & model) {
+    for(size_t c = 0; c < model.chroms_size(); c++){
+	const CompactModel::ChromRec & chrom = model.chrom(c);
+	RefJunctions & ptr = (*refs_)[model.chrom_name(c)];
+	for(const CompactModel::GeneRec * g = model.genes_begin(chrom); g != model.genes_end(chrom); g++){
+	    ptr.add_gene(model, *g);
 	}
     }
 }
 
+inline void PairJunctions::save(ContextImage::Writer & w) {
+    std::vector<RefJunctions::ImageRef>  refs;
+    std::vector<RefJunctions::JuncBlock> blocks;
+    for(iterator it = begin(); it != end(); it++){
+        RefJunctions::ImageRef r;
+        r.name   = w.name(it->first);
+        r.pstart = blocks.size();
+        r.psize  = it->second.pjuncs().size();
+        blocks.insert(blocks.end(), it->second.pjuncs().begin(), it->second.pjuncs().end());
+        r.mstart = blocks.size();
+        r.msize  = it->second.mjuncs().size();
+        blocks.insert(blocks.end(), it->second.mjuncs().begin(), it->second.mjuncs().end());
+        refs.push_back(r);
+    }
+    w.add(ContextImage::JUNC_REFS, refs);
+    w.add(ContextImage::JUNC_BLOCKS, blocks);
+}
+
+inline void PairJunctions::load(const ContextImage & img) {
+    ConstArray<RefJunctions::ImageRef> refs = img.section<RefJunctions::ImageRef>(ContextImage::JUNC_REFS);
+    RefJunctions::JuncView blocks = img.section<RefJunctions::JuncBlock>(ContextImage::JUNC_BLOCKS);
+    for(size_t i = 0; i < refs.size(); i++){
+        (*refs_)[img.name(refs[i].name)].map(refs[i], blocks);
+    }
+}
+
 inline PairJunctions::score_pair PairJunctions::estimate_dist(ReadPair & p) {
     score_pair s(0, 0.0);
 
@@ -269,10 +332,10 @@ inline PairJunctions::score_pair PairJunctions::estimate_dist(ReadPair & p) {
     s         = score_pair(p.isize(), dist_.height(p.fsize()));
 
     //std::cout.flush();
-    const_iterator it = refs_.find(p.r1().tname());
+    const_iterator it = refs_->find(p.r1().tname());
     //p.debug(std::cout);
     //cout << "Estimating DIST! cd = " << cd << " fsize = " << p.fsize() << " score: " << s.second << " min exonic = " << min_exonic_ << "\n";
-    if(it == refs_.end()) {
+    if(it == refs_->end()) {
 	return s;
     }
 
@@ -321,7 +384,7 @@ inline PairJunctions::score_pair PairJunctions::estimate_dist(ReadPair & p) {
 }
 
 inline PairJunctions::score_pair PairJunctions::estimate_(
-	size_t i, const RefJunctions::JuncList & juncs, 
+	size_t i, const RefJunctions::JuncView & juncs, 
         unsigned int lft, unsigned int rgt, 
         unsigned int dist, ReadPair & p, unsigned int depth) 
 {
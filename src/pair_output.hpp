@@ -23,27 +23,109 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/thread/thread.hpp>
 #include "writer.hpp"
 #include <vector>
+#include <cstdio>
 #include "reader.hpp"
 #include "vector_pool.hpp"
+#include "bam_concat.hpp"
+#include "bam_sort.hpp"
+#include "failure.hpp"
+#include <boost/thread/mutex.hpp>
 
 namespace rnasequel {
 
+/**
+ * Writes the resolver pools in the background
+ *
+ * With parts every pool is compressed into its own file by its own thread and
+ * the files are joined by copying their blocks on close, the reads of a
+ * resolver thread stay together instead of following the input order.
+ * Sorted output encodes every pool into its sorter run on its own thread, the
+ * runs are merged by coordinate and indexed on close.
+ * Unsorted output that isn't in the input order (parts, or in_order false
+ * when some reads are written later) has its header sort order set to
+ * unsorted. A write error on a background thread is kept and join() fails
+ * with it on the calling thread after removing the output.
+ */
 class PairOutput {
     public:
-        PairOutput(const std::string & fout, const BamHeader & bh, size_t num_threads) : bout_(fout, bh), running_(false){
+        enum Mode { ORDERED, PARTS, SORTED };
+
+        PairOutput(const std::string & fout, const BamHeader & bh, size_t num_threads, Mode mode = ORDERED, size_t sort_mem = 0, 
+                   bool in_order = true) 
+            : fout_(fout), sorter_(NULL), running_(false), closed_(false)
+        {
             pools.resize(num_threads);
+            const BamHeader * h = &bh;
+            if(mode == PARTS || !in_order){
+                header_.copy_sorted(bh, "unsorted");
+                h = &header_;
+            }
+            if(mode == SORTED){
+                sorter_ = new BamSorter(fout, bh, num_threads, sort_mem);
+                part_threads_.resize(num_threads);
+            }else if(mode == PARTS){
+                for(size_t i = 0; i < num_threads; i++){
+                    parts_.push_back(new BamWriter(part_name_(i), *h));
+                }
+                part_threads_.resize(num_threads);
+            }else{
+                bout_.open(fout, *h);
+            }
+        }
+
+        // An output that wasn't closed is incomplete (the sample failed), it's removed
+        ~PairOutput() {
+            wait_();
+            if(!closed_) discard();
+            for(size_t i = 0; i < parts_.size(); i++) delete parts_[i];
+            delete sorter_;
         }
 
         void operator()(){
-            for(auto & p : pools){
-                for(auto & r : p){
-                    bout_.write_read(r);
+            FailScope scope;
+            try {
+                for(auto & p : pools){
+                    for(auto & r : p){
+                        bout_.write_read(r);
+                    }
                 }
+            } catch(const Failure & e) {
+                set_error_(e.what());
             }
         }
 
-        void close() {
+        void close(std::ostream & log = std::cout) {
+            join();
+            if(sorter_ != NULL){
+                sorter_->close(log);
+            }else if(parts_.empty()){
+                bout_.close();
+            }else{
+                BamConcat out(fout_);
+                for(size_t i = 0; i < parts_.size(); i++){
+                    parts_[i]->close();
+                    out.add(part_name_(i));
+                    std::remove(part_name_(i).c_str());
+                }
+                out.close();
+            }
+            closed_ = true;
+        }
+
+        // Removes the output without finishing it
+        void discard() {
+            wait_();
+            if(sorter_ != NULL){
+                sorter_->discard();
+                std::remove((fout_ + ".bai").c_str());
+            }
             bout_.close();
+            for(size_t i = 0; i < parts_.size(); i++){
+                parts_[i]->close();
+                std::remove(part_name_(i).c_str());
+            }
+            std::remove(fout_.c_str());
+            closed_ = true;
         }
 
         void start() {
@@ -53,22 +135,76 @@ class PairOutput {
             }
             if(!running_ && count > 0){
                 running_ = true;
-                thread_  = boost::thread(boost::ref(*this));
+                if(part_threads_.empty()){
+                    thread_ = boost::thread(boost::ref(*this));
+                }else{
+                    for(size_t i = 0; i < part_threads_.size(); i++){
+                        part_threads_[i] = boost::thread(&PairOutput::write_part_, this, i);
+                    }
+                }
             }
         }
 
         void join() {
-            if(running_) {
-                thread_.join();
-                running_ = false;
+            wait_();
+            if(!error_.empty()){
+                std::string error;
+                error.swap(error_);
+                discard();
+                fail(error);
             }
         }
 
         std::vector< VectorPool<BamRead> > pools;
     private:
-        BamWriter     bout_;
-        boost::thread thread_;
-        bool          running_;
+        PairOutput(const PairOutput & p);
+        PairOutput & operator=(const PairOutput & p);
+
+        void write_part_(size_t i) {
+            FailScope scope;
+            try {
+                for(auto & r : pools[i]){
+                    if(sorter_ != NULL) sorter_->add(i, r);
+                    else parts_[i]->write_read(r);
+                }
+            } catch(const Failure & e) {
+                set_error_(e.what());
+            }
+        }
+
+        // Joins the threads without looking at their errors
+        void wait_() {
+            if(running_) {
+                if(part_threads_.empty()){
+                    thread_.join();
+                }else{
+                    for(size_t i = 0; i < part_threads_.size(); i++) part_threads_[i].join();
+                }
+                running_ = false;
+            }
+        }
+
+        // The first error of the threads is the one reported
+        void set_error_(const std::string & error) {
+            boost::mutex::scoped_lock lock(error_mtx_);
+            if(error_.empty()) error_ = error;
+        }
+
+        std::string part_name_(size_t i) const {
+            return fout_ + ".part" + std::to_string(i);
+        }
+
+        std::string                  fout_;
+        BamHeader                    header_;
+        BamWriter                    bout_;
+        std::vector<BamWriter*>      parts_;
+        BamSorter                  * sorter_;
+        std::vector<boost::thread>   part_threads_;
+        boost::thread                thread_;
+        bool                         running_;
+        bool                         closed_;
+        boost::mutex                 error_mtx_;
+        std::string                  error_;
 
 };
 
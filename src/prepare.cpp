@@ -0,0 +1,124 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "prepare.hpp"
+#include "context_image.hpp"
+#include "resolve_fragments.hpp"
+#include "size_dist.hpp"
+#include "gtf.hpp"
+#include "timer.hpp"
+#include <boost/program_options.hpp>
+#include <string>
+#include <iostream>
+
+namespace po = boost::program_options;
+
+using namespace std;
+using namespace rnasequel;
+
+void prepare_init_options(int argc, char *argv[], po::variables_map & vm) {
+    po::options_description generic("Arguments");
+    generic.add_options()
+    ("gtf,g", po::value< string >(), "GTF file (optional)")
+    ("gtf-cache", po::value< string >(), "Parsed annotation cache, loaded instead of the GTF when it matches and written after parsing it (default <gtf>.cache)")
+    ("no-gtf-cache", "Don't read or write the parsed annotation cache")
+    ("fragments,f", po::value<string>(), "Transcriptome fragment database (.fdb or .txt)")
+    ("output,o", po::value<string>(), "Output context image")
+    ("threads,t", po::value< unsigned int >()->default_value(4), "Number of threads to use for GTF parsing")
+    ("help,h", "help message")
+    ;
+
+    po::store(po::command_line_parser(argc, argv).options(generic).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "Usage: " << endl;
+        cout << "rnasequel " << string(argv[0]) << " [options] -f <prefix.fdb> -o <context.img>\n" << endl;
+        cout << generic << "\n";
+        exit(0);
+    }
+
+    bool error = false;
+
+    if(vm.count("output") == 0) {
+        cout << "An output context image must be specified\n";
+        error = true;
+    }
+
+    if(vm.count("fragments") == 0) {
+        cout << "The fragment index must be specified\n";
+        error = true;
+    }
+
+    if(error) exit(1);
+}
+
+void rnasequel::build_merge_junctions(const CompactModel & model, const FragmentDB & fdb, PairJunctions & pjuncs, SpliceTrimmer & strimmer) {
+    Timer ti("Building the splice junction maps");
+    pjuncs.set_model(model);
+
+    for(size_t j = 0; j < fdb.sets_size(); j++){
+        const FragmentDB::Set     & s     = fdb.set(j);
+        if(s.size < 2) continue;
+        const FragmentDB::Block   * b     = fdb.blocks(s);
+        const std::string         & chrom = fdb.chrom(s);
+        for(size_t i = 1; i < s.size; i++){
+            pjuncs.add_junction(chrom, PosBlock(b[i - 1].rgt, b[i].lft, fdb.strand(s)));
+            strimmer.add_junction(chrom, b[i - 1].rgt, b[i].lft);
+        }
+    }
+
+    pjuncs.prepare();
+    strimmer.merge();
+}
+
+int rnasequel::prepare_context(int argc, char *argv[]) {
+    po::variables_map vm;
+    prepare_init_options(argc, argv, vm);
+    Timer ti("Total context preparation time");
+
+    CompactModel model;
+    if(vm.count("gtf") > 0){
+        Model parsed;
+        GTF::parse(vm["gtf"].as<string>(), parsed, vm["threads"].as<unsigned int>(), GTF::cache_file(vm));
+        parsed.sort_genes();
+        model.build(parsed);
+    }
+
+    ResolveFragments rf;
+    rf.open(vm["fragments"].as<string>());
+
+    // The size distribution and trimming distance are merge parameters and aren't part of the image
+    SizeDist      size_dist;
+    PairJunctions pjuncs(size_dist);
+    SpliceTrimmer strimmer(0);
+    build_merge_junctions(model, rf.fragment_db(), pjuncs, strimmer);
+
+    {
+        Timer ti("Writing the context image");
+        ContextImage::Writer w;
+        model.save(w);
+        pjuncs.save(w);
+        strimmer.save(w);
+        rf.save(w);
+        w.save(vm["output"].as<string>());
+    }
+    return 0;
+}
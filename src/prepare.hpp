@@ -0,0 +1,38 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GW_PREPARE_HPP
+#define GW_PREPARE_HPP
+
+#include "models.hpp"
+#include "fragment_db.hpp"
+#include "pair_junctions.hpp"
+#include "splice_trim.hpp"
+
+namespace rnasequel {
+
+int prepare_context(int argc, char * argv[]);
+
+// Builds the pairing junction map and the splice site lists used by merge
+void build_merge_junctions(const CompactModel & model, const FragmentDB & fdb, PairJunctions & pjuncs, SpliceTrimmer & strimmer);
+
+};
+
+#endif
@@ -135,6 +135,101 @@ void BamRead::load_to_struct(bam1_t *b) {
     }
 }
 
+namespace {
+    struct PackedCore {
+        int32_t  tid;
+        int32_t  lft;
+        int32_t  mlft;
+        int32_t  mtid;
+        int32_t  tlen;
+        int32_t  score;
+        uint32_t flag;
+        uint32_t n_cigar;
+        uint32_t l_qname;
+        uint32_t l_tname;
+        uint32_t l_seq;
+        uint32_t l_qual;
+        uint32_t l_aux;
+        uint8_t  mapq;
+        uint8_t  filtered;
+    };
+}
+
+void BamRead::pack(std::vector<uint8_t> & out) const {
+    PackedCore c;
+    memset(&c, 0, sizeof(c));
+    c.tid      = tid();
+    c.lft      = lft();
+    c.mlft     = mlft();
+    c.mtid     = mtid();
+    c.tlen     = tlen();
+    c.score    = score();
+    c.flag     = flag.flag_val;
+    c.n_cigar  = cigar.size();
+    c.l_qname  = qname().length();
+    c.l_tname  = tname().length();
+    c.l_seq    = seq.length();
+    c.l_qual   = quals.length();
+    c.l_aux    = tags.get_size();
+    c.mapq     = map_q();
+    c.filtered = filtered();
+
+    size_t start = out.size();
+    out.resize(start + sizeof(c) + c.l_qname + c.l_tname + 4 * c.n_cigar + ((c.l_seq + 1) >> 1) + c.l_qual + c.l_aux);
+    uint8_t * p = &out[start];
+    memcpy(p, &c, sizeof(c));
+    p += sizeof(c);
+    memcpy(p, qname().data(), c.l_qname);
+    p += c.l_qname;
+    memcpy(p, tname().data(), c.l_tname);
+    p += c.l_tname;
+    for(Cigar::const_iterator it = cigar.begin(); it != cigar.end(); ++it) {
+        uint32_t v = it->packed();
+        memcpy(p, &v, 4);
+        p += 4;
+    }
+    seq.copy_to(p);
+    p += (c.l_seq + 1) >> 1;
+    memcpy(p, quals.data(), c.l_qual);
+    p += c.l_qual;
+    for(BamTags::const_iterator it = tags.begin(); it != tags.end(); ++it) {
+        p = it->fill_data(p);
+    }
+}
+
+const uint8_t * BamRead::unpack(const uint8_t * p) {
+    PackedCore c;
+    memcpy(&c, p, sizeof(c));
+    p += sizeof(c);
+    tid()        = c.tid;
+    lft()        = c.lft;
+    mlft()       = c.mlft;
+    mtid()       = c.mtid;
+    tlen()       = c.tlen;
+    score()      = c.score;
+    flag.flag_val = c.flag;
+    map_q()      = c.mapq;
+    filtered()   = c.filtered != 0;
+
+    qname().assign(reinterpret_cast<const char *>(p), c.l_qname);
+    p += c.l_qname;
+    tname().assign(reinterpret_cast<const char *>(p), c.l_tname);
+    p += c.l_tname;
+    cigar.resize(c.n_cigar, CigarElement(0));
+    for(Cigar::iterator it = cigar.begin(); it != cigar.end(); ++it) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        it->set_cigar(v);
+        p += 4;
+    }
+    seq.copy_from(p, c.l_seq);
+    p += (c.l_seq + 1) >> 1;
+    quals.update(p, c.l_qual);
+    p += c.l_qual;
+    tags.update_data(p, c.l_aux);
+    return p + c.l_aux;
+}
+
 void BamRead::clip_front(unsigned int n) {
     //std::cout << "front n: " << n << " cigar: " << this->cigar << "\n";
     Cigar::iterator it = cigar.begin();
@@ -29,6 +29,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "types.hpp"
 #include "packed_seq.hpp"
 #include <algorithm>
+#include <vector>
 
 namespace rnasequel {
 
@@ -126,6 +127,11 @@ class BamRead {
 
         void load_from_struct(const bam1_t *b, const std::string & s_tname);
         void load_to_struct(bam1_t *b);
+
+        // Appends a compact copy of the read (bam style packed fields) to out
+        // and restores a read from one, unpack returns the end of the record
+        void pack(std::vector<uint8_t> & out) const;
+        const uint8_t * unpack(const uint8_t * p);
         // Bam entry methods
 	const std::string & qname() const {
             return _qname;
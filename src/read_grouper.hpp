@@ -141,12 +141,23 @@ class ReadGroup : public MemPoolList<BamRead> {
 };
 
 
+/**
+ * Groups the consecutive reads of a file with the same name
+ *
+ * load_next() and has_next() only need the reads of a name to be together,
+ * the order the aligner wrote them in is fine. load_id(), seek() and
+ * skip_to() need the file sorted by name (ReadStringCmp).
+ */
 class ReadGrouper {
     public:
+        // First step back from an offset with no block after it, the largest BGZF block
+        static const uint64_t SEEK_BACK = 1UL << 16;
+
         ReadGrouper() : _next(true) { }
 
-        ReadGrouper(const std::string &file) : _next(true) {
-            open(file);
+        // An empty file name leaves the grouper without any groups
+        ReadGrouper(const std::string &file) : _next(!file.empty()) {
+            if(_next) open(file);
         }
 
         ~ReadGrouper() { }
@@ -156,6 +167,21 @@ class ReadGrouper {
         bool load_next(ReadGroup & reads, bool clear = true);
 
         bool load_id(ReadGroup & reads, const ReadStringID::value_type & id);
+
+        /**
+         * Moves to the first whole group after the byte offset, see BamReader::sync.
+         * An offset past the last block with reads (a small file or the end of the
+         * last block) backs off to an earlier block, a file is only ended by seeking
+         * if it has no reads at all
+         */
+        bool seek(uint64_t offset);
+
+        // Discards the groups before id, or up to and including id
+        void skip_to(const ReadStringID::value_type & id, bool inclusive = false);
+
+        uint64_t file_size() const {
+            return _reader.file_size();
+        }
         
         bool has_next() const {
             return _next;
@@ -246,7 +272,36 @@ inline bool ReadGrouper::load_id(ReadGroup & reads, const ReadStringID::value_ty
     return true;
 }
 
+inline bool ReadGrouper::seek(uint64_t offset) {
+    bool synced = false;
+    for(uint64_t back = 0; !synced; back = back == 0 ? static_cast<uint64_t>(SEEK_BACK) : back * 2){
+        uint64_t at = back < offset ? offset - back : 0;
+        synced = _reader.sync(at);
+        if(at == 0) break;
+    }
+    _next = synced && _reader.get_read(_read.front());
+    if(_next){
+        // The group at the offset may have started in an earlier block
+        _next_id = _get_id(_read.front());
+        ReadStringID::value_type first = _next_id;
+        skip_to(first, true);
+    }else{
+        _next_id = _get_id.max_value;
+    }
+    return _next;
+}
+
+inline void ReadGrouper::skip_to(const ReadStringID::value_type & id, bool inclusive) {
+    while(_next && (_cmp(_next_id, id) || (inclusive && _next_id == id))) {
+        if(!_reader.get_read(_read.front())) {
+            _next = false;
+	    _next_id = _get_id.max_value;
+            break;
+        }
+        _next_id = _get_id(_read.front());
+    }
+}
+
 }; // namespace rnasequel
 
 #endif
-
@@ -26,6 +26,13 @@ bool PairedReader::load_input(){
     size_t count = 0;
     while(!done_ && count < input.size()){
         read_one_(*input[count]);
+        const std::string & q = qname_(*input[count]);
+        if(!end_.empty() && !q.empty() && !cmp_(q, end_)){
+            input[count]->reset();
+            total_--;
+            done_ = true;
+            break;
+        }
         count++;
     }
     //std::cout << "  Read total: " << total_ << " count = " << count << " input size: " << input.size() << "\n";
@@ -33,6 +40,43 @@ bool PairedReader::load_input(){
     return count > 0;
 }
 
+bool PairedReader::seek(double f, const std::string & after){
+    std::string & target = start_;
+    target.clear();
+    in1_.seek(f, target);
+    if(!paired_) in2_.seek(f, target);
+    if(!after.empty() && (target.empty() || !cmp_(after, target))){
+        in1_.skip_to(after, true);
+        if(!paired_) in2_.skip_to(after, true);
+    }else if(!target.empty()){
+        in1_.skip_to(target);
+        if(!paired_) in2_.skip_to(target);
+    }
+    r1_.reset();
+    r2_.reset();
+    pair_      = true;
+    r1_done_   = false;
+    r2_done_   = false;
+    r1_single_ = false;
+    r2_single_ = false;
+    done_      = target.empty();
+    count_     = 0;
+    return !done_;
+}
+
+std::string PairedReader::last_qname() const {
+    if(count_ == 0) return blank_;
+    return qname_(*input[count_ - 1]);
+}
+
+const std::string & PairedReader::qname_(const InputPair & in) const {
+    if(!in.ref1.empty()) return in.ref1.front().qname();
+    if(!in.tx1.empty())  return in.tx1.front().qname();
+    if(!in.ref2.empty()) return in.ref2.front().qname();
+    if(!in.tx2.empty())  return in.tx2.front().qname();
+    return blank_;
+}
+
 void PairedReader::next_(PairGrouper & pg, PairGrouper::pair_group & g, bool & done){
     if(!g.next_group()){
         if(!pg.next_group(g) || !g.next_group()){
@@ -47,8 +91,41 @@ const std::string & PairedReader::qname_(PairGrouper::pair_group & g) {
     else                   return blank_;
 }
 
+void PairedReader::split_(ReadGroup & group, ReadGroup & g1, ReadGroup & g2){
+    while(!group.empty()){
+        BamRead & r = group.front();
+        ReadGroup & to = r.flag.read2 ? g2 : g1;
+        // The mate details are dropped so the reads look like they were aligned on their own
+        r.flag.paired      = 0;
+        r.flag.proper_pair = 0;
+        r.flag.m_unmapped  = 0;
+        r.flag.m_strand    = 0;
+        r.flag.read1       = 0;
+        r.flag.read2       = 0;
+        r.mtid()           = -1;
+        r.mlft()           = -1;
+        r.tlen()           = 0;
+        to.splice(group, group.begin());
+    }
+}
+
+void PairedReader::read_paired_(InputPair & in){
+    next_(in1_, r1_, r1_done_);
+    if(r1_done_){
+        done_ = true;
+        return;
+    }
+    split_(r1_.g1, in.ref1, in.ref2);
+    split_(r1_.g2, in.tx1, in.tx2);
+    total_++;
+}
+
 void PairedReader::read_one_(InputPair & in){
     in.reset();
+    if(paired_){
+        read_paired_(in);
+        return;
+    }
 
     if(r1_done_ && r2_done_){
         pair_      = false;
@@ -66,6 +143,11 @@ void PairedReader::read_one_(InputPair & in){
         next_(in2_, r2_, r2_done_);
     }
 
+    if(input_order_ && r1_done_ != r2_done_) {
+        fail(std::string("the reference alignments of read ") + (r1_done_ ? "1" : "2") + " ended before the ones of read " + (r1_done_ ? "2" : "1") + ", "
+             "the input order needs every read in both reference bam files");
+    }
+
     if(((r1_done_ || r2_done_) && (r1_done_ != r2_done_))) {
         r1_single_ = !r1_done_;
         r2_single_ = !r2_done_;
@@ -79,6 +161,9 @@ void PairedReader::read_one_(InputPair & in){
         pair_      = true;
         r1_single_ = false;
         r2_single_ = false;
+    }else if(input_order_){
+        fail("the reference alignments of read 1 (" + std::string(qname_(r1_)) + ") and read 2 (" + std::string(qname_(r2_)) + ") are out of step, "
+             "the input order needs every read in both reference bam files");
     }else{
         bool check = cmp_(qname_(r1_), qname_(r2_));
         r1_single_ = check;
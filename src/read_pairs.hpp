@@ -50,15 +50,23 @@ class PairedReader{
         typedef std::vector<InputPair*> input_pairs;
 
 
+        /**
+         * With input_order the files are in the order the aligner wrote them instead of
+         * sorted by read name, the groups are joined on equal names without comparing
+         * them so seek() and set_end() can't be used. Without ref2 and tx2 the ref1 and
+         * tx1 files hold both mates and the groups are split by their read 1 / 2 flag
+         */
         PairedReader(const std::string & ref1, const std::string & tx1, const std::string & ref2, const std::string & tx2, 
-                     size_t inputsize = 1000) 
-            : in1_(10, ref1, tx1), in2_(10, ref2, tx2), ref1_(ref1), ref2_(ref2), tx1_(tx1), tx2_(tx2), r1_(pool_), r2_(pool_),
-              total_(0), count_(0), pair_(true), r1_done_(false), r2_done_(false), r1_single_(false), r2_single_(false), done_(false)
+                     size_t inputsize = 1000, bool input_order = false) 
+            : in1_(10, ref1, tx1, input_order), in2_(10, ref2, tx2, input_order), ref1_(ref1), ref2_(ref2), tx1_(tx1), tx2_(tx2), 
+              r1_(pool_, input_order), r2_(pool_, input_order), total_(0), count_(0), pair_(true), r1_done_(false), r2_done_(false), 
+              r1_single_(false), r2_single_(false), done_(false), input_order_(input_order), paired_(ref2.empty() && tx2.empty())
 
         {
             for(size_t i = 0; i < inputsize; i++){
                 input.push_back(new InputPair(pool_));
             }
+            count_ = std::min(count_, inputsize);
         }
 
         ~PairedReader() {
@@ -76,13 +84,44 @@ class PairedReader{
             r1_single_ = false;
             r2_single_ = false;
             in1_.reopen(ref1_, tx1_);
-            in2_.reopen(ref2_, tx2_);
+            if(!paired_) in2_.reopen(ref2_, tx2_);
             r1_.reset();
             r2_.reset();
         }
 
         bool load_input();
 
+        // Changes the number of groups load_input reads at a time
+        void set_input_size(size_t inputsize) {
+            while(input.size() > inputsize){
+                delete input.back();
+                input.pop_back();
+            }
+            while(input.size() < inputsize){
+                input.push_back(new InputPair(pool_));
+            }
+        }
+
+        /**
+         * Moves the four files to the fraction f of their size and lines them up
+         * on the first read name they can all start from. Groups up to and
+         * including after are skipped so sampled windows don't overlap
+         */
+        bool seek(double f, const std::string & after = "");
+
+        // First read name the last seek lined up on, empty if the files ended before it
+        const std::string & start() const {
+            return start_;
+        }
+
+        // Groups from this read name on aren't loaded, empty to read to the end
+        void set_end(const std::string & end) {
+            end_ = end;
+        }
+
+        // Read name of the last group loaded
+        std::string last_qname() const;
+
         size_t total() const { 
             return total_;
         }
@@ -100,18 +139,22 @@ class PairedReader{
         }
 
         const BamHeader & ref2_header() const {
-            return in2_.h1();
+            return paired_ ? in1_.h1() : in2_.h1();
         }
 
         const BamHeader & tx2_header() const {
-            return in2_.h2();
+            return paired_ ? in1_.h2() : in2_.h2();
         }
 
         input_pairs             input;
     private:
         void next_(PairGrouper & pg, PairGrouper::pair_group & g, bool & done);
         void read_one_(InputPair & in);
+        void read_paired_(InputPair & in);
+        // Moves the reads of group to the read 1 or read 2 group by their flag
+        void split_(ReadGroup & group, ReadGroup & g1, ReadGroup & g2);
         const std::string & qname_(PairGrouper::pair_group & g);
+        const std::string & qname_(const InputPair & in) const;
 
         PairGrouper             in1_;
         PairGrouper             in2_;
@@ -123,6 +166,8 @@ class PairedReader{
         PairGrouper::pair_group r1_;
         PairGrouper::pair_group r2_;
         std::string             blank_;
+        std::string             start_;
+        std::string             end_;
         ReadStringCmp           cmp_;
         size_t                  total_;
         size_t                  count_;
@@ -132,6 +177,8 @@ class PairedReader{
         bool                    r1_single_;
         bool                    r2_single_;
         bool                    done_;
+        bool                    input_order_;
+        bool                    paired_;
 };
 
 
@@ -19,38 +19,163 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "reader.hpp"
 #include <climits>
+#include <cstring>
+#include <cstdio>
+#include <vector>
 #include <stdint.h>
+#include <sys/stat.h>
 
 using namespace rnasequel;
 using namespace std;
 
-BamReader::BamReader(const string & file, bool bam) : _unaligned("*"), _bam(NULL), _data(bam_init1()) {
+namespace {
+
+const size_t  SYNC_BUFFER  = 1 << 18;
+const size_t  SYNC_RECORDS = 3;
+
+int32_t le32(const uint8_t * p) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Length of a plausible alignment record at p or 0, n is the number of bytes available
+size_t record_length(const uint8_t * p, size_t n, int32_t n_ref) {
+    if(n < 36) return 0;
+    int32_t  bsize  = le32(p);
+    int32_t  tid    = le32(p + 4);
+    int32_t  pos    = le32(p + 8);
+    uint32_t lname  = p[12];
+    uint32_t ncigar = p[16] | (p[17] << 8);
+    int32_t  lseq   = le32(p + 20);
+    int32_t  mtid   = le32(p + 24);
+    int32_t  mpos   = le32(p + 28);
+    if(bsize < 32 || bsize > (1 << 24) || tid < -1 || tid >= n_ref || mtid < -1 || mtid >= n_ref) return 0;
+    if(pos < -1 || mpos < -1 || lname < 2 || lseq < 0) return 0;
+    if(32 + lname + 4 * ncigar + (lseq + 1) / 2 + lseq > static_cast<uint32_t>(bsize)) return 0;
+    if(n < 36 + lname) return 0;
+    const uint8_t * name = p + 36;
+    if(name[lname - 1] != 0) return 0;
+    for(size_t i = 0; i + 1 < lname; i++){
+        if(name[i] < 33 || name[i] > 126) return 0;
+    }
+    return 4 + bsize;
+}
+
+// Offset of the first record in buf followed by well formed records
+bool find_record(const uint8_t * buf, size_t n, bool eof, int32_t n_ref, size_t & start) {
+    for(start = 0; start + 36 <= n; start++){
+        size_t p = start, found = 0;
+        while(found < SYNC_RECORDS){
+            size_t len = record_length(buf + p, n - p, n_ref);
+            if(len == 0) break;
+            p += len;
+            found++;
+            if(p >= n) break;
+        }
+        if(found == SYNC_RECORDS || (found > 0 && eof && p == n)) return true;
+    }
+    return false;
+}
+
+bool is_block_header(const uint8_t * p) {
+    return p[0] == 31 && p[1] == 139 && p[2] == 8 && (p[3] & 4) != 0 && p[12] == 'B' && p[13] == 'C' && p[14] == 2 && p[15] == 0;
+}
+
+};
+
+BamReader::BamReader(const string & file, bool bam) : _data_start(0), _unaligned("*"), _bam(NULL), _sam(NULL), _data(bam_init1()) {
     open(file, bam);
 }
 
-BamReader::BamReader() : _unaligned("*"),  _bam(NULL), _data(bam_init1()) {
+BamReader::BamReader() : _data_start(0), _unaligned("*"),  _bam(NULL), _sam(NULL), _data(bam_init1()) {
+}
+
+bool BamReader::is_stream(const std::string & file) {
+    struct stat st;
+    return file == "-" || (stat(file.c_str(), &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+bool BamReader::is_sam(const std::string & file) {
+    return is_stream(file) || (file.size() > 4 && file.compare(file.size() - 4, 4, ".sam") == 0);
 }
 
 void BamReader::open(const string & file, bool bam) {
     if(_bam != NULL) samclose(_bam);
+    delete _sam;
+    _bam = NULL;
+    _sam = NULL;
+    _file = file;
+
+    if(!bam || is_sam(file)) {
+        _sam = new SamReader(file);
+        _header.set_cstruct(_sam->header());
+        _data_start = 0;
+        return;
+    }
         
-    _bam = samopen(file.c_str(), bam ? "rb" : "r", NULL);
+    _bam = samopen(file.c_str(), "rb", NULL);
 
     if(_bam == NULL) {
-        cout << "Error opening the bam file `" << file << "` for reading\n";
-        exit(1);
+        fail("opening the bam file `" + file + "` for reading");
     }
 
     _header.set_cstruct(_bam->header);
+    _data_start = bam_tell(_bam->x.bam);
+}
+
+uint64_t BamReader::file_size() const {
+    struct stat st;
+    if(stat(_file.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+bool BamReader::sync(uint64_t offset) {
+    // Sam text can't be synced, merge rejects shards and sampling windows with sam or piped input
+    if(_sam != NULL) return false;
+    BGZF * fp = _bam->x.bam;
+    if(offset <= static_cast<uint64_t>(_data_start >> 16)) {
+        return bam_seek(fp, _data_start, SEEK_SET) == 0;
+    }
+
+    FILE * raw = fopen(_file.c_str(), "rb");
+    if(raw == NULL) return false;
+    std::vector<uint8_t> buf(SYNC_BUFFER), data(SYNC_BUFFER);
+    int32_t n_ref = _bam->header->n_targets;
+    bool found = false;
+    while(!found && fseeko(raw, offset, SEEK_SET) == 0){
+        size_t n = fread(&buf[0], 1, buf.size(), raw);
+        if(n < 18) break;
+        size_t i = 0;
+        for(; i + 18 <= n && !found; i++){
+            if(!is_block_header(&buf[i])) continue;
+            int64_t block = offset + i;
+            if(bam_seek(fp, block << 16, SEEK_SET) != 0) continue;
+            ssize_t got = bam_read(fp, &data[0], data.size());
+            if(got <= 0) continue;
+            size_t start = 0;
+            if(!find_record(&data[0], got, static_cast<size_t>(got) < data.size(), n_ref, start)) continue;
+            // Records span blocks so the start is reached by reading up to it
+            bam_seek(fp, block << 16, SEEK_SET);
+            found = start == 0 || bam_read(fp, &data[0], start) == static_cast<ssize_t>(start);
+        }
+        // The last 17 bytes may hold the start of a header
+        offset += i;
+        if(n < buf.size()) break;
+    }
+    fclose(raw);
+    return found;
 }
 
 BamReader::~BamReader() {
     if(_bam != NULL)
         samclose(_bam);
+    delete _sam;
     bam_destroy1(_data);
 }
 
 bool BamReader::get_read(BamRead &r) {
+    if(_sam != NULL) return _sam->get_read(r);
     if(samread(_bam,_data) <= 0) {
         return false;
     }
@@ -24,10 +24,15 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <bam/sam.h>
 #include <bam/bam.h>
 #include "header.hpp"
+#include "sam_reader.hpp"
 #include <stdint.h>
 
 namespace rnasequel {
 
+/**
+ * Bam file reader, sam text (bam = false, a .sam file, a pipe or stdin as "-")
+ * is read by a SamReader
+ */
 class BamReader {
     public:
         BamReader();
@@ -37,12 +42,23 @@ class BamReader {
         ~BamReader();
 
 	operator bool() {
-	    return _bam != NULL;
+	    return _bam != NULL || _sam != NULL;
 	}
 
         // Instead of returning a new read, overwrite the one specified
         bool get_read(BamRead &r);
 
+        // Reads the next entry without converting it to a BamRead
+        bool get_struct(bam1_t * b) {
+            if(_sam != NULL) return _sam->get_struct(b);
+            return samread(_bam, b) > 0;
+        }
+
+        // True for input that can only be read once (a pipe or stdin)
+        static bool is_stream(const std::string & file);
+        // True if the file is read as sam text
+        static bool is_sam(const std::string & file);
+
         const BamHeader & header() const {
             return _header;
         }
@@ -57,13 +73,28 @@ class BamReader {
         }
         */
 
+        // Size of the compressed file in bytes
+        uint64_t file_size() const;
+
+        /**
+         * Moves to the first alignment that starts in a BGZF block at or after
+         * the byte offset, returns false if there isn't one. The block start is
+         * found by its gzip header and the alignment by checking that a few
+         * consecutive records are well formed
+         */
+        bool sync(uint64_t offset);
+
     private:
         BamReader(const BamReader & b);
         BamReader & operator=(const BamReader & b);
         
         BamHeader                        _header;
+        std::string                      _file;
+        // Virtual offset of the first alignment
+        int64_t                          _data_start;
         std::string                      _unaligned;
         samfile_t                      * _bam;
+        SamReader                      * _sam;
         bam1_t                         * _data;
 };
 
@@ -19,86 +19,162 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "resolve_fragments.hpp"
 #include "cigar_misc.hpp"
+#include <algorithm>
 using namespace std;
 using namespace rnasequel;
 
 #include <iostream>
 
+void ResolveFragments::open(const std::string & frag_db) {
+    frags_.open(frag_db);
+    chroms_ = frags_.chroms();
+    compile_();
+}
+
+void ResolveFragments::open(const ContextImage & img) {
+    ConstArray<uint32_t> names = img.section<uint32_t>(ContextImage::FRAG_CHROMS);
+    chroms_.clear();
+    for(size_t i = 0; i < names.size(); i++){
+        chroms_.push_back(img.name(names[i]));
+    }
+    rec2proj_    = img.section<ProjectionRange>(ContextImage::FRAG_RECORDS);
+    projections_ = img.section<Projection>(ContextImage::FRAG_PROJECTIONS);
+    blocks_      = img.section<ProjectionBlock>(ContextImage::FRAG_BLOCKS);
+}
+
+void ResolveFragments::compile_() {
+    orec2proj_.assign(frags_.size(), ProjectionRange());
+    oprojections_.clear();
+    oblocks_.clear();
+    for(size_t i = 0; i < frags_.size(); ++i) {
+        const FragmentDB::Record & rec = frags_[i];
+        orec2proj_[i].start = oprojections_.size();
+        orec2proj_[i].size  = rec.size;
+        for(size_t k = rec.start; k < rec.start + rec.size; k++) {
+            const FragmentDB::Set & s = frags_.set(k);
+            const FragmentDB::Block * fb = frags_.blocks(s);
+            Strand strand = frags_.strand(s);
+            oprojections_.push_back(Projection());
+            Projection & p = oprojections_.back();
+            p.start   = oblocks_.size();
+            p.offset  = s.offset;
+            p.frag_id = i;
+            p.chrom   = s.chrom;
+            if(strand != BOTH && strand != UNKNOWN) p.xs = strand2char[strand];
+            for(size_t j = 0; j < s.size; ++j) {
+                pos_t skip = (j + 1) < s.size ? fb[j + 1].lft - fb[j].rgt - 1 : 0;
+                oblocks_.push_back(ProjectionBlock(fb[j].r_rgt, fb[j].lft - fb[j].r_lft, skip));
+            }
+            p.end = oblocks_.size();
+        }
+    }
+    rec2proj_    = ConstArray<ProjectionRange>(orec2proj_);
+    projections_ = ConstArray<Projection>(oprojections_);
+    blocks_      = ConstArray<ProjectionBlock>(oblocks_);
+}
+
+void ResolveFragments::save(ContextImage::Writer & w) const {
+    std::vector<uint32_t> names;
+    for(size_t i = 0; i < chroms_.size(); i++){
+        names.push_back(w.name(chroms_[i]));
+    }
+    w.add(ContextImage::FRAG_CHROMS, names);
+    w.add(ContextImage::FRAG_RECORDS, rec2proj_.data(), rec2proj_.size());
+    w.add(ContextImage::FRAG_PROJECTIONS, projections_.data(), projections_.size());
+    w.add(ContextImage::FRAG_BLOCKS, blocks_.data(), blocks_.size());
+}
+
 bool ResolveFragments::resolve(BamRead &r) const {
-    //cout << "Before: " << r;
-    const FragmentSet & s = *tid2set_[r.tid()];
-    // Calculating the rgt side is slow
-    pos_t rgt = r.rgt();
-    pos_t lft = r.lft();
-    size_t i = 0;
+    CigarBuffer buffer;
+    return resolve(r, buffer);
+}
 
-    // Find the first block that overlaps with the read
-    while((lft > s[i].r_rgt) && i < s.size()) i++;
+bool ResolveFragments::resolve(BamRead &r, CigarBuffer & buffer, size_t set) const {
+    //cout << "Before: " << r;
+    const ProjectionRange & range = range_(r.tid());
+    if(set >= range.size) {
+        r.filtered() = true;
+        return false;
+    }
+    const Projection & p = projections_[range.start + set];
+    const ProjectionBlock * bend = blocks_.begin() + p.end;
+    pos_t lft = r.lft() - p.offset;
 
-    assert(lft >= s[i].r_lft && lft <= s[i].r_rgt);
+    // The read starts before the block set in a shared sequence
+    if(lft < 0) {
+        r.filtered() = true;
+        return false;
+    }
 
-    // If the read is contained within the block it's garbage
-    if(rgt <= s[i].r_rgt) {
+    // Find the first block that overlaps with the read
+    const ProjectionBlock * b = std::lower_bound(blocks_.begin() + p.start, bend, lft);
+    if(b == bend) {
         r.filtered() = true;
         return false;
     }
+    const ProjectionBlock * first = b;
 
-    //cout << "Read before: " << r << "\n";
-    //cout << "Blocks: " << s << "\n";
-    pos_t pos = lft;
-    r.lft() = r.lft() - s[i].r_lft + s[i].lft;
-    Cigar::iterator it = r.cigar.begin();
-    while(it != r.cigar.end()) {
-        // Skip cigar entries that don't contribute to the genomic position
+    // Emit the genomic cigar, splitting entries that cross a block end
+    // An intron is only added once we know the read continues into the next block
+    // so it is placed directly after the entry that ended on the block boundary
+    const size_t npos = static_cast<size_t>(-1);
+    size_t pending = npos;
+    size_t skips   = 0;
+    pos_t  pos     = lft;
+    buffer.clear();
+    for(Cigar::const_iterator it = r.cigar.begin(); it != r.cigar.end(); ++it) {
+        // Entries that don't contribute to the genomic position are copied as is
         if(!it->has_bases()) {
-            it++;
+            buffer.push_back(*it);
             continue;
         }
 
-        pos_t np = pos + it->len - 1;
-
-        // Need to split the entry
-        if(np > s[i].r_rgt) {
-            pos_t d = np - s[i].r_rgt;
-            it->len -= d;
-            pos += it->len;
-            Cigar::iterator p = it;
-            ++p;
-            // Insert the intron gap
-            assert((i+1) < s.size());
-            p = r.cigar.insert(p, CigarElement(s[i+1].lft - s[i].rgt - 1, REF_SKIP));
-            p++;
-
-            // Insert the remaining cigar sequence and point it to it
-            it = r.cigar.insert(p, CigarElement(d, it->op));
-
-            // Next block
-            i++;
-
-            // Don't insert an intron if the read's rgt ends at the end of this block
-        } else if(np == s[i].r_rgt && rgt > s[i].r_rgt) {
-            pos += it->len;
-            it++;
-            assert((i+1) < s.size());
-            // Insert the intron before the next cigar element
-            r.cigar.insert(it, CigarElement(s[i+1].lft - s[i].rgt - 1, REF_SKIP));
-
-            // Next block
-            i++;
-
-            // This entry does not take us past a block end so just add it to the position
-        } else {
-            pos += it->len;
-            it++;
+        if(pending != npos) {
+            buffer.insert(buffer.begin() + pending, CigarElement((b - 1)->skip, REF_SKIP));
+            pending = npos;
+            skips++;
+        }
+
+        pos_t len = it->len;
+        while(pos + len - 1 > b->r_rgt) {
+            // The read extends past the block set in a shared sequence
+            if((b + 1) == bend) {
+                r.filtered() = true;
+                return false;
+            }
+            pos_t d = b->r_rgt - pos + 1;
+            buffer.push_back(CigarElement(d, it->op));
+            buffer.push_back(CigarElement(b->skip, REF_SKIP));
+            skips++;
+            pos += d;
+            len -= d;
+            b++;
+        }
+
+        buffer.push_back(CigarElement(len, it->op));
+        pos += len;
+
+        // The entry ends on the last base of the block
+        if(pos - 1 == b->r_rgt && (b + 1) < bend) {
+            pending = buffer.size();
+            b++;
         }
-        //cout << "  Cigar iter: " << r.cigar << "\n";
     }
 
-    r.tags.set_value<int32_t>("ZJ",atoi(r.tname().c_str()));
-    r.tid() = tid2ref_[r.tid()];
+    // If the read is contained within the block it's garbage
+    if(skips == 0) {
+        r.filtered() = true;
+        return false;
+    }
+
+    r.lft() = lft + first->shift;
+    r.cigar.assign(buffer.begin(), buffer.end());
+
+    r.tags.set_value<int32_t>("ZJ", p.frag_id);
+    r.tid() = chrom2ref_[p.chrom];
     r.tname().assign(header_[r.tid()]);
-    if(s.strand() != BOTH && s.strand() != UNKNOWN){
-        r.tags.set_value<char>("XS",strand2char[s.strand()]);
+    if(p.xs != 0){
+        r.tags.set_value<char>("XS", p.xs);
     }
     return true;
 }
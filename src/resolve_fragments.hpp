@@ -19,44 +19,133 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 
 #ifndef GW_RESOLVE_SPANS_H
 #define GW_RESOLVE_SPANS_H
-#include "fragments.hpp"
+#include "fragment_db.hpp"
 #include "read.hpp"
 #include "header.hpp"
+#include "const_array.hpp"
+#include "context_image.hpp"
 #include <vector>
 namespace rnasequel {
 
 class ResolveFragments {
     public:
-        typedef std::vector<const FragmentSet *> Tid2Set;
-        typedef std::vector<int32_t>             Tid2Ref;
+        typedef std::vector<uint32_t>            Tid2Frag;
+        typedef std::vector<CigarElement>        CigarBuffer;
 
 	ResolveFragments() {
 
 	}
 
+        // Compiles the projections of a fragment database or maps them from a merge
+        // context image, the bam headers are set by the open calls below
+        void  open(const std::string & frag_db);
+        void  open(const ContextImage & img);
         template <typename T1, typename T2>
         void  open(T1 & j, T2 & r, const std::string & frag_db);
+        // Shares the projections of base, which has to outlive this, with another set of bam headers
+        template <typename T1, typename T2>
+        void  open(T1 & j, T2 & r, const ResolveFragments & base);
+        void  save(ContextImage::Writer & w) const;
         bool  resolve(BamRead &r) const;
+        // Same as above but the genomic cigar is built in a caller owned buffer
+        // set selects the block set when the sequence is shared by several block sets
+        bool  resolve(BamRead &r, CigarBuffer & buffer, size_t set = 0) const;
+
+        // Number of genomic block sets the transcriptome sequence of the read represents
+        size_t sets(const BamRead &r) const {
+            return range_(r.tid()).size;
+        }
+
         int   trim(BamRead &r, int min_exonic, int max_splice_indel) const;
-        const FragmentMap & fragment_map() { return frags_; }
+        const FragmentDB & fragment_db() const { return frags_; }
 
     private:
-        FragmentMap                        frags_;
-        Tid2Set                            tid2set_;
-        Tid2Ref                            tid2ref_;
+        // A fragment block compiled for projecting cDNA positions back onto the genome
+        struct ProjectionBlock {
+            ProjectionBlock(pos_t r_rgt, pos_t shift, pos_t skip) : r_rgt(r_rgt), shift(shift), skip(skip) { }
+
+            bool operator<(pos_t p) const {
+                return r_rgt < p;
+            }
+
+            pos_t r_rgt; // Last cDNA position of the block
+            pos_t shift; // Genomic lft - cDNA lft
+            pos_t skip;  // Size of the intron following the block
+        };
+
+        struct Projection {
+            Projection() : start(0), end(0), offset(0), frag_id(0), chrom(0), xs(0) { }
+
+            uint32_t start;
+            uint32_t end;
+            pos_t    offset;  // Position of the block set in the transcriptome sequence
+            int32_t  frag_id;
+            uint32_t chrom;   // Fragment database chromosome index
+            char     xs;
+        };
+
+        struct ProjectionRange {
+            ProjectionRange() : start(0), size(0) { }
+
+            uint32_t start;
+            uint32_t size;
+        };
+
+        // Projections are compiled per fragment record so they don't depend on the bam headers
+        void compile_();
+
+        template <typename T1, typename T2>
+        void open_headers_(T1 & j, T2 & r);
+
+        const ProjectionRange & range_(int32_t tid) const {
+            static const ProjectionRange empty;
+            // Fragments retired by a transcriptome update have no block sets
+            uint32_t f = tid2frag_[tid];
+            return f < rec2proj_.size() ? rec2proj_[f] : empty;
+        }
+
+        FragmentDB                         frags_;
+        Tid2Frag                           tid2frag_;
+        std::vector<std::string>           chroms_;
+        std::vector<int32_t>               chrom2ref_;
         std::vector<std::string>           header_;
+
+        // Owned storage when compiled from the fragment database
+        std::vector<ProjectionRange>       orec2proj_;
+        std::vector<Projection>            oprojections_;
+        std::vector<ProjectionBlock>       oblocks_;
+
+        ConstArray<ProjectionRange>        rec2proj_;
+        ConstArray<Projection>             projections_;
+        ConstArray<ProjectionBlock>        blocks_;
 };
 
 template <typename T1, typename T2>
 void ResolveFragments::open(T1 & j, T2 & r, const std::string & frag_db) {
-    frags_.init(frag_db);
-    tid2set_.resize(j.size(),NULL);
-    tid2ref_.resize(j.size(),0);
+    open(frag_db);
+    open_headers_(j, r);
+}
+
+template <typename T1, typename T2>
+void ResolveFragments::open(T1 & j, T2 & r, const ResolveFragments & base) {
+    chroms_      = base.chroms_;
+    rec2proj_    = base.rec2proj_;
+    projections_ = base.projections_;
+    blocks_      = base.blocks_;
+    open_headers_(j, r);
+}
+
+template <typename T1, typename T2>
+void ResolveFragments::open_headers_(T1 & j, T2 & r) {
+    tid2frag_.resize(j.size(),0);
     header_.resize(r.size());
-    for(size_t i = 0; i < tid2set_.size(); ++i) {
-        int32_t id = atoi(j.tname(i).c_str());
-        tid2set_[i] = &frags_[id];
-        tid2ref_[i] = r.tid(tid2set_[i]->chrom());
+    for(size_t i = 0; i < tid2frag_.size(); ++i) {
+        tid2frag_[i] = atoi(j.tname(i).c_str());
+    }
+
+    chrom2ref_.resize(chroms_.size());
+    for(size_t i = 0; i < chrom2ref_.size(); i++){
+        chrom2ref_[i] = r.tid(chroms_[i]);
     }
 
     for(size_t i = 0; i < r.size(); i++){
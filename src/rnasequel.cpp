@@ -21,6 +21,9 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include "index.hpp"
 #include "transcriptome.hpp"
 #include "merge.hpp"
+#include "prepare.hpp"
+#include "bam_concat.hpp"
+#include "fastq_rename.hpp"
 #include <iostream>
 
 using namespace std;
@@ -34,9 +37,16 @@ int main(int argc, char * argv[]){
         return rnasequel::fasta_index(argc, argv);
     }else if(cmd == "transcriptome"){
         return rnasequel::build_transcriptome(argc, argv);
+    }else if(cmd == "prepare"){
+        return rnasequel::prepare_context(argc, argv);
     }else if(cmd == "merge"){
         return rnasequel::merge_alignments(argc, argv);
+    }else if(cmd == "fragsize"){
+        return rnasequel::fragment_sizes(argc, argv);
+    }else if(cmd == "concat"){
+        return rnasequel::concat_bams(argc, argv);
     }else if(cmd == "rename"){
+        return rnasequel::rename_fastq(argc, argv);
     }else{
         // print help
         cout << "Program: rnasequel\n"
@@ -46,8 +56,11 @@ int main(int argc, char * argv[]){
              << "Commands:\n"
              << "  index            Reference genome fasta file indexing\n"
              << "  transcriptome    Transcriptome index generation\n"
+             << "  prepare          Merge context image generation (annotation, junctions and fragments)\n"
+             << "  fragsize         Fragment size distribution estimation and combining\n"
              << "  merge            Reference / Transcriptome alignment merging\n"
-             //<< "  rename           Rename fastq files to lexicographically ordered integers\n"
+             << "  concat           Bam file concatenation without recompressing\n"
+             << "  rename           Rename fastq files to lexicographically ordered integers\n"
              << "\n";
 
         return 1;
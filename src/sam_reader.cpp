@@ -0,0 +1,522 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sam_reader.hpp"
+#include <iostream>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+using namespace std;
+using namespace rnasequel;
+
+namespace {
+
+const size_t CORE_SIZE = 36;
+
+// Bam 4 bit base codes
+struct NT16 {
+    NT16() {
+        memset(code, 15, sizeof(code));
+        const char * bases = "=ACMGRSVTWYHKDBN";
+        for(int i = 0; i < 16; i++){
+            code[static_cast<uint8_t>(bases[i])] = i;
+            code[static_cast<uint8_t>(tolower(bases[i]))] = i;
+        }
+    }
+    uint8_t code[256];
+};
+
+const NT16 nt16;
+
+int8_t cigar_op(char c) {
+    switch(c){
+        case 'M': return 0;
+        case 'I': return 1;
+        case 'D': return 2;
+        case 'N': return 3;
+        case 'S': return 4;
+        case 'H': return 5;
+        case 'P': return 6;
+        case '=': return 7;
+        case 'X': return 8;
+    }
+    return -1;
+}
+
+// Signed integer in [s, e), p is left after it
+bool parse_int(const char * s, const char * e, const char * & p, int64_t & v) {
+    p = s;
+    bool neg = p < e && *p == '-';
+    if(neg || (p < e && *p == '+')) p++;
+    const char * d = p;
+    v = 0;
+    // Longer numbers are left unparsed so they can't overflow v
+    while(p < e && *p >= '0' && *p <= '9' && p - d < 18) v = v * 10 + (*p++ - '0');
+    if(neg) v = -v;
+    return p > d;
+}
+
+void put32(uint8_t * p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+int32_t get32(const uint8_t * p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+[[noreturn]] void bad_record(const char * s, const char * e, const char * why) {
+    fail(string("parsing the sam record (") + why + "): " + string(s, std::min<size_t>(e - s, 200)));
+}
+
+};
+
+SamReader::SamReader(const std::string & file) 
+    : file_(file), fd_(-1), header_(NULL), unaligned_("*"), slots_(2 * parsers() + 1), parse_seq_(0), use_seq_(0), 
+      last_seq_(std::numeric_limits<size_t>::max()), current_(NULL), done_(false), stop_(false), data_(bam_init1()) 
+{
+    fd_ = file == "-" ? 0 : ::open(file.c_str(), O_RDONLY);
+    if(fd_ < 0) {
+        bam_destroy1(data_);
+        fail("opening the sam file `" + file + "` for reading");
+    }
+    if(::pipe(wake_) != 0) {
+        if(fd_ > 0) ::close(fd_);
+        bam_destroy1(data_);
+        fail("creating a pipe for reading the sam file `" + file + "`");
+    }
+    try {
+        read_header_();
+    } catch(const Failure &) {
+        if(fd_ > 0) ::close(fd_);
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+        bam_destroy1(data_);
+        throw;
+    }
+
+    reader_thread_ = boost::thread(&SamReader::reader_, this);
+    for(size_t i = 0; i < parsers(); i++){
+        parser_threads_.push_back(boost::thread(&SamReader::parser_, this));
+    }
+}
+
+SamReader::~SamReader() {
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+        stop_ = true;
+        cond_.notify_all();
+    }
+    // The reader thread can be waiting on an idle pipe or terminal
+    ssize_t w = ::write(wake_[1], "", 1);
+    (void)w;
+    reader_thread_.join();
+    for(size_t i = 0; i < parser_threads_.size(); i++) parser_threads_[i].join();
+    if(fd_ > 0) ::close(fd_);
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+
+    for(int32_t i = 0; i < header_->n_targets; i++) free(header_->target_name[i]);
+    free(header_->target_name);
+    free(header_->target_len);
+    free(header_->text);
+    free(header_);
+    bam_destroy1(data_);
+}
+
+size_t SamReader::fill_(std::vector<char> & buf, size_t n, bool all) {
+    size_t start = buf.size();
+    buf.resize(start + n);
+    size_t got = 0;
+    while(got < n){
+        pollfd fds[2] = { { fd_, POLLIN, 0 }, { wake_[0], POLLIN, 0 } };
+        if(::poll(fds, 2, -1) < 0){
+            if(errno == EINTR) continue;
+            break;
+        }
+        // The reader is being destroyed
+        if(fds[1].revents != 0) break;
+        ssize_t r = ::read(fd_, &buf[start + got], n - got);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        got += r;
+        if(!all) break;
+    }
+    buf.resize(start + got);
+    return got;
+}
+
+void SamReader::read_header_() {
+    std::string text;
+    size_t pos = 0;
+    bool   eof = false;
+    while(true){
+        if(pos == carry_.size() && (eof || fill_(carry_, 1 << 16, false) == 0)) break;
+        if(carry_[pos] != '@') break;
+        std::vector<char>::iterator nl = std::find(carry_.begin() + pos, carry_.end(), '\n');
+        if(nl == carry_.end() && !eof){
+            eof = fill_(carry_, 1 << 16, false) == 0;
+            continue;
+        }
+        std::string line(carry_.begin() + pos, nl);
+        if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if(line.compare(0, 4, "@SQ\t") == 0) add_target_(line);
+        text += line;
+        text += '\n';
+        pos = nl == carry_.end() ? carry_.size() : nl - carry_.begin() + 1;
+    }
+    carry_.erase(carry_.begin(), carry_.begin() + pos);
+
+    header_ = static_cast<bam_header_t *>(calloc(1, sizeof(bam_header_t)));
+    header_->n_targets   = names_.size();
+    header_->target_name = static_cast<char **>(calloc(names_.size() + 1, sizeof(char *)));
+    header_->target_len  = static_cast<uint32_t *>(calloc(names_.size() + 1, sizeof(uint32_t)));
+    header_->l_text      = text.size();
+    header_->text        = static_cast<char *>(malloc(text.size() + 1));
+    memcpy(header_->text, text.c_str(), text.size() + 1);
+    for(size_t i = 0; i < names_.size(); i++){
+        header_->target_name[i] = strdup(names_[i].c_str());
+        header_->target_len[i]  = lens_[i];
+    }
+}
+
+void SamReader::add_target_(const std::string & line) {
+    size_t sn = line.find("\tSN:");
+    if(sn == string::npos) {
+        fail("the sam header line `" + line + "` doesn't have a sequence name");
+    }
+    size_t end = line.find('\t', sn + 4);
+    std::string name = line.substr(sn + 4, end == string::npos ? string::npos : end - sn - 4);
+    size_t ln = line.find("\tLN:");
+    tids_.insert(std::make_pair(name, static_cast<int32_t>(names_.size())));
+    names_.push_back(name);
+    lens_.push_back(ln == string::npos ? 0 : strtoul(line.c_str() + ln + 4, NULL, 10));
+}
+
+void SamReader::reader_() {
+    for(size_t seq = 0; ; seq++){
+        Chunk & c = slots_[seq % slots_.size()];
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            while(!stop_ && c.state != EMPTY) cond_.wait(lock);
+            if(stop_) return;
+        }
+
+        c.text.swap(carry_);
+        carry_.clear();
+        // Chunks end with a whole line, the rest is kept for the next one
+        bool   eof = false;
+        size_t end = 0;
+        while(!eof && end == 0){
+            eof = fill_(c.text, CHUNK) < CHUNK;
+            for(end = c.text.size(); end > 0 && c.text[end - 1] != '\n'; end--) ;
+        }
+        if(!eof){
+            carry_.assign(c.text.begin() + end, c.text.end());
+            c.text.resize(end);
+        }
+
+        boost::mutex::scoped_lock lock(mtx_);
+        if(stop_) return;
+        c.eof   = eof;
+        c.state = READ;
+        if(eof) last_seq_ = seq;
+        cond_.notify_all();
+        if(eof) return;
+    }
+}
+
+void SamReader::parser_() {
+    std::string name;
+    while(true){
+        size_t seq;
+        {
+            boost::mutex::scoped_lock lock(mtx_);
+            while(!stop_ && parse_seq_ <= last_seq_ && slots_[parse_seq_ % slots_.size()].state != READ) cond_.wait(lock);
+            if(stop_ || parse_seq_ > last_seq_) return;
+            seq = parse_seq_++;
+            slots_[seq % slots_.size()].state = PARSING;
+        }
+
+        Chunk & c = slots_[seq % slots_.size()];
+        {
+            // A bad record is reported by get_struct when it reaches the chunk
+            FailScope scope;
+            c.error.clear();
+            try {
+                parse_(c, name);
+            } catch(const Failure & e) {
+                c.error = e.what();
+            }
+        }
+
+        boost::mutex::scoped_lock lock(mtx_);
+        c.state = PARSED;
+        cond_.notify_all();
+    }
+}
+
+void SamReader::parse_(Chunk & c, std::string & name) {
+    c.records.clear();
+    c.records.reserve(c.text.size());
+    c.next = 0;
+    const char * p   = c.text.empty() ? NULL : &c.text[0];
+    const char * end = p + c.text.size();
+    while(p < end){
+        const char * nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char * e  = nl == NULL ? end : nl;
+        if(e > p && e[-1] == '\r') e--;
+        if(e > p && *p != '@') parse_line_(p, e, c.records, name);
+        p = nl == NULL ? end : nl + 1;
+    }
+}
+
+int32_t SamReader::tid_(const char * s, const char * e, std::string & name) const {
+    if(e - s == 1 && *s == '*') return -1;
+    name.assign(s, e);
+    std::unordered_map<std::string, int32_t>::const_iterator it = tids_.find(name);
+    if(it == tids_.end()) {
+        fail("the reference " + name + " isn't in the sam header of " + file_);
+    }
+    return it->second;
+}
+
+void SamReader::parse_line_(const char * s, const char * e, std::vector<uint8_t> & out, std::string & name) {
+    // The 11 mandatory fields, the tags follow them
+    const char * f[11], * fe[11];
+    const char * p = s;
+    for(size_t i = 0; i < 11; i++){
+        const char * t = static_cast<const char *>(memchr(p, '\t', e - p));
+        if(t == NULL && i < 10) bad_record(s, e, "missing fields");
+        f[i]  = p;
+        fe[i] = t == NULL ? e : t;
+        p     = t == NULL ? e : t + 1;
+    }
+    const char * tags = p;
+
+    const char * q;
+    int64_t flag, pos, mapq, mpos, tlen;
+    if(!parse_int(f[1], fe[1], q, flag) || !parse_int(f[3], fe[3], q, pos) || !parse_int(f[4], fe[4], q, mapq) ||
+       !parse_int(f[7], fe[7], q, mpos) || !parse_int(f[8], fe[8], q, tlen)){
+        bad_record(s, e, "bad number");
+    }
+    int32_t tid  = tid_(f[2], fe[2], name);
+    int32_t mtid = (fe[6] - f[6] == 1 && *f[6] == '=') ? tid : tid_(f[6], fe[6], name);
+
+    size_t start = out.size();
+    out.resize(start + CORE_SIZE);
+
+    size_t l_qname = fe[0] - f[0];
+    if(l_qname > 254) bad_record(s, e, "read name longer than 254 characters");
+    out.insert(out.end(), f[0], fe[0]);
+    out.push_back(0);
+
+    // Cigar
+    uint32_t n_cigar = 0;
+    int32_t  rlen    = 0;
+    const char * c = f[5], * ce = fe[5];
+    if(!(ce - c == 1 && *c == '*')){
+        while(c < ce){
+            int64_t len;
+            if(!parse_int(c, ce, c, len) || c == ce) bad_record(s, e, "bad cigar");
+            int8_t op = cigar_op(*c++);
+            if(op < 0) bad_record(s, e, "bad cigar operation");
+            uint8_t v[4];
+            put32(v, (static_cast<uint32_t>(len) << 4) | op);
+            out.insert(out.end(), v, v + 4);
+            if(op == 0 || op == 2 || op == 3 || op == 7 || op == 8) rlen += len;
+            n_cigar++;
+        }
+        if(n_cigar > 0xffff) bad_record(s, e, "more than 65535 cigar operations");
+    }
+
+    // Sequence and qualities
+    const char * sq = f[9], * sqe = fe[9];
+    const char * ql = f[10], * qle = fe[10];
+    size_t l_seq = (sqe - sq == 1 && *sq == '*') ? 0 : sqe - sq;
+    size_t sp = out.size();
+    out.resize(sp + (l_seq + 1) / 2 + l_seq, 0);
+    uint8_t * o = &out[sp];
+    for(size_t i = 0; i < l_seq; i++){
+        o[i >> 1] |= nt16.code[static_cast<uint8_t>(sq[i])] << ((~i & 1) << 2);
+    }
+    o += (l_seq + 1) / 2;
+    if(qle - ql == 1 && *ql == '*'){
+        memset(o, 0xff, l_seq);
+    }else{
+        if(static_cast<size_t>(qle - ql) != l_seq) bad_record(s, e, "sequence and quality lengths differ");
+        for(size_t i = 0; i < l_seq; i++) o[i] = ql[i] - 33;
+    }
+
+    // Optional tags TAG:TYPE:VALUE
+    p = tags;
+    while(p < e){
+        const char * t  = static_cast<const char *>(memchr(p, '\t', e - p));
+        const char * te = t == NULL ? e : t;
+        if(te - p < 5 || p[2] != ':' || p[4] != ':') bad_record(s, e, "bad tag");
+        const char * v = p + 5;
+        char type = p[3];
+        out.push_back(p[0]);
+        out.push_back(p[1]);
+        if(type == 'A'){
+            out.push_back('A');
+            out.push_back(*v);
+        }else if(type == 'i'){
+            int64_t x;
+            if(!parse_int(v, te, q, x) || q != te) bad_record(s, e, "bad integer tag");
+            if(x < std::numeric_limits<int32_t>::min() || x > std::numeric_limits<uint32_t>::max()){
+                bad_record(s, e, "integer tag out of range");
+            }
+            uint8_t b[4];
+            put32(b, static_cast<uint32_t>(x));
+            out.push_back(x > std::numeric_limits<int32_t>::max() ? 'I' : 'i');
+            out.insert(out.end(), b, b + 4);
+        }else if(type == 'f'){
+            float x = strtof(std::string(v, te).c_str(), NULL);
+            uint8_t b[4];
+            memcpy(b, &x, 4);
+            out.push_back('f');
+            out.insert(out.end(), b, b + 4);
+        }else if(type == 'Z' || type == 'H'){
+            out.push_back(type);
+            out.insert(out.end(), v, te);
+            out.push_back(0);
+        }else if(type == 'B'){
+            // B:t,v1,v2,... is the sub type, the number of values and the values
+            size_t esize = v < te ? BamTag::array_size(*v) : 0;
+            if(esize == 0) bad_record(s, e, "bad array tag type");
+            out.push_back('B');
+            out.push_back(*v);
+            size_t cnt = out.size();
+            out.resize(cnt + 4);
+            uint32_t n = 0;
+            for(const char * a = v + 1; a < te; n++){
+                if(*a++ != ',') bad_record(s, e, "bad array tag");
+                const char * ae = static_cast<const char *>(memchr(a, ',', te - a));
+                if(ae == NULL) ae = te;
+                uint8_t b[4];
+                if(*v == 'f'){
+                    float x = strtof(std::string(a, ae).c_str(), NULL);
+                    memcpy(b, &x, 4);
+                }else{
+                    int64_t x;
+                    if(!parse_int(a, ae, q, x) || q != ae) bad_record(s, e, "bad array tag value");
+                    int64_t lo = 0, hi = (1LL << (8 * esize)) - 1;
+                    if(islower(*v)){
+                        lo = -(1LL << (8 * esize - 1));
+                        hi = (1LL << (8 * esize - 1)) - 1;
+                    }
+                    if(x < lo || x > hi) bad_record(s, e, "array tag value out of range");
+                    uint32_t u = static_cast<uint32_t>(x);
+                    memcpy(b, &u, 4);
+                }
+                out.insert(out.end(), b, b + esize);
+                a = ae;
+            }
+            put32(&out[cnt], n);
+        }else{
+            bad_record(s, e, "unknown tag type");
+        }
+        p = t == NULL ? e : t + 1;
+    }
+
+    pos--;
+    mpos--;
+    uint32_t bin = pos < 0 ? 4680 : bam_reg2bin(pos, pos + std::max<int32_t>(rlen, 1));
+    uint8_t * core = &out[start];
+    put32(core,      out.size() - start - 4);
+    put32(core + 4,  tid);
+    put32(core + 8,  pos);
+    put32(core + 12, (bin << 16) | ((mapq & 0xff) << 8) | ((l_qname + 1) & 0xff));
+    put32(core + 16, (static_cast<uint32_t>(flag) << 16) | n_cigar);
+    put32(core + 20, l_seq);
+    put32(core + 24, mtid);
+    put32(core + 28, mpos);
+    put32(core + 32, tlen);
+}
+
+bool SamReader::get_struct(bam1_t * b) {
+    if(done_) return false;
+    while(current_ == NULL || current_->next == current_->records.size()){
+        boost::mutex::scoped_lock lock(mtx_);
+        if(current_ != NULL){
+            bool eof = current_->eof;
+            current_->state = EMPTY;
+            current_ = NULL;
+            use_seq_++;
+            cond_.notify_all();
+            if(eof){
+                done_ = true;
+                return false;
+            }
+        }
+        Chunk & c = slots_[use_seq_ % slots_.size()];
+        while(c.state != PARSED) cond_.wait(lock);
+        current_ = &c;
+        if(!c.error.empty()){
+            std::string error = c.error;
+            done_ = true;
+            lock.unlock();
+            fail(error);
+        }
+    }
+
+    const uint8_t * r = &current_->records[current_->next];
+    size_t bsize = get32(r);
+    current_->next += 4 + bsize;
+
+    bam1_core_t & core = b->core;
+    uint32_t bmn  = get32(r + 12);
+    uint32_t fnc  = get32(r + 16);
+    core.tid      = get32(r + 4);
+    core.pos      = get32(r + 8);
+    core.bin      = bmn >> 16;
+    core.qual     = (bmn >> 8) & 0xff;
+    core.l_qname  = bmn & 0xff;
+    core.flag     = fnc >> 16;
+    core.n_cigar  = fnc & 0xffff;
+    core.l_qseq   = get32(r + 20);
+    core.mtid     = get32(r + 24);
+    core.mpos     = get32(r + 28);
+    core.isize    = get32(r + 32);
+
+    b->data_len = bsize - (CORE_SIZE - 4);
+    if(b->m_data < b->data_len){
+        b->m_data = b->data_len;
+        kroundup32(b->m_data);
+        b->data = static_cast<uint8_t *>(realloc(b->data, b->m_data));
+    }
+    memcpy(b->data, r + CORE_SIZE, b->data_len);
+    b->l_aux = b->data_len - core.l_qname - 4 * core.n_cigar - (core.l_qseq + 1) / 2 - core.l_qseq;
+    return true;
+}
+
+bool SamReader::get_read(BamRead & r) {
+    if(!get_struct(data_)) return false;
+    r.load_from_struct(data_, data_->core.tid >= 0 ? names_[data_->core.tid] : unaligned_);
+    return true;
+}
@@ -0,0 +1,134 @@
+/*
+Copyright (C) 2014 Gavin Wilson, Lincoln Stein
+
+This file is part of RNASequel.
+
+RNASequel is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RNASequel is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GW_SAM_READER_HPP
+#define GW_SAM_READER_HPP
+
+#include "read.hpp"
+#include "failure.hpp"
+#include <bam/bam.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace rnasequel {
+
+/**
+ * SAM text reader for files, pipes and stdin ("-")
+ *
+ * A reader thread cuts the input into chunks of whole lines and parsers()
+ * threads encode the chunks into bam records in parallel, the records are
+ * handed out in the input order. Fields are split with memchr and the cigar,
+ * sequence, qualities and tags are encoded without going through samtools.
+ * Every reader starts 1 + parsers() threads, set_parsers() is called before
+ * any reader is opened so the threads fit the command's thread count.
+ */
+class SamReader {
+    public:
+        static const size_t CHUNK   = 1UL << 22;
+        static const size_t PARSERS = 2;
+
+        // Parser threads of each reader, between 1 and PARSERS
+        static size_t parsers() {
+            return parsers_();
+        }
+
+        static void set_parsers(size_t n) {
+            parsers_() = std::max<size_t>(std::min<size_t>(n, static_cast<size_t>(PARSERS)), 1);
+        }
+
+        SamReader(const std::string & file);
+        ~SamReader();
+
+        // Header built from the @ lines, it's owned by the reader
+        bam_header_t * header() {
+            return header_;
+        }
+
+        bool get_struct(bam1_t * b);
+        bool get_read(BamRead & r);
+
+    private:
+        SamReader(const SamReader & s);
+        SamReader & operator=(const SamReader & s);
+
+        static size_t & parsers_() {
+            static size_t parsers = PARSERS;
+            return parsers;
+        }
+
+        enum State { EMPTY, READ, PARSING, PARSED };
+
+        struct Chunk {
+            Chunk() : state(EMPTY), eof(false), next(0) { }
+
+            std::vector<char>       text;
+            std::vector<uint8_t>    records;
+            // The parsing error of the chunk, empty if it's fine
+            std::string             error;
+            State                   state;
+            bool                    eof;
+            size_t                  next;
+        };
+
+        // Appends up to n bytes, all is false to return after the first read that gets any
+        size_t fill_(std::vector<char> & buf, size_t n, bool all = true);
+        void read_header_();
+        void add_target_(const std::string & line);
+
+        void reader_();
+        void parser_();
+        void parse_(Chunk & c, std::string & name);
+        void parse_line_(const char * s, const char * e, std::vector<uint8_t> & out, std::string & name);
+        int32_t tid_(const char * s, const char * e, std::string & name) const;
+
+        std::string                                 file_;
+        int                                         fd_;
+        // Wakes the reader thread out of poll when the reader is destroyed
+        int                                         wake_[2];
+        bam_header_t                              * header_;
+        std::vector<std::string>                    names_;
+        std::vector<uint32_t>                       lens_;
+        std::unordered_map<std::string, int32_t>    tids_;
+        std::string                                 unaligned_;
+        // Input read past the last whole line of a chunk
+        std::vector<char>                           carry_;
+
+        std::vector<Chunk>                          slots_;
+        size_t                                      parse_seq_;
+        size_t                                      use_seq_;
+        size_t                                      last_seq_;
+        Chunk                                     * current_;
+        bool                                        done_;
+        bool                                        stop_;
+        boost::mutex                                mtx_;
+        boost::condition_variable                   cond_;
+        boost::thread                               reader_thread_;
+        std::vector<boost::thread>                  parser_threads_;
+        bam1_t                                    * data_;
+};
+
+};
+
+#endif
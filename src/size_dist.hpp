@@ -49,7 +49,8 @@ class SizeDist{
         // Write the distribution to a ostream
         void save(std::ostream & f);
         void save_normed(std::ostream & f);
-	void load(std::istream & f);
+	// The cutoff is reported to log
+	void load(std::istream & f, std::ostream & log = std::cout);
 
         /** Get the normalized (between 0.0 and 1.0) height of the column
          * for a fragment with size s
@@ -71,10 +72,12 @@ class SizeDist{
 	    return count_;
 	}
 
+	// Adds the raw counts, a loaded distribution can cover fewer sizes than this one,
+	// sizes past the maximum are dropped and not counted like add_fragment drops them
 	SizeDist & operator+=(const SizeDist & sd){
-	    count_ += sd.count();
-	    for(size_t i = 0; i < max_sz_; i++){
+	    for(size_t i = 0; i < dist_.size() && i < sd.dist_.size(); i++){
 		dist_[i] += sd.dist(i);
+		count_   += sd.dist(i);
 	    }
 	    return *this;
 	}
@@ -82,7 +85,7 @@ class SizeDist{
 	/**
 	 * Normalize the distribution's column heights to [0,1]
 	 */
-	void normalize();
+	void normalize(std::ostream & log = std::cout);
         double max_height() const {
             return max_height_;
         }
@@ -125,7 +128,7 @@ inline void SizeDist::save_normed(std::ostream & f){
     }
 }
 
-inline void SizeDist::load(std::istream & f){
+inline void SizeDist::load(std::istream & f, std::ostream & log){
     std::string line;
     // read the header line
     getline(f, line);
@@ -150,7 +153,7 @@ inline void SizeDist::load(std::istream & f){
         count_ += c;
     }
     if(cutoff_ == 0) cutoff_ = normed_.size() - 1;
-    std::cout << "Read fragment size distribution.  Size cutoff = " << cutoff_ << " max_height = " << max_height_ << "\n";
+    log << "Read fragment size distribution.  Size cutoff = " << cutoff_ << " max_height = " << max_height_ << "\n";
     //normalize();
 }
 
@@ -163,8 +166,8 @@ inline void SizeDist::add_fragment(unsigned int sz){
     count_++;
 }
 
-inline void SizeDist::normalize(){
-    size_t sum = std::accumulate(dist_.begin(),dist_.end(),0); 
+inline void SizeDist::normalize(std::ostream & log){
+    size_t sum = std::accumulate(dist_.begin(),dist_.end(),static_cast<size_t>(0)); 
     normed_.resize(dist_.size(),0);
     double x = 0;
     max_height_ = 0;
@@ -177,7 +180,7 @@ inline void SizeDist::normalize(){
             max_height_ = std::max(normed_[i], max_height_);
         }
     }
-    std::cout << "Read fragment size distribution.  Size cutoff = " << cutoff_ << " max_height = " << max_height_ << "\n";
+    log << "Read fragment size distribution.  Size cutoff = " << cutoff_ << " max_height = " << max_height_ << "\n";
 }
 
 };
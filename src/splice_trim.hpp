@@ -24,6 +24,8 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include "types.hpp"
 #include "read.hpp"
+#include "const_array.hpp"
+#include "context_image.hpp"
 namespace rnasequel {
 
 class SpliceTrimmer {
@@ -33,24 +35,67 @@ class SpliceTrimmer {
         }
 
         typedef std::vector<unsigned int> splice_sites;
+        typedef ConstArray<unsigned int>  site_view;
         struct ref_sites { 
-            splice_sites lfts;
-            splice_sites rgts;
+            splice_sites olfts;
+            splice_sites orgts;
+            site_view    lfts;
+            site_view    rgts;
+        };
+
+        // Site ranges of a reference in a merge context image
+        struct ImageRef {
+            uint32_t name;
+            uint32_t lstart;
+            uint32_t lsize;
+            uint32_t rstart;
+            uint32_t rsize;
         };
 
         void add_junction(const std::string & ref, unsigned int lft, unsigned int rgt){
-            refs_[ref].lfts.push_back(lft);
-            refs_[ref].rgts.push_back(rgt);
+            refs_[ref].olfts.push_back(lft);
+            refs_[ref].orgts.push_back(rgt);
         }
 
         void merge() {
             for(auto & p : refs_){
-                std::sort(p.second.lfts.begin(), p.second.lfts.end());
-                auto it = std::unique(p.second.lfts.begin(), p.second.lfts.end());
-                p.second.lfts.resize(std::distance(p.second.lfts.begin(), it));
-                std::sort(p.second.rgts.begin(), p.second.rgts.end());
-                it = std::unique(p.second.rgts.begin(), p.second.rgts.end());
-                p.second.rgts.resize(std::distance(p.second.rgts.begin(), it));
+                std::sort(p.second.olfts.begin(), p.second.olfts.end());
+                auto it = std::unique(p.second.olfts.begin(), p.second.olfts.end());
+                p.second.olfts.resize(std::distance(p.second.olfts.begin(), it));
+                std::sort(p.second.orgts.begin(), p.second.orgts.end());
+                it = std::unique(p.second.orgts.begin(), p.second.orgts.end());
+                p.second.orgts.resize(std::distance(p.second.orgts.begin(), it));
+                p.second.lfts = site_view(p.second.olfts);
+                p.second.rgts = site_view(p.second.orgts);
+            }
+        }
+
+        // Stores the merged sites in a merge context image or maps them from one
+        void save(ContextImage::Writer & w) const {
+            std::vector<ImageRef>     refs;
+            std::vector<unsigned int> sites;
+            for(auto & p : refs_){
+                ImageRef r;
+                r.name   = w.name(p.first);
+                r.lstart = sites.size();
+                r.lsize  = p.second.lfts.size();
+                sites.insert(sites.end(), p.second.lfts.begin(), p.second.lfts.end());
+                r.rstart = sites.size();
+                r.rsize  = p.second.rgts.size();
+                sites.insert(sites.end(), p.second.rgts.begin(), p.second.rgts.end());
+                refs.push_back(r);
+            }
+            w.add(ContextImage::TRIM_REFS, refs);
+            w.add(ContextImage::TRIM_SITES, sites);
+        }
+
+        void load(const ContextImage & img){
+            ConstArray<ImageRef> refs  = img.section<ImageRef>(ContextImage::TRIM_REFS);
+            site_view            sites = img.section<unsigned int>(ContextImage::TRIM_SITES);
+            for(size_t i = 0; i < refs.size(); i++){
+                ref_sites & r = refs_[img.name(refs[i].name)];
+                r.lfts = site_view(sites.data() + refs[i].lstart, refs[i].lsize);
+                r.rgts = site_view(sites.data() + refs[i].rstart, refs[i].rsize);
             }
         }
 
@@ -83,7 +128,7 @@ class SpliceTrimmer {
         }
 
     private:
-        unsigned int count_bases_(unsigned int p, const splice_sites & sites) const {
+        unsigned int count_bases_(unsigned int p, const site_view & sites) const {
             auto it = std::lower_bound(sites.begin(), sites.end(), p);
             //std::cout << "  p = " << p << " lower bound: " << (it == sites.end() ? -1 : *it) << "\n";
             if(it == sites.end() || (*it - p) > min_dist_) return 0;
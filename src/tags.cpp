@@ -70,13 +70,18 @@ const uint8_t * BamTag::set_data(const uint8_t * x) {
         x += 8;
         break;
 
-    case 'H':
-	cout << "Error! Hex tags aren't currently supported! converting to a string\n";
-	_type = 'Z';
-        _s.assign((char*)x);
-        x += _s.length() + 1;
-	break;	
+    case 'B':
+        // Arrays are kept as they're stored, the sub type, the count and the values
+        {
+            uint32_t n;
+            memcpy(&n, x + 1, 4);
+            size_t len = 5 + n * array_size(x[0]);
+            _s.assign((char*)x, len);
+            x += len;
+        }
+        break;
 
+    case 'H':
     case 'Z':
         _s.assign((char*)x);
         x += _s.length() + 1;
@@ -20,6 +20,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <bam/bam.h>
 #include <stdint.h>
 #include <string>
+#include <cstring>
 #include <cctype>
 #include <list>
 #include <cassert>
@@ -64,7 +65,7 @@ class BamTag {
         }
 
         void clear() {
-            if(_type == 'Z' || _type == 'H') _s.clear();
+            if(_type == 'Z' || _type == 'H' || _type == 'B') _s.clear();
             else                             _s.assign(8,0);
         }
 
@@ -78,6 +79,16 @@ class BamTag {
 
         const uint8_t * set_data(const uint8_t * x);
 
+        // Bytes of a B (array) value of the sub type, 0 for an unknown type
+        static size_t array_size(char type) {
+            switch(type) {
+                case 'c': case 'C': return 1;
+                case 's': case 'S': return 2;
+                case 'i': case 'I': case 'f': return 4;
+            }
+            return 0;
+        }
+
         uint8_t *       fill_data(uint8_t * x) const;
 
         friend std::ostream& operator<< (std::ostream &os, const BamTag &t);
@@ -227,7 +238,7 @@ inline double & BamTag::as() {
 
 template <>
 inline std::string & BamTag::as() {
-    assert(type() == 'Z');
+    assert(type() == 'Z' || type() == 'H');
     return _s;
 }
 
@@ -257,7 +268,7 @@ inline const char & BamTag::as() const {
 
 template <>
 inline const std::string & BamTag::as() const {
-    assert(type() == 'Z');
+    assert(type() == 'Z' || type() == 'H');
     return _s;
 }
 
@@ -298,6 +309,8 @@ inline size_t BamTag::size() const {
 	case 'Z':
 	case 'H':
 	    return _s.length() + 1; // because it should be null terminated
+	case 'B':
+	    return _s.length();
 	case 'd':
 	    return 8;
 	case 'i':
@@ -326,6 +339,28 @@ inline std::ostream& operator<< (std::ostream &os, const BamTag &t) {
         break;
     case 'd':
         os << "d:" << t.as<double>();
+        break;
+    case 'B':
+        {
+            char sub = t._s[0];
+            uint32_t n;
+            memcpy(&n, &t._s[1], 4);
+            os << "B:" << sub;
+            const char * v = t._s.c_str() + 5;
+            for(uint32_t i = 0; i < n; i++, v += BamTag::array_size(sub)) {
+                os << ",";
+                switch(sub) {
+                    case 'c': os << (int)*(const int8_t*)v;   break;
+                    case 'C': os << (int)*(const uint8_t*)v;  break;
+                    case 's': os << *(const int16_t*)v;       break;
+                    case 'S': os << *(const uint16_t*)v;      break;
+                    case 'i': os << *(const int32_t*)v;       break;
+                    case 'I': os << *(const uint32_t*)v;      break;
+                    case 'f': os << *(const float*)v;         break;
+                }
+            }
+        }
+        break;
     }
     return os;
 }
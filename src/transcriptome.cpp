@@ -25,11 +25,14 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/program_options.hpp>
 #include <string>
 #include <iostream>
-#include <unordered_set>
+#include "distinct_counter.hpp"
+#include <unordered_map>
+#include <boost/thread/thread.hpp>
 #include "gtf.hpp"
 #include "seed_iterator.hpp"
 #include "reader.hpp"
 #include "timer.hpp"
+#include "binary_io.hpp"
 
 namespace po = boost::program_options;
 
@@ -38,22 +41,9 @@ using namespace rnasequel;
 
 class SpliceSiteStrand {
     public:
-        struct splice_strand {
-            splice_strand() : tid(-1), pos(0) {
-
-            }
-
-            splice_strand(int tid, unsigned int pos) : tid(tid), pos(pos) {
-
-            }
-
-            int          tid;
-            unsigned int pos;
-
-            bool operator<(const splice_strand & s) const {
-                return tid < s.tid || (tid == s.tid && pos < s.pos);
-            }
-        };
+        static uint64_t splice_strand(unsigned int tid, unsigned int pos) {
+            return (static_cast<uint64_t>(tid) << 32) | pos;
+        }
 
         void add_junction(const Junction & j){ 
             auto ret_lft = lfts_.insert(make_pair(splice_strand(j.tid, j.lft), j.strand));
@@ -83,8 +73,8 @@ class SpliceSiteStrand {
         }
 
     private:
-        std::map<splice_strand, Strand> lfts_;
-        std::map<splice_strand, Strand> rgts_;
+        std::unordered_map<uint64_t, Strand> lfts_;
+        std::unordered_map<uint64_t, Strand> rgts_;
 };
 
 union SpliceSiteType {
@@ -145,22 +135,26 @@ class SpliceSites {
 	}
 
 	SpliceSiteType find(unsigned int pos) const {
-	   std::map<unsigned int, SpliceSiteType>::const_iterator it = sites_.find(pos);
+	   std::unordered_map<unsigned int, SpliceSiteType>::const_iterator it = sites_.find(pos);
 	   if(it == sites_.end()) return SpliceSiteType();
 	   return it->second;
 	}
 
     private:
-	std::map<unsigned int, SpliceSiteType> sites_;
+	std::unordered_map<unsigned int, SpliceSiteType> sites_;
 };
 
+// Splice sites indexed by the reference tid
 class SpliceSiteMap {
     public:
-	typedef std::map<std::string, SpliceSites> ChromMap;
+	typedef std::vector<SpliceSites> ChromMap;
 
-	void build_from_model(const Model & m){
+	void build_from_model(const Model & m, const FastaIndex & fi){
+	    sites_.resize(fi.size());
 	    for(Model::const_iterator it = m.begin(); it != m.end(); it++){
-		SpliceSites & ptr = sites_[it->first];
+		FastaIndex::const_iterator fit = fi.get_entry(it->first);
+		if(fit == fi.end()) continue;
+		SpliceSites & ptr = sites_[fit->tid];
 		const Model::gene_list & g = it->second;
 		for(size_t i = 0; i < g.size(); i++){
 		    for(size_t j = 0; j < g[i].transcripts().size(); j++){
@@ -174,12 +168,11 @@ class SpliceSiteMap {
 	    }
 	}
 
-	SpliceSiteType find(const std::string & chrom, unsigned int pos) const {
-	    ChromMap::const_iterator it = sites_.find(chrom);
-	    if(it == sites_.end()){
+	SpliceSiteType find(unsigned int tid, unsigned int pos) const {
+	    if(tid >= sites_.size()){
 		return SpliceSiteType();
 	    }
-	    return it->second.find(pos);
+	    return sites_[tid].find(pos);
 	}
 
     private:
@@ -243,10 +236,14 @@ void tx_init_options(int argc, char *argv[], po::variables_map & vm) {
     ("ref,r", po::value< string >(), "Reference sequence fasta file")
     ("out,o", po::value< string >(), "Output prefix")
     ("gtf,g", po::value< string >(), "Gene annotation GTF file (optional)")
+    ("gtf-cache", po::value< string >(), "Parsed annotation cache, loaded instead of the GTF when it matches and written after parsing it (default <gtf>.cache)")
+    ("no-gtf-cache", "Don't read or write the parsed annotation cache")
     ("skip,s", po::value< string >()->default_value("MT,chrM"), "Comma separated list of chromosomes to skip")
     ("bam,b", po::value< string >(), "The bam file for de novo junctions (optional)")
     ("read-size,n", po::value< unsigned int >(), "Read Size")
-    ("max-iter", po::value< unsigned int >()->default_value(1000), "Maximum number of graph iterations before giving up on a locus")
+    ("threads,t", po::value< unsigned int >()->default_value(4), "Number of threads to use for junction extraction and path enumeration, a sam input is parsed with up to half of them")
+    ("convert", po::value< string >(), "Convert an existing transcriptome .txt index to a binary .fdb fragment database and exit")
+    ("update,u", po::value< string >(), "Prefix of an existing transcriptome to update, unchanged locuses keep their fragment ids and only new sequences are written to the fasta file")
     ("debug,d", "Whether the reads are stranded or not")
     ("help,h", "help message")
     ;
@@ -268,8 +265,14 @@ void tx_init_options(int argc, char *argv[], po::variables_map & vm) {
     ;
 
 
+    // Options that are still accepted so existing command lines keep working
+    po::options_description deprecated("Deprecated Options");
+    deprecated.add_options()
+    ("max-iter", po::value< unsigned int >(), "Ignored, the path search doesn't need an iteration limit")
+    ;
+
     po::options_description cmdline_options;
-    cmdline_options.add(generic).add(filter);
+    cmdline_options.add(generic).add(filter).add(deprecated);
 
     po::options_description visible;
     visible.add(generic).add(filter);
@@ -291,6 +294,12 @@ void tx_init_options(int argc, char *argv[], po::variables_map & vm) {
         exit(0);
     }
 
+    if(vm.count("max-iter")) {
+        cout << "Warning --max-iter is deprecated and ignored, every locus is searched without an iteration limit\n";
+    }
+
+    if(vm.count("convert")) return;
+
     bool error = false;
 
     if(vm.count("ref") == 0) {
@@ -313,6 +322,12 @@ void tx_init_options(int argc, char *argv[], po::variables_map & vm) {
         error = true;
     }
 
+    // Checked before any output is opened, the outputs would truncate the transcriptome being updated
+    if(vm.count("update") > 0 && vm.count("out") > 0 && same_file(vm["update"].as<string>() + ".loci", vm["out"].as<string>() + ".loci")) {
+        cout << "The updated transcriptome must use a different output prefix\n";
+        error = true;
+    }
+
     if(error) exit(1);
 }
 
@@ -321,18 +336,196 @@ struct JunctionCount {
 
     }
 
-    std::unordered_set<uint64_t> positions;
+    void merge(const JunctionCount & jc){
+        count += jc.count;
+        ends  += jc.ends;
+        positions.merge(jc.positions);
+    }
+
+    // Distinct fragment blocks supporting the junction
+    DistinctCounter              positions;
     unsigned int                 count;
     unsigned int                 ends;
 };
 
+struct JunctionHash {
+    size_t operator()(const Junction & j) const {
+        uint64_t h = (static_cast<uint64_t>(j.tid) << 40) ^ (static_cast<uint64_t>(j.lft) << 8) ^ j.strand;
+        h ^= static_cast<uint64_t>(j.rgt) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+};
+
+typedef std::unordered_map<Junction, JunctionCount, JunctionHash> JunctionCounts;
+
 bool is_skip(CigarElement c) { return c.op == REF_SKIP; }
 
+// Reads up to batch.size() raw entries, returns the number read
+size_t read_batch(BamReader & bin, std::vector<bam1_t*> & batch) {
+    size_t n = 0;
+    while(n < batch.size() && bin.get_struct(batch[n])) n++;
+    return n;
+}
+
+/*
+  Counts the junctions of a batch of raw bam entries, the counts are split into
+  one shard per thread by the junction hash so the shards can be merged in parallel
+*/
+class JunctionExtractor {
+    public:
+        JunctionExtractor(const FastaIndex & fi, const SpliceSiteMap & splice_sites, const SpliceStrand & infer_strand,
+                          const BamHeader & header, const std::vector<int> & tidmap, size_t shards)
+            : fi_(fi), splice_sites_(splice_sites), infer_strand_(infer_strand), header_(header), tidmap_(tidmap),
+              shards_(shards), use_repeats_(false), min_length_(0), end_cutoff_(0), running_(false)
+        {
+
+        }
+
+        void set_params(bool use_repeats, unsigned int min_length, unsigned int end_cutoff){
+            use_repeats_ = use_repeats;
+            min_length_  = min_length;
+            end_cutoff_  = end_cutoff;
+        }
+
+        void init(std::vector<bam1_t*>::const_iterator start, std::vector<bam1_t*>::const_iterator end){
+            start_ = start;
+            end_   = end;
+        }
+
+        void operator()() {
+            for(std::vector<bam1_t*>::const_iterator it = start_; it != end_; ++it){
+                if((*it)->core.tid < 0) continue;
+                r_.load_from_struct(*it, header_.tname((*it)->core.tid));
+                process_(r_);
+            }
+        }
+
+        // Merges shard s of every thread into the shard of this thread
+        void merge(size_t s, const std::vector<JunctionExtractor*> & threads){
+            JunctionCounts & counts = shards_[s];
+            for(size_t i = 0; i < threads.size(); i++){
+                if(threads[i] == this) continue;
+                JunctionCounts & other = threads[i]->shards_[s];
+                for(auto const & j : other){
+                    counts[j.first].merge(j.second);
+                }
+                JunctionCounts().swap(other);
+            }
+        }
+
+        const JunctionCounts & shard(size_t s) const {
+            return shards_[s];
+        }
+
+        void start() {
+            running_ = true;
+            thread_  = boost::thread(boost::ref(*this));
+        }
+
+        void start_merge(size_t s, const std::vector<JunctionExtractor*> & threads) {
+            running_ = true;
+            thread_  = boost::thread(&JunctionExtractor::merge, this, s, boost::cref(threads));
+        }
+
+        void join() {
+            if(running_) {
+                thread_.join();
+                running_ = false;
+            }
+        }
+
+    private:
+        void process_(BamRead & r);
+
+        const FastaIndex                         & fi_;
+        const SpliceSiteMap                      & splice_sites_;
+        const SpliceStrand                       & infer_strand_;
+        const BamHeader                          & header_;
+        const std::vector<int>                   & tidmap_;
+
+        std::vector<JunctionCounts>                shards_;
+        JunctionHash                               hash_;
+        BamRead                                    r_;
+
+        bool                                       use_repeats_;
+        unsigned int                               min_length_;
+        unsigned int                               end_cutoff_;
+
+        std::vector<bam1_t*>::const_iterator       start_;
+        std::vector<bam1_t*>::const_iterator       end_;
+        boost::thread                              thread_;
+        bool                                       running_;
+};
+
+void JunctionExtractor::process_(BamRead & r){
+    if(!r.aligned() || !r.flag.paired || !r.flag.proper_pair || r.flag.secondary){
+        return;
+    }
+
+    size_t num_juncs = std::count_if(r.cigar.begin(), r.cigar.end(), is_skip);
+    if(num_juncs == 0 || (!use_repeats_ && r.repeat())) return;
+
+    uint64_t block = 0;
+    if(r.flag.paired && r.flag.proper_pair){
+        int tlen = r.tlen();
+        if(tlen < 0){
+            block = (static_cast<uint64_t>(r.rgt() + r.cigar.back_clipped() - (tlen - 1)) << 32) | static_cast<uint64_t>(r.lft() - r.cigar.front_clipped() + tlen - 1);
+        }else{
+            block = (static_cast<uint64_t>(r.lft()) << 32) | static_cast<uint64_t>(r.lft() + tlen - 1);
+        }
+    }
+
+    size_t junc_num = 1;
+    SeedIterator<Cigar::const_iterator> bit(r.cigar.begin(), r.cigar.end(), r.lft(), 0);
+    Seed l = bit();
+
+    int tid = tidmap_[r.tid()];
+    const PackedSequence & ref = fi_[tid].seq;
+    unsigned int qrgt = r.qrgt();
+
+    while(bit.next()){
+        Junction j(tid, l.rrgt(), bit().rlft(), UNKNOWN);
+        Strand s1 = splice_sites_.find(tid, j.lft).infer();
+        Strand s2 = splice_sites_.find(tid, j.rgt).infer();
+        Strand strand;
+
+        if((s1 == UNKNOWN && s2 == UNKNOWN) || (s1 != UNKNOWN && s2 != UNKNOWN && s1 != s2)){
+            strand = infer_strand_.strand(ref[j.lft + 1], ref[j.lft + 2], ref[j.rgt - 2], ref[j.rgt - 1]);
+        }else{
+            strand = s1 == UNKNOWN ? s2 : s1;
+        }
+
+        bool end = l.qrgt() < end_cutoff_ || r.qlft() >= (qrgt - end_cutoff_);
+
+        j.strand = strand;
+
+        if((junc_num != 1 || l.score() >= static_cast<int>(min_length_)) 
+            && (junc_num != num_juncs || bit().score() >= static_cast<int>(min_length_))){
+
+            JunctionCount & jc = shards_[hash_(j) % shards_.size()][j];
+            jc.count++;
+            jc.positions.insert(block);
+            if(end) jc.ends++;
+        }
+        l = bit();
+        junc_num++;
+    }
+}
+
 int rnasequel::build_transcriptome(int argc, char * argv[]) {
     Timer ti("Total time building the transcriptome");
     po::variables_map vm;
     tx_init_options(argc,argv,vm);
 
+    if(vm.count("convert")) {
+        string txt = vm["convert"].as<string>();
+        string out = vm.count("out") ? vm["out"].as<string>() : txt.substr(0, txt.find_last_of("."));
+        FragmentDB db(txt);
+        db.save(out + ".fdb");
+        cout << "Wrote " << db.size() << " fragments to " << out << ".fdb\n";
+        return 0;
+    }
+
     FastaIndex fi(vm["ref"].as<string>());
     fi.load_all(false);
     unsigned int read_size  = vm["read-size"].as<unsigned int>();
@@ -358,8 +551,8 @@ int rnasequel::build_transcriptome(int argc, char * argv[]) {
     if(vm.count("gtf") > 0) {
         int min_intron = vm["min-intron"].as<unsigned int>();
 	Model m;
-	GTF::parse(vm["gtf"].as<string>(), m);
-        splice_sites.build_from_model(m);
+	GTF::parse(vm["gtf"].as<string>(), m, vm["threads"].as<unsigned int>(), GTF::cache_file(vm));
+        splice_sites.build_from_model(m, fi);
         size_t kept = 0;
 	for(Model::iterator it = m.begin(); it != m.end(); it++){
 	    unsigned int tid = fi.tid(it->first);
@@ -389,9 +582,8 @@ int rnasequel::build_transcriptome(int argc, char * argv[]) {
     if(vm.count("bam") > 0){
         bool use_repeats = vm.count("use-repeats") > 0;
         SpliceStrand infer_strand(vm["canonical"].as<string>());
-        std::map<Junction, JunctionCount> counts;
+        SamReader::set_parsers(vm["threads"].as<unsigned int>() / 2);
         BamReader bin(vm["bam"].as<string>());
-        BamRead r;
 
         size_t min_length = vm["min-length"].as<unsigned int>();
         unsigned int end_cutoff = vm["end-cutoff"].as<unsigned int>();
@@ -401,74 +593,87 @@ int rnasequel::build_transcriptome(int argc, char * argv[]) {
             tidmap[i] = fi[bin.header()[i]].tid;
         }
 
+        // The distinct fragment counts are exact up to the largest threshold they're compared to
+        DistinctCounter::set_exact(std::max(vm["min-unique"].as<unsigned int>(), vm["min-nc-unique"].as<unsigned int>()));
+
+        std::vector<JunctionExtractor*> threads(std::max(vm["threads"].as<unsigned int>(), 1U));
+        for(size_t i = 0; i < threads.size(); i++){
+            threads[i] = new JunctionExtractor(fi, splice_sites, infer_strand, bin.header(), tidmap, threads.size());
+            threads[i]->set_params(use_repeats, min_length, end_cutoff);
+        }
+
+        // Two batches, the next one is read while the workers count the current one
+        const size_t STEP = 0x40000;
+        std::vector<bam1_t*> batches[2];
+        for(size_t b = 0; b < 2; b++){
+            batches[b].resize(STEP);
+            for(size_t i = 0; i < STEP; i++){
+                batches[b][i] = bam_init1();
+            }
+        }
+
         cout << "Extracting novel splice junctions" << endl;
         Timer ti2("Time extracting junctions");
         size_t total = 0;
-        while(bin.get_read(r)){
-            total++;
-            if(total % 0x40000 == 0){
-                time_t e = ti2.elapsed();
-                if(e > 0){
-                    std::cerr << "\33[2K\rTotal processed: " << total 
-                        << ",  reads / second: " << (total / e);
-                    std::cerr.flush();
-                }
+        size_t cur   = 0;
+        size_t n     = read_batch(bin, batches[cur]);
+        while(n > 0){
+            std::vector<bam1_t*> & batch = batches[cur];
+            size_t next = 0;
+            boost::thread reader;
+            if(n == batch.size()){
+                reader = boost::thread([&]() { next = read_batch(bin, batches[cur ^ 1]); });
             }
 
-            if(!r.aligned() || !r.flag.paired || !r.flag.proper_pair || r.flag.secondary){
-                continue;
-            }
-            
-            size_t num_juncs = std::count_if(r.cigar.begin(), r.cigar.end(), is_skip);
-            if(num_juncs == 0 || (!use_repeats && r.repeat())) continue;
-
-            uint64_t block = 0;
-            if(r.flag.paired && r.flag.proper_pair){
-                int tlen = r.tlen();
-                if(tlen < 0){
-                    block = (static_cast<uint64_t>(r.rgt() + r.cigar.back_clipped() - (tlen - 1)) << 32) | static_cast<uint64_t>(r.lft() - r.cigar.front_clipped() + tlen - 1);
-                }else{
-                    block = (static_cast<uint64_t>(r.lft()) << 32) | static_cast<uint64_t>(r.lft() + tlen - 1);
+            size_t start   = 0;
+            size_t num_per = n / threads.size();
+            size_t extra   = n - num_per * threads.size();
+            for(size_t i = 0; i < threads.size(); i++){
+                size_t end = start + num_per;
+                if(extra > 0){
+                    end++;
+                    extra--;
                 }
+                threads[i]->init(batch.begin() + start, batch.begin() + end);
+                start = end;
             }
 
-            size_t junc_num = 1;
-            SeedIterator<Cigar::const_iterator> bit(r.cigar.begin(), r.cigar.end(), r.lft(), 0);
-            Seed l = bit();
-
-            int tid = tidmap[r.tid()];
-            const PackedSequence & ref = fi[tid].seq;
-            unsigned int qrgt = r.qrgt();
-
-            while(bit.next()){
-                Junction j(tid, l.rrgt(), bit().rlft(), UNKNOWN);
-                Strand s1 = splice_sites.find(r.tname(), j.lft).infer();
-                Strand s2 = splice_sites.find(r.tname(), j.rgt).infer();
-                Strand strand;
-
-                if((s1 == UNKNOWN && s2 == UNKNOWN) || (s1 != UNKNOWN && s2 != UNKNOWN && s1 != s2)){
-                    strand = infer_strand.strand(ref[j.lft + 1], ref[j.lft + 2], ref[j.rgt - 2], ref[j.rgt - 1]);
-                }else{
-                    strand = s1 == UNKNOWN ? s2 : s1;
-                }
-
-                bool end = l.qrgt() < end_cutoff || r.qlft() >= (qrgt - end_cutoff);
-
-                j.strand = strand;
-
-                if((junc_num != 1 || l.score() >= static_cast<int>(min_length)) 
-                    && (junc_num != num_juncs || bit().score() >= static_cast<int>(min_length))){
+            for(size_t i = 1; i < threads.size(); i++){
+                threads[i]->start();
+            }
+            threads[0]->operator()();
+            for(size_t i = 1; i < threads.size(); i++){
+                threads[i]->join();
+            }
+            if(reader.joinable()) reader.join();
+
+            total += n;
+            time_t e = ti2.elapsed();
+            if(e > 0){
+                std::cerr << "\33[2K\rTotal processed: " << total 
+                    << ",  reads / second: " << (total / e);
+                std::cerr.flush();
+            }
+            n    = next;
+            cur ^= 1;
+        }
 
-                    JunctionCount & jc = counts[j];
-                    jc.count++;
-                    jc.positions.insert(block);
-                    if(end) jc.ends++;
-                }
-                l = bit();
-                junc_num++;
+        for(size_t b = 0; b < 2; b++){
+            for(size_t i = 0; i < batches[b].size(); i++){
+                bam_destroy1(batches[b][i]);
             }
         }
 
+        {
+            Timer ti3("Merging the junction counts");
+            for(size_t i = 1; i < threads.size(); i++){
+                threads[i]->start_merge(i, threads);
+            }
+            threads[0]->merge(0, threads);
+            for(size_t i = 1; i < threads.size(); i++){
+                threads[i]->join();
+            }
+        }
 
         unsigned int min_intron    = vm["min-intron"].as<unsigned int>();
         unsigned int max_intron    = vm["max-intron"].as<unsigned int>();
@@ -481,45 +686,52 @@ int rnasequel::build_transcriptome(int argc, char * argv[]) {
         size_t kept = 0, total_novel = 0;
         size_t nc_kept = 0, nc_total_novel = 0;
 
-        for(auto const & j : counts){
-            const Junction & junc    = j.first;
-            const JunctionCount & jc = j.second;
-            unsigned int isize = junc.isize();
-            const PackedSequence & ref = fi[junc.tid].seq;
-            bool canonical = infer_strand.canonical(ref[junc.lft + 1], ref[junc.lft + 2], ref[junc.rgt - 2], ref[junc.rgt - 1]);
-
-            bool found = false;
-            if(junc.strand == PLUS){
-                found = pjuncs.find(junc) != pjuncs.end();
-            }else if(junc.strand == MINUS){
-                found = mjuncs.find(junc) != mjuncs.end();
-            }else{
-                found = ajuncs.find(junc) != ajuncs.end();
-            }
-            
-            if(!found) {
-                if(canonical) total_novel++;
-                else          nc_total_novel++;
-            }
-
-            if((canonical && (jc.count < min_count || jc.positions.size() < min_unique)) ||
-               (!canonical && (jc.count < min_nc_count || jc.positions.size() < min_nc_unique)) || 
-                isize < min_intron || isize > max_intron || (jc.count - jc.ends) < end_count){
-                continue;
-            }
+        for(size_t t = 0; t < threads.size(); t++){
+            for(auto const & j : threads[t]->shard(t)){
+                const Junction & junc    = j.first;
+                const JunctionCount & jc = j.second;
+                unsigned int isize = junc.isize();
+                const PackedSequence & ref = fi[junc.tid].seq;
+                bool canonical = infer_strand.canonical(ref[junc.lft + 1], ref[junc.lft + 2], ref[junc.rgt - 2], ref[junc.rgt - 1]);
 
-            if(!found) {
+                bool found = false;
                 if(junc.strand == PLUS){
-                    pjuncs.insert(junc);
+                    found = pjuncs.find(junc) != pjuncs.end();
                 }else if(junc.strand == MINUS){
-                    mjuncs.insert(junc);
+                    found = mjuncs.find(junc) != mjuncs.end();
                 }else{
-                    ajuncs.insert(junc);
+                    found = ajuncs.find(junc) != ajuncs.end();
+                }
+            
+                if(!found) {
+                    if(canonical) total_novel++;
+                    else          nc_total_novel++;
+                }
+
+                if((canonical && (jc.count < min_count || jc.positions.size() < min_unique)) ||
+                   (!canonical && (jc.count < min_nc_count || jc.positions.size() < min_nc_unique)) || 
+                    isize < min_intron || isize > max_intron || (jc.count - jc.ends) < end_count){
+                    continue;
+                }
+
+                if(!found) {
+                    if(junc.strand == PLUS){
+                        pjuncs.insert(junc);
+                    }else if(junc.strand == MINUS){
+                        mjuncs.insert(junc);
+                    }else{
+                        ajuncs.insert(junc);
+                    }
+                    if(canonical) kept++;
+                    else          nc_kept++;
                 }
-                if(canonical) kept++;
-                else          nc_kept++;
             }
         }
+
+        for(size_t i = 0; i < threads.size(); i++){
+            delete threads[i];
+        }
+
         cout << "\n\nKept " << kept << " out of " << total_novel << " novel junctions\n";
         if(!skip_nc) cout << "Kept " << nc_kept << " out of " << nc_total_novel << " non-canonical novel junctions\n";
     }
@@ -549,9 +761,13 @@ int rnasequel::build_transcriptome(int argc, char * argv[]) {
         }
     }
 
-    Transcriptome builder(vm["out"].as<string>(), fi, read_size, vm["max-iter"].as<unsigned int>(), false);
+    Transcriptome builder(vm["out"].as<string>(), fi, read_size, vm["threads"].as<unsigned int>(), false);
+    if(vm.count("update")){
+        builder.load(vm["update"].as<string>(), pjuncs, mjuncs);
+    }
     builder.process_junctions(pjuncs, PLUS);
     builder.process_junctions(mjuncs, MINUS);
+    builder.close();
 
     return 0;
 }
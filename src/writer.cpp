@@ -18,6 +18,7 @@ along with RNASequel.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "writer.hpp"
+#include "failure.hpp"
 #include <iostream>
 using namespace rnasequel;
 using namespace std;
@@ -39,8 +40,7 @@ void BamWriter::open(const std::string & out, const BamHeader & h, bool bam){
         _out = samopen(out.c_str(), bam ? "wb" : "wh", h.cstruct());
 
     if(_out == NULL) {
-        std::cerr << "Error opening the bam file `" << out << "` for writing\n";
-        exit(1);
+        fail("opening the bam file `" + out + "` for writing");
     }
 }
 